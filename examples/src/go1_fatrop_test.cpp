@@ -0,0 +1,65 @@
+#include "go1_test.h"
+
+/*The go1 problem with fatrop, which is given the dimensions of every stage of the horizon*/
+const std::string fatrop_solver_parameter_location = "../resources/go1/Parameters/fatrop_solver_parameters.txt";
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> end_effector_names;
+    std::vector<int> knot_num;
+    std::vector<double> knot_time;
+    std::vector<std::vector<galileo::legged::environment::SurfaceID>> contact_surfaces;
+
+    std::vector<double> q0_vec;
+    std::vector<double> qf_vec;
+
+    galileo::legged::helper::ReadProblemFromParameterFile(problem_parameter_location,
+                                                          end_effector_names,
+                                                          knot_num,
+                                                          knot_time,
+                                                          contact_surfaces,
+                                                          q0_vec,
+                                                          qf_vec);
+
+    galileo::legged::LeggedInterface solver_interface;
+
+    solver_interface.LoadModel(robot_location, end_effector_names);
+    solver_interface.LoadParameters(fatrop_solver_parameter_location);
+
+    int nx = solver_interface.states()->nx;
+    int q_idx = solver_interface.states()->q_index;
+
+    casadi::DM X0;
+    std::vector<double> X0_vec = galileo::legged::helper::getXfromq(solver_interface.states()->nx, q_idx, q0_vec);
+    galileo::tools::vectorToCasadi(X0_vec, nx, 1, X0);
+
+    casadi::DM Xf;
+    std::vector<double> Xf_vec = galileo::legged::helper::getXfromq(solver_interface.states()->nx, q_idx, qf_vec);
+    galileo::tools::vectorToCasadi(Xf_vec, nx, 1, Xf);
+
+    solver_interface.addSurface(environment::createInfiniteGround());
+
+    std::vector<uint> mask_vec = galileo::legged::helper::getMaskVectorFromContactSurfaces(contact_surfaces);
+
+    solver_interface.setContactSequence(
+        knot_num,
+        knot_time,
+        mask_vec,
+        contact_surfaces);
+
+    solver_interface.Initialize(X0, Xf);
+    solver_interface.Update(X0, Xf);
+
+    opt::SolveStats stats = solver_interface.getSolveStats();
+    std::cout << "fatrop return status: " << stats.return_status << std::endl;
+    std::cout << "Iterations: " << stats.iterations << std::endl;
+    std::cout << "Max constraint violation: " << stats.constraint_violation << std::endl;
+    /*The iteration limit of the parameter file may stop fatrop before it converges, so a feasible iterate also passes*/
+    if (!stats.success && stats.constraint_violation > 1e-4)
+    {
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
+    std::cout << "PASSED" << std::endl;
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "galileo/opt/Solution.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+using namespace galileo::opt::solution;
+
+/*Every allocation of the process is counted. Eigen allocates with malloc and posix_memalign, and operator new with malloc,
+so the glibc allocation functions are interposed, and operator new is routed through them*/
+static std::atomic<size_t> num_allocations{0};
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+
+    void *malloc(size_t size)
+    {
+        ++num_allocations;
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        ++num_allocations;
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        ++num_allocations;
+        return __libc_realloc(ptr, size);
+    }
+
+    int posix_memalign(void **ptr, size_t alignment, size_t size)
+    {
+        ++num_allocations;
+        *ptr = __libc_memalign(alignment, size);
+        return *ptr == nullptr ? ENOMEM : 0;
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size)
+    {
+        ++num_allocations;
+        return __libc_memalign(alignment, size);
+    }
+}
+
+void *operator new(std::size_t size)
+{
+    if (void *ptr = malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { free(ptr); }
+
+/*The solution of row r is r + slope * t, which every interpolating polynomial reproduces exactly*/
+const double slope = 2.0;
+
+solution_segment_data_t createSegment(double initial_time, double end_time, int num_knots, int degree, Eigen::Index nx, Eigen::Index nu)
+{
+    solution_segment_data_t segment;
+    segment.initial_time = initial_time;
+    segment.end_time = end_time;
+    segment.num_knots = num_knots;
+    segment.state_degree = degree;
+    segment.input_degree = degree;
+    segment.state_poly = galileo::opt::LagrangePolynomial(degree, "radau");
+    segment.input_poly = segment.state_poly;
+
+    /*Each knot has a column per root, and the state has a last column at the end of the segment*/
+    double h = (end_time - initial_time) / num_knots;
+    Eigen::Index nodes = segment.state_poly.tau_root.size();
+    segment.state_times.resize(num_knots * nodes + 1);
+    segment.input_times.resize(num_knots * nodes);
+    for (int k = 0; k < num_knots; ++k)
+    {
+        for (Eigen::Index j = 0; j < nodes; ++j)
+        {
+            segment.state_times(k * nodes + j) = initial_time + (k + segment.state_poly.tau_root[j]) * h;
+            segment.input_times(k * nodes + j) = segment.state_times(k * nodes + j);
+        }
+    }
+    segment.state_times(num_knots * nodes) = end_time;
+
+    segment.solx_segment.resize(nx, segment.state_times.size());
+    segment.solu_segment.resize(nu, segment.input_times.size());
+    for (Eigen::Index r = 0; r < nx; ++r)
+        segment.solx_segment.row(r) = (double(r) + slope * segment.state_times.array()).matrix().transpose();
+    for (Eigen::Index r = 0; r < nu; ++r)
+        segment.solu_segment.row(r) = (double(r) + slope * segment.input_times.array()).matrix().transpose();
+    return segment;
+}
+
+int main()
+{
+    const Eigen::Index nx = 6;
+    const Eigen::Index nu = 4;
+    const Eigen::Index num_queries = 200;
+    const int num_repeats = 1000;
+
+    Solution solution;
+    solution.UpdateSolution({createSegment(0.0, 0.5, 5, 3, nx, nu), createSegment(0.5, 1.2, 8, 2, nx, nu)});
+
+    /*Everything the queries write to is allocated up front*/
+    Eigen::VectorXd query_times = Eigen::VectorXd::LinSpaced(num_queries, 0.0, 1.2);
+    Eigen::MatrixXd state_result(nx, num_queries);
+    Eigen::MatrixXd input_result(nu, num_queries);
+    std::vector<Eigen::MatrixXd> state_derivatives = {Eigen::MatrixXd(nx, num_queries)};
+    std::vector<Eigen::MatrixXd> input_derivatives = {Eigen::MatrixXd(nu, num_queries)};
+    query_workspace_t workspace;
+    solution.PrepareWorkspace(workspace, 1);
+    Solution::AccessSolutionError sol_error;
+
+    size_t allocations_before = num_allocations;
+    bool success = true;
+    for (int repeat = 0; repeat < num_repeats; ++repeat)
+    {
+        success &= solution.GetSolution(query_times, workspace, state_result, input_result, state_derivatives, input_derivatives, sol_error);
+        success &= solution.GetSolution(query_times, workspace, state_result, input_result);
+    }
+    size_t allocations = num_allocations - allocations_before;
+
+    double error = 0.0;
+    for (Eigen::Index i = 0; i < num_queries; ++i)
+    {
+        for (Eigen::Index r = 0; r < nx; ++r)
+        {
+            error = std::max(error, std::abs(state_result(r, i) - (r + slope * query_times(i))));
+            error = std::max(error, std::abs(state_derivatives[0](r, i) - slope));
+        }
+        for (Eigen::Index r = 0; r < nu; ++r)
+            error = std::max(error, std::abs(input_result(r, i) - (r + slope * query_times(i))));
+    }
+
+    std::cout << "Allocations in " << 2 * num_repeats << " workspace queries: " << allocations << std::endl;
+    std::cout << "Max interpolation error: " << error << std::endl;
+    if (!success || allocations != 0 || error > 1e-8)
+    {
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
+    std::cout << "PASSED" << std::endl;
+    return 0;
+}
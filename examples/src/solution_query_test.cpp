@@ -0,0 +1,247 @@
+#include "galileo/opt/Solution.h"
+#include "galileo/opt/SolutionLog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace galileo::opt::solution;
+
+/*The solution of row r is r + slope * t + curvature * t^2, which every interpolating polynomial of degree 2 or more reproduces exactly*/
+const double slope = 2.0;
+const double curvature = -1.5;
+
+double trajectory(Eigen::Index r, double t) { return double(r) + slope * t + curvature * t * t; }
+
+solution_segment_data_t createSegment(double initial_time, double end_time, int num_knots, int degree, Eigen::Index nx, Eigen::Index nu)
+{
+    solution_segment_data_t segment;
+    segment.initial_time = initial_time;
+    segment.end_time = end_time;
+    segment.num_knots = num_knots;
+    segment.state_degree = degree;
+    segment.input_degree = degree;
+    segment.state_poly = galileo::opt::LagrangePolynomial(degree, "radau");
+    segment.input_poly = segment.state_poly;
+
+    /*Each knot has a column per root, and the state has a last column at the end of the segment*/
+    double h = (end_time - initial_time) / num_knots;
+    Eigen::Index nodes = segment.state_poly.tau_root.size();
+    segment.state_times.resize(num_knots * nodes + 1);
+    segment.input_times.resize(num_knots * nodes);
+    for (int k = 0; k < num_knots; ++k)
+    {
+        for (Eigen::Index j = 0; j < nodes; ++j)
+        {
+            segment.state_times(k * nodes + j) = initial_time + (k + segment.state_poly.tau_root[j]) * h;
+            segment.input_times(k * nodes + j) = segment.state_times(k * nodes + j);
+        }
+    }
+    segment.state_times(num_knots * nodes) = end_time;
+
+    segment.solx_segment.resize(nx, segment.state_times.size());
+    segment.solu_segment.resize(nu, segment.input_times.size());
+    for (Eigen::Index i = 0; i < segment.state_times.size(); ++i)
+    {
+        for (Eigen::Index r = 0; r < nx; ++r)
+            segment.solx_segment(r, i) = trajectory(r, segment.state_times(i));
+    }
+    for (Eigen::Index i = 0; i < segment.input_times.size(); ++i)
+    {
+        for (Eigen::Index r = 0; r < nu; ++r)
+            segment.solu_segment(r, i) = trajectory(r, segment.input_times(i));
+    }
+    return segment;
+}
+
+/*Prints the result of a check, and returns whether it passed*/
+bool check(const std::string &name, double error, double tolerance = 1e-8)
+{
+    bool passed = error <= tolerance;
+    std::cout << name << ": max error " << error << (passed ? " PASSED" : " FAILED") << std::endl;
+    return passed;
+}
+
+int main()
+{
+    const Eigen::Index nx = 6;
+    const Eigen::Index nu = 4;
+    const Eigen::Index num_queries = 97;
+    const double end_time = 1.2;
+
+    Solution solution;
+    solution.UpdateSolution({createSegment(0.0, 0.5, 5, 3, nx, nu), createSegment(0.5, end_time, 8, 2, nx, nu)});
+
+    Eigen::VectorXd query_times = Eigen::VectorXd::LinSpaced(num_queries, 0.0, end_time);
+    bool success = true;
+
+    /*A prepared query gives the same values as an unprepared one, before and after the solution is replaced by one of a new layout*/
+    {
+        Eigen::MatrixXd state_result(nx, num_queries);
+        Eigen::MatrixXd input_result(nu, num_queries);
+        Eigen::MatrixXd prepared_state_result;
+        Eigen::MatrixXd prepared_input_result;
+        prepared_query_t query(query_times);
+        solution.PrepareQuery(query);
+
+        double error = 0.0;
+        for (int layout = 0; layout < 2; ++layout)
+        {
+            if (layout == 1)
+                solution.UpdateSolution({createSegment(0.0, 0.7, 4, 2, nx, nu), createSegment(0.7, end_time, 6, 4, nx, nu)});
+            success &= solution.GetSolution(query_times, state_result, input_result);
+            success &= solution.GetSolution(query, prepared_state_result, prepared_input_result);
+            error = std::max(error, (prepared_state_result - state_result).cwiseAbs().maxCoeff());
+            error = std::max(error, (prepared_input_result - input_result).cwiseAbs().maxCoeff());
+        }
+        success &= check("Prepared query against GetSolution", error);
+    }
+
+    /*The first and second time derivatives are those of the quadratic, and the third is zero, from both kinds of queries*/
+    {
+        const int derivative_order = 3;
+        std::vector<Eigen::MatrixXd> state_results;
+        std::vector<Eigen::MatrixXd> input_results;
+        Solution::AccessSolutionError sol_error;
+        success &= solution.GetSolution(query_times, derivative_order, state_results, input_results, sol_error);
+
+        Eigen::MatrixXd prepared_state_result;
+        Eigen::MatrixXd prepared_input_result;
+        std::vector<Eigen::MatrixXd> prepared_state_derivatives;
+        std::vector<Eigen::MatrixXd> prepared_input_derivatives;
+        prepared_query_t query(query_times);
+        query.derivative_order = derivative_order;
+        success &= solution.GetSolution(query, prepared_state_result, prepared_input_result, prepared_state_derivatives, prepared_input_derivatives);
+
+        double error = 0.0;
+        double prepared_error = 0.0;
+        for (int k = 1; k <= derivative_order; ++k)
+        {
+            for (Eigen::Index i = 0; i < num_queries; ++i)
+            {
+                double expected = k == 1 ? slope + 2 * curvature * query_times(i) : (k == 2 ? 2 * curvature : 0.0);
+                for (Eigen::Index r = 0; r < nx; ++r)
+                {
+                    error = std::max(error, std::abs(state_results[k](r, i) - expected));
+                    prepared_error = std::max(prepared_error, std::abs(prepared_state_derivatives[k - 1](r, i) - expected));
+                }
+                for (Eigen::Index r = 0; r < nu; ++r)
+                {
+                    error = std::max(error, std::abs(input_results[k](r, i) - expected));
+                    prepared_error = std::max(prepared_error, std::abs(prepared_input_derivatives[k - 1](r, i) - expected));
+                }
+            }
+        }
+        success &= check("Analytic derivatives", error, 1e-6);
+        success &= check("Prepared analytic derivatives", prepared_error, 1e-6);
+    }
+
+    /*The exported monomials evaluated with Horner's method match the barycentric interpolation at and between the breakpoints,
+    also after a round trip through a blob*/
+    {
+        piecewise_monomial_t state_monomial;
+        piecewise_monomial_t input_monomial;
+        success &= solution.ExportMonomial(state_monomial, input_monomial);
+
+        std::vector<double> monomial_times;
+        for (size_t i = 0; i + 1 < state_monomial.breakpoints.size(); ++i)
+        {
+            monomial_times.push_back(state_monomial.breakpoints[i]);
+            monomial_times.push_back(0.5 * (state_monomial.breakpoints[i] + state_monomial.breakpoints[i + 1]));
+        }
+        monomial_times.push_back(state_monomial.breakpoints.back());
+        Eigen::VectorXd times = Eigen::Map<Eigen::VectorXd>(monomial_times.data(), monomial_times.size());
+
+        Eigen::MatrixXd state_result(nx, times.size());
+        Eigen::MatrixXd input_result(nu, times.size());
+        success &= solution.GetSolution(times, state_result, input_result);
+
+        auto blob = state_monomial.Serialize();
+        piecewise_monomial_t state_copy;
+        success &= piecewise_monomial_t::Deserialize(blob.data(), blob.size(), state_copy);
+
+        Eigen::VectorXd state_value(nx);
+        Eigen::VectorXd copy_value(nx);
+        Eigen::VectorXd input_value(nu);
+        double error = 0.0;
+        for (Eigen::Index i = 0; i < times.size(); ++i)
+        {
+            success &= state_monomial.Evaluate(times(i), state_value);
+            success &= state_copy.Evaluate(times(i), copy_value);
+            error = std::max(error, (state_value - state_result.col(i)).cwiseAbs().maxCoeff());
+            error = std::max(error, (copy_value - state_result.col(i)).cwiseAbs().maxCoeff());
+            success &= input_monomial.Evaluate(times(i), input_value);
+            error = std::max(error, (input_value - input_result.col(i)).cwiseAbs().maxCoeff());
+        }
+        success &= check("Horner evaluation against barycentric interpolation", error);
+    }
+
+    /*Solutions read back from a log are the ones written, and a record cut short by an interrupted write is ignored*/
+    {
+        std::vector<std::vector<solution_segment_data_t>> logged = {{createSegment(0.0, 0.5, 5, 3, nx, nu), createSegment(0.5, end_time, 8, 2, nx, nu)},
+                                                                    {createSegment(0.0, end_time, 7, 4, nx, nu)}};
+        std::string log_name = (std::filesystem::temp_directory_path() / "galileo_solution_query_test.log").string();
+        std::filesystem::remove(log_name);
+        for (const std::vector<solution_segment_data_t> &segments : logged)
+            success &= SolutionLog::AppendSolution(log_name, segments);
+        std::uintmax_t complete_size = std::filesystem::file_size(log_name);
+        success &= SolutionLog::AppendSolution(log_name, logged[0]);
+        std::filesystem::resize_file(log_name, complete_size + (std::filesystem::file_size(log_name) - complete_size) / 2);
+
+        SolutionLog solution_log;
+        success &= solution_log.Open(log_name);
+        success &= solution_log.NumSolutions() == logged.size();
+        double error = 0.0;
+        for (size_t index = 0; index < std::min(solution_log.NumSolutions(), logged.size()); ++index)
+        {
+            std::vector<solution_segment_data_t> segments;
+            std::vector<std::vector<galileo::opt::constraint_metadata_t>> constraint_metadata;
+            success &= solution_log.ReadSolution(index, segments, constraint_metadata);
+            success &= segments.size() == logged[index].size();
+            for (size_t j = 0; j < std::min(segments.size(), logged[index].size()); ++j)
+            {
+                const solution_segment_data_t &read = segments[j];
+                const solution_segment_data_t &written = logged[index][j];
+                success &= read.num_knots == written.num_knots && read.state_degree == written.state_degree && read.input_degree == written.input_degree &&
+                           read.solx_segment.rows() == written.solx_segment.rows() && read.solx_segment.cols() == written.solx_segment.cols() &&
+                           read.solu_segment.rows() == written.solu_segment.rows() && read.solu_segment.cols() == written.solu_segment.cols() &&
+                           read.state_times.size() == written.state_times.size() && read.input_times.size() == written.input_times.size();
+                if (!success)
+                    break;
+                error = std::max(error, std::abs(read.initial_time - written.initial_time) + std::abs(read.end_time - written.end_time));
+                error = std::max(error, (read.solx_segment - written.solx_segment).cwiseAbs().maxCoeff());
+                error = std::max(error, (read.solu_segment - written.solu_segment).cwiseAbs().maxCoeff());
+                error = std::max(error, (read.state_times - written.state_times).cwiseAbs().maxCoeff());
+                error = std::max(error, (read.input_times - written.input_times).cwiseAbs().maxCoeff());
+            }
+
+            /*The loaded solution interpolates like the logged one*/
+            Solution loaded;
+            Solution expected;
+            success &= solution_log.LoadSolution(index, loaded);
+            expected.UpdateSolution(logged[index]);
+            Eigen::MatrixXd state_result(nx, num_queries);
+            Eigen::MatrixXd input_result(nu, num_queries);
+            Eigen::MatrixXd expected_state_result(nx, num_queries);
+            Eigen::MatrixXd expected_input_result(nu, num_queries);
+            success &= loaded.GetSolution(query_times, state_result, input_result);
+            success &= expected.GetSolution(query_times, expected_state_result, expected_input_result);
+            error = std::max(error, (state_result - expected_state_result).cwiseAbs().maxCoeff());
+            error = std::max(error, (input_result - expected_input_result).cwiseAbs().maxCoeff());
+        }
+        solution_log.Close();
+        std::filesystem::remove(log_name);
+        success &= check("Solution log round trip", error, 0.0);
+    }
+
+    if (!success)
+    {
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
+    std::cout << "PASSED" << std::endl;
+    return 0;
+}
@@ -217,7 +217,8 @@ namespace galileo
             FootstepDefinition VelocityConstraintBuilder<ProblemData>::buildFootstepDefinition(const ProblemData &problem_data, int phase_index, std::shared_ptr<galileo::legged::contact::EndEffector> ee_ptr) const
             {
 
-                double liftoff_time = 0;
+                /*The sequence may have dropped the phases before the horizon, so it starts wherever its first phase does*/
+                double liftoff_time = problem_data.velocity_constraint_problem_data.contact_sequence->getStartTime();
                 double touchdown_time = problem_data.velocity_constraint_problem_data.contact_sequence->getDT();
                 FootstepDefinition footstep_definition;
 
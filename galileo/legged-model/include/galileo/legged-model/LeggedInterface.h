@@ -1,5 +1,7 @@
 #pragma once
 
+#include <filesystem>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -17,6 +19,7 @@
 #include "galileo/legged-model/LeggedRobotStates.h"
 #include "galileo/legged-model/EnvironmentSurfaces.h"
 #include "galileo/opt/TrajectoryOpt.h"
+#include "galileo/opt/SolutionLog.h"
 #include "galileo/tools/GNUPlotInterface.h"
 #include "galileo/tools/MeshcatInterface.h"
 #include "galileo/tools/CasadiConversions.h"
@@ -85,6 +88,61 @@ namespace galileo
              */
             void Update(const T_ROBOT_STATE &initial_state, const T_ROBOT_STATE &target_state);
 
+            /**
+             * @brief Advance the horizon and solve the problem again. The consumed phases are replaced by cycling through the
+             * phases of the contact sequence given at initialization. Since the gait is periodic, the phases in the horizon repeat,
+             * and the solver built for them is reused; only the parameters, the bounds, and the initial guess are updated.
+             *
+             * @param time_advance The time elapsed since the last solve
+             * @param initial_state The new initial state
+             */
+            void Advance(double time_advance, const T_ROBOT_STATE &initial_state);
+
+            /**
+             * @brief Advance the horizon without solving. In real-time iteration mode, this is the preparation phase, which
+             * also linearizes the problem, and should run before the new state is measured.
+             *
+             * @param time_advance The time elapsed since the last solve
+             * @param predicted_state The predicted initial state at the next solve
+             */
+            void Prepare(double time_advance, const T_ROBOT_STATE &predicted_state);
+
+            /**
+             * @brief Solve the prepared problem from the measured initial state. In real-time iteration mode, this is the
+             * feedback phase, which only solves one QP.
+             *
+             * @param initial_state The measured initial state
+             */
+            void Feedback(const T_ROBOT_STATE &initial_state);
+
+            /**
+             * @brief Get the time, on the contact sequence time line, at which the current horizon starts.
+             */
+            double getHorizonStartTime()
+            {
+                std::lock_guard<std::mutex> lock(trajectory_opt_mutex_);
+                return trajectory_opt_->getHorizonStartTime();
+            }
+
+            /**
+             * @brief Get the statistics of the last solve.
+             */
+            opt::SolveStats getSolveStats()
+            {
+                std::lock_guard<std::mutex> lock(trajectory_opt_mutex_);
+                return trajectory_opt_->getSolveStats();
+            }
+
+            /**
+             * @brief Get the iteration telemetry of the solver. Safe to read from any thread while the solver runs.
+             *
+             * @return std::shared_ptr<const opt::IterationRingBuffer> The ring buffer, or nullptr if telemetry is not enabled
+             */
+            std::shared_ptr<const opt::IterationRingBuffer> getTelemetry() const
+            {
+                return trajectory_opt_ == nullptr ? nullptr : trajectory_opt_->getTelemetry();
+            }
+
             /**
              * @brief Get the solution.
              *
@@ -94,6 +152,47 @@ namespace galileo
              */
             bool GetSolution(const Eigen::VectorXd &query_times, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result);
 
+            /**
+             * @brief Get the solution without allocating, for real-time loops. The workspace is prepared on first use, and again
+             * only if the polynomials of a new solution have a higher degree.
+             *
+             * @param query_times The times at which to get the solution state and input.(num_times x 1 vector)
+             * @param workspace The query workspace, reused between calls
+             * @param state_result The state at the query times, preallocated (num_states x num_times)
+             * @param input_result The input at the query times, preallocated (num_inputs x num_times)
+             */
+            bool GetSolution(const Eigen::Ref<const Eigen::VectorXd> &query_times, opt::solution::query_workspace_t &workspace,
+                             Eigen::Ref<Eigen::MatrixXd> state_result, Eigen::Ref<Eigen::MatrixXd> input_result);
+
+            /**
+             * @brief Get the solution at the times of a prepared query, which are relative to the start of the solution.
+             *
+             * @param query The prepared query, prepared again if the layout of the solution changed
+             * @param state_result The state at the query times (num_states x num_times)
+             * @param input_result The input at the query times (num_inputs x num_times)
+             */
+            bool GetSolution(opt::solution::prepared_query_t &query, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result);
+
+            /**
+             * @brief Get the solution and its time derivatives up to the derivative order of a prepared query.
+             *
+             * @param query The prepared query, prepared again if the layout of the solution changed
+             * @param state_result The state at the query times (num_states x num_times)
+             * @param input_result The input at the query times (num_inputs x num_times)
+             * @param state_derivatives The k-th time derivative of the state at the query times, for k from 1 to the derivative order
+             * @param input_derivatives The k-th time derivative of the input at the query times, for k from 1 to the derivative order
+             */
+            bool GetSolution(opt::solution::prepared_query_t &query, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result,
+                             std::vector<Eigen::MatrixXd> &state_derivatives, std::vector<Eigen::MatrixXd> &input_derivatives);
+
+            /**
+             * @brief Export the solution as piecewise monomials, whose serialized form is what is sent to the joint controllers.
+             *
+             * @param state_monomial The state polynomials, in seconds since the start of each knot
+             * @param input_monomial The input polynomials, in seconds since the start of each knot
+             */
+            bool ExportMonomial(opt::solution::piecewise_monomial_t &state_monomial, opt::solution::piecewise_monomial_t &input_monomial);
+
             /**
              * @brief Get the solution and plot the constraints
              */
@@ -174,12 +273,12 @@ namespace galileo
             void CreateTrajOpt();
 
             /**
-             * @brief Create the running and terminal costs.
+             * @brief Create the running and terminal costs. The costs are parameterized by the target state and the terminal weight.
              */
-            void CreateCost(const T_ROBOT_STATE &initial_state, const T_ROBOT_STATE &target_state, casadi::Function &Phi);
+            void CreateCost(const T_ROBOT_STATE &initial_state, casadi::Function &Phi);
 
             /**
-             * @brief update the problem data with new boundary conditions
+             * @brief update the parameters of the problem with new boundary conditions
              */
             void UpdateProblemBoundaries(const T_ROBOT_STATE &initial_state, const T_ROBOT_STATE &target_state);
 
@@ -188,6 +287,11 @@ namespace galileo
              */
             void CreateProblemData(const T_ROBOT_STATE &initial_state, const T_ROBOT_STATE &target_state);
 
+            /**
+             * @brief Update the solution interface with the last solve of the trajectory optimizer, and append it to the solution log.
+             */
+            void UpdateSolutionInterface();
+
             std::shared_ptr<LeggedRobotStates> states_; /**< Definition of the state. */
 
             std::shared_ptr<LeggedRobotProblemData> problem_data_; /**< The problem data. */
@@ -203,8 +307,60 @@ namespace galileo
 
             casadi::Dict opts_;
 
+            casadi::Dict qp_opts_; /**< Options of the QP solver of the real-time iterations. */
+
             std::string solver_type_ = "ipopt";
 
+            bool warm_start_ = false; /**< Warm start each solve with the primal-dual solution of the last one. */
+
+            bool telemetry_ = false; /**< Record a summary of the solver iterations. */
+
+            int telemetry_step_ = 1; /**< Number of solver iterations between telemetry records. */
+
+            bool stage_wise_ordering_ = false; /**< Order the decision variables and constraints knot by knot. */
+
+            bool fused_knot_kernel_ = false; /**< Evaluate each knot segment with a single function. */
+
+            bool segment_cache_ = true; /**< Share the per-knot functions between phases with the same mode, constraints and discretization. */
+
+            std::string solution_log_file_; /**< Binary log which every solve is appended to. Empty disables the log. */
+
+            std::ofstream solution_log_stream_; /**< The binary log, opened by the first solve and kept open. */
+
+            opt::MapPolicy map_policy_; /**< Execution policy of the maps of the segments and the solution. */
+
+            bool map_reduce_cost_ = false; /**< Evaluate the cost of each segment with a map and a sum instead of a fold. */
+
+            int construction_threads_ = 0; /**< Number of threads used to build the phases. 0 uses the hardware concurrency. Only takes effect if CasADi is built with thread-safe symbolics, otherwise the phases are built on a single thread. */
+
+            opt::TranscriptionMethod transcription_ = opt::TranscriptionMethod::PSEUDOSPECTRAL; /**< Transcription of the phases with contacts. */
+
+            opt::TranscriptionMethod flight_transcription_ = opt::TranscriptionMethod::PSEUDOSPECTRAL; /**< Transcription of the phases without contacts. */
+
+            int degree_ = 1; /**< Degree of the state polynomials of the phases with contacts. */
+
+            int flight_degree_ = 1; /**< Degree of the state polynomials of the phases without contacts. */
+
+            std::string scheme_ = "radau"; /**< Collocation scheme of the phases with contacts. */
+
+            std::string flight_scheme_ = "radau"; /**< Collocation scheme of the phases without contacts. */
+
+            bool rti_ = false; /**< Solve with real-time iterations. */
+
+            std::string rti_qpsol_ = "qpoases"; /**< QP solver of the real-time iterations. */
+
+            bool rti_exact_hessian_ = false; /**< Use the Hessian of the Lagrangian in the real-time iterations. */
+
+            bool mesh_refinement_ = false; /**< Refine the mesh of the phases whose discretization error is high, and solve again. */
+
+            bool mesh_refinement_done_ = false; /**< True once the first solve has refined the mesh, or the horizon has advanced so that it can no longer be refined. */
+
+            opt::MeshRefinementOptions mesh_refinement_options_; /**< Options of the mesh refinement. */
+
+            bool codegen_ = false; /**< Generate and compile C code for the NLP functions. */
+
+            std::string codegen_cache_directory_ = (std::filesystem::temp_directory_path() / "galileo_codegen").string(); /**< Directory in which the compiled NLP functions are cached. */
+
             std::shared_ptr<opt::DecisionDataBuilder<LeggedRobotProblemData>> decision_builder_;
 
             std::shared_ptr<LeggedTrajOpt> trajectory_opt_; /**< The trajectory optimizer. */
@@ -232,6 +388,10 @@ namespace galileo
             bool phases_set_ = false;
 
             bool fully_initialized_ = false;
+
+            std::vector<contact::ContactSequence::Phase> gait_phases_; /**< The phases of the contact sequence at initialization, appended in turn as the horizon advances. */
+
+            size_t next_gait_phase_ = 0; /**< Index of the gait phase appended next. */
         };
 
     }
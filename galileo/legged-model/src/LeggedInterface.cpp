@@ -123,6 +123,22 @@ namespace galileo
                     else if (type == "vector")
                         continue;
                 }
+
+                // If the first word up until "." is "qp" then it is an option of the QP solver of the real-time iterations
+                if (var.first.substr(0, var.first.find(".")) == "qp")
+                {
+                    std::string key = var.first.substr(var.first.find(".") + 1);
+                    std::string value = std::get<0>(var.second);
+                    std::string type = std::get<1>(var.second);
+                    if (type == "int")
+                        qp_opts_[key] = std::stoi(value);
+                    else if (type == "double")
+                        qp_opts_[key] = std::stod(value);
+                    else if (type == "string")
+                        qp_opts_[key] = value;
+                    else if (type == "bool")
+                        qp_opts_[key] = (value == "true");
+                }
             }
 
             // Extract the string value from imported_vars
@@ -157,6 +173,96 @@ namespace galileo
             if (imported_vars.find("solver") != imported_vars.end())
                 solver_type_ = std::get<0>(imported_vars["solver"]);
 
+            if (imported_vars.find("warm_start") != imported_vars.end())
+                warm_start_ = (std::get<0>(imported_vars["warm_start"]) == "true");
+
+            if (imported_vars.find("telemetry") != imported_vars.end())
+                telemetry_ = (std::get<0>(imported_vars["telemetry"]) == "true");
+
+            if (imported_vars.find("telemetry_step") != imported_vars.end())
+                telemetry_step_ = std::stoi(std::get<0>(imported_vars["telemetry_step"]));
+
+            if (imported_vars.find("stage_wise_ordering") != imported_vars.end())
+                stage_wise_ordering_ = (std::get<0>(imported_vars["stage_wise_ordering"]) == "true");
+
+            if (imported_vars.find("fused_knot_kernel") != imported_vars.end())
+                fused_knot_kernel_ = (std::get<0>(imported_vars["fused_knot_kernel"]) == "true");
+
+            if (imported_vars.find("segment_cache") != imported_vars.end())
+                segment_cache_ = (std::get<0>(imported_vars["segment_cache"]) == "true");
+
+            if (imported_vars.find("solution_log") != imported_vars.end())
+                solution_log_file_ = std::get<0>(imported_vars["solution_log"]);
+
+            if (imported_vars.find("map.parallelization") != imported_vars.end())
+                map_policy_.parallelization = opt::MapPolicy::parallelizationFromString(std::get<0>(imported_vars["map.parallelization"]));
+
+            if (imported_vars.find("map.max_workers") != imported_vars.end())
+                map_policy_.max_workers = std::stoi(std::get<0>(imported_vars["map.max_workers"]));
+
+            if (imported_vars.find("map.min_batch_size") != imported_vars.end())
+                map_policy_.min_batch_size = std::stoi(std::get<0>(imported_vars["map.min_batch_size"]));
+
+            if (imported_vars.find("cost.map_reduce") != imported_vars.end())
+                map_reduce_cost_ = (std::get<0>(imported_vars["cost.map_reduce"]) == "true");
+
+            if (imported_vars.find("construction_threads") != imported_vars.end())
+                construction_threads_ = std::stoi(std::get<0>(imported_vars["construction_threads"]));
+
+            if (imported_vars.find("transcription") != imported_vars.end())
+            {
+                transcription_ = opt::SegmentFactory::transcriptionFromString(std::get<0>(imported_vars["transcription"]));
+                flight_transcription_ = transcription_;
+            }
+
+            if (imported_vars.find("transcription.flight") != imported_vars.end())
+                flight_transcription_ = opt::SegmentFactory::transcriptionFromString(std::get<0>(imported_vars["transcription.flight"]));
+
+            if (imported_vars.find("collocation.degree") != imported_vars.end())
+            {
+                degree_ = std::stoi(std::get<0>(imported_vars["collocation.degree"]));
+                flight_degree_ = degree_;
+            }
+
+            if (imported_vars.find("collocation.degree.flight") != imported_vars.end())
+                flight_degree_ = std::stoi(std::get<0>(imported_vars["collocation.degree.flight"]));
+
+            if (imported_vars.find("collocation.scheme") != imported_vars.end())
+            {
+                scheme_ = std::get<0>(imported_vars["collocation.scheme"]);
+                flight_scheme_ = scheme_;
+            }
+
+            if (imported_vars.find("collocation.scheme.flight") != imported_vars.end())
+                flight_scheme_ = std::get<0>(imported_vars["collocation.scheme.flight"]);
+
+            if (imported_vars.find("rti") != imported_vars.end())
+                rti_ = (std::get<0>(imported_vars["rti"]) == "true");
+
+            if (imported_vars.find("rti.qpsol") != imported_vars.end())
+                rti_qpsol_ = std::get<0>(imported_vars["rti.qpsol"]);
+
+            if (imported_vars.find("rti.exact_hessian") != imported_vars.end())
+                rti_exact_hessian_ = (std::get<0>(imported_vars["rti.exact_hessian"]) == "true");
+
+            if (imported_vars.find("mesh_refinement") != imported_vars.end())
+                mesh_refinement_ = (std::get<0>(imported_vars["mesh_refinement"]) == "true");
+
+            if (imported_vars.find("mesh_refinement.tolerance") != imported_vars.end())
+                mesh_refinement_options_.tolerance = std::stod(std::get<0>(imported_vars["mesh_refinement.tolerance"]));
+
+            if (imported_vars.find("mesh_refinement.max_iterations") != imported_vars.end())
+                mesh_refinement_options_.max_iterations = std::stoi(std::get<0>(imported_vars["mesh_refinement.max_iterations"]));
+
+            if (imported_vars.find("mesh_refinement.max_degree") != imported_vars.end())
+                mesh_refinement_options_.max_degree = std::stoi(std::get<0>(imported_vars["mesh_refinement.max_degree"]));
+
+            if (imported_vars.find("codegen") != imported_vars.end())
+                codegen_ = (std::get<0>(imported_vars["codegen"]) == "true");
+
+            if (imported_vars.find("codegen.cache_directory") != imported_vars.end())
+                codegen_cache_directory_ = std::get<0>(imported_vars["codegen.cache_directory"]);
+
             parameters_set_ = true;
         }
 
@@ -165,9 +271,9 @@ namespace galileo
             assert(robot_ != nullptr); // Model must be loaded
             casadi::Function Phi;
 
-            CreateCost(initial_state, target_state, Phi);
+            CreateCost(initial_state, Phi);
 
-            std::shared_ptr<opt::GeneralProblemData> gp_data = std::make_shared<opt::GeneralProblemData>(robot_->fint, robot_->fdiff, Phi);
+            std::shared_ptr<opt::GeneralProblemData> gp_data = std::make_shared<opt::GeneralProblemData>(robot_->fint, robot_->fdiff, Phi, states_->nx + 1);
 
             problem_data_ = std::make_shared<LeggedRobotProblemData>(gp_data,
                                                                      surfaces_,
@@ -179,7 +285,7 @@ namespace galileo
         }
 
         // TODO: Generate a reference trajectory somewhere and share it betwen the objective and initial guess
-        void LeggedInterface::CreateCost(const T_ROBOT_STATE &initial_state, const T_ROBOT_STATE &target_state, casadi::Function &Phi)
+        void LeggedInterface::CreateCost(const T_ROBOT_STATE &initial_state, casadi::Function &Phi)
         {
             assert(robot_ != nullptr);
 
@@ -202,6 +308,11 @@ namespace galileo
             pinocchio::casadi::copy(Q_mat, Q);
             pinocchio::casadi::copy(R_mat, R);
 
+            /*The target state and terminal weight are parameters of the NLP, so they can change without rebuilding the solver*/
+            casadi::SX cost_params = casadi::SX::sym("cost_params", states_->nx + 1, 1);
+            casadi::SX target_state = cost_params(casadi::Slice(0, states_->nx));
+            casadi::SX terminal_weight = cost_params(states_->nx);
+
             /*Both f_state_error and fdiff work for the quaternion error, but fdiff uses the quaternion logarithm, so it is more accurate albeit slightly more expensive*/
             casadi::SX X_error = robot_->f_state_error(casadi::SXVector{robot_->cx, target_state}).at(0);
             // casadi::SX X_error = robot_->fdiff(casadi::SXVector{rrobot_->cx, target_state, 1.}).at(0);
@@ -212,17 +323,18 @@ namespace galileo
             {
                 casadi::SX U_ref = robot_->weightCompensatingInputsForPhase(i);
                 casadi::SX u_error = robot_->cu - U_ref;
-                casadi::Function L = casadi::Function("L_" + std::to_string(i),
-                                                      {robot_->cx, robot_->cu},
+                // The cost only depends on the contact mode, so it is named by the mode. Phases of the same mode then get the same
+                // cost function, and share their per-knot functions in the segment function cache.
+                casadi::Function L = casadi::Function("L_" + std::to_string(robot_->contact_sequence->modeIDFromPhaseIndex(i)),
+                                                      {robot_->cx, robot_->cu, cost_params},
                                                       {0.5 * casadi::SX::dot(X_error, casadi::SX::mtimes(Q, X_error)) +
                                                        0.5 * casadi::SX::dot(u_error, casadi::SX::mtimes(R, u_error))});
                 robot_->contact_sequence->FillPhaseCost(i, L);
             }
 
-            // TODO: Add the terminal cost weight to a parameter file
             Phi = casadi::Function("Phi",
-                                   {robot_->cx},
-                                   {cost_params_.terminal_weight * casadi::SX::dot(X_error, casadi::SX::mtimes(Q, X_error))});
+                                   {robot_->cx, cost_params},
+                                   {terminal_weight * casadi::SX::dot(X_error, casadi::SX::mtimes(Q, X_error))});
         }
 
         std::vector<LeggedInterface::LeggedConstraintBuilderType>
@@ -266,6 +378,17 @@ namespace galileo
             // Create the trajectory optimizer.
             CreateTrajOpt();
 
+            // Build the NLP and the solver once. Later updates only change the parameters.
+            {
+                std::lock_guard<std::mutex> lock(trajectory_opt_mutex_);
+                trajectory_opt_->initFiniteElements(degree_, initial_state);
+            }
+            UpdateProblemBoundaries(initial_state, target_state);
+
+            gait_phases_ = robot_->contact_sequence->getPhases();
+            next_gait_phase_ = 0;
+            mesh_refinement_done_ = false;
+
             fully_initialized_ = true;
         }
 
@@ -276,7 +399,41 @@ namespace galileo
 
             std::lock_guard<std::mutex> lock(trajectory_opt_mutex_);
 
-            trajectory_opt_ = std::make_shared<LeggedTrajOpt>(problem_data_, robot_->contact_sequence, constraint_builders, decision_builder_, opts_, solver_type_);
+            for (int i = 0; i < robot_->contact_sequence->getNumPhases(); ++i)
+            {
+                bool flight = robot_->contact_sequence->numEndEffectorsInContactAtPhase(i) == 0;
+                robot_->contact_sequence->FillPhaseTranscription(i, flight ? flight_transcription_ : transcription_);
+                robot_->contact_sequence->FillPhaseDegree(i, flight ? flight_degree_ : degree_);
+                robot_->contact_sequence->FillPhaseScheme(i, flight ? flight_scheme_ : scheme_);
+            }
+
+            // Options of the other solvers in the parameter file would be rejected by the chosen solver.
+            const std::vector<std::string> solver_plugins = {"ipopt", "snopt", "fatrop", "knitro", "worhp", "bonmin"};
+            casadi::Dict solver_opts;
+            for (const auto &opt : opts_)
+            {
+                std::string prefix = opt.first.substr(0, opt.first.find("."));
+                bool other_solver = prefix != solver_type_ && std::find(solver_plugins.begin(), solver_plugins.end(), prefix) != solver_plugins.end();
+                if (!other_solver)
+                    solver_opts[opt.first] = opt.second;
+            }
+
+            trajectory_opt_ = std::make_shared<LeggedTrajOpt>(problem_data_, robot_->contact_sequence, constraint_builders, decision_builder_, solver_opts, solver_type_);
+            trajectory_opt_->setWarmStart(warm_start_);
+            if (telemetry_)
+                trajectory_opt_->enableTelemetry(1024, telemetry_step_);
+            if (codegen_)
+                trajectory_opt_->enableCodegen(codegen_cache_directory_);
+            if (rti_)
+                trajectory_opt_->enableRealTimeIteration(rti_qpsol_, qp_opts_, rti_exact_hessian_);
+            trajectory_opt_->setStageWiseOrdering(stage_wise_ordering_);
+            trajectory_opt_->setFusedKnotKernel(fused_knot_kernel_);
+            trajectory_opt_->setMapReduceCost(map_reduce_cost_);
+            trajectory_opt_->setSegmentFunctionCache(segment_cache_);
+            trajectory_opt_->setMapPolicy(map_policy_);
+            solution_interface_->setMapPolicy(map_policy_);
+            if (construction_threads_ > 0)
+                trajectory_opt_->setConstructionThreads(construction_threads_);
         }
 
         void LeggedInterface::Update(const T_ROBOT_STATE &initial_state, const T_ROBOT_STATE &target_state)
@@ -285,13 +442,74 @@ namespace galileo
 
             // Solve the problem
             std::lock_guard<std::mutex> lock_traj(trajectory_opt_mutex_);
+            // The mesh is refined once, by the first solve, while the horizon still matches the contact sequence.
+            // The phases appended as the horizon advances then use the refined mesh.
+            if (mesh_refinement_ && !mesh_refinement_done_)
+            {
+                trajectory_opt_->optimizeWithMeshRefinement(mesh_refinement_options_);
+                gait_phases_ = robot_->contact_sequence->getPhases();
+                mesh_refinement_done_ = true;
+            }
+            else
+                trajectory_opt_->optimize();
+
+            UpdateSolutionInterface();
+        }
+
+        void LeggedInterface::Advance(double time_advance, const T_ROBOT_STATE &initial_state)
+        {
+            Prepare(time_advance, initial_state);
+            Feedback(initial_state);
+        }
+
+        void LeggedInterface::Prepare(double time_advance, const T_ROBOT_STATE &predicted_state)
+        {
+            assert(isFullyInitialized());
+
+            std::lock_guard<std::mutex> lock_traj(trajectory_opt_mutex_);
+            problem_data_->legged_decision_problem_data.X0 = (predicted_state);
+            // The gait repeats, so each phase the horizon needs is the next phase of the initial contact sequence.
+            auto next_phase = [this]()
+            {
+                contact::ContactSequence::Phase phase = gait_phases_[next_gait_phase_];
+                next_gait_phase_ = (next_gait_phase_ + 1) % gait_phases_.size();
+                return phase;
+            };
+            trajectory_opt_->advanceFiniteElements(time_advance, predicted_state, next_phase);
+            mesh_refinement_done_ = true;
+
+            if (rti_)
+                trajectory_opt_->prepareRealTimeIteration();
+        }
+
+        void LeggedInterface::Feedback(const T_ROBOT_STATE &initial_state)
+        {
+            assert(isFullyInitialized());
+
+            std::lock_guard<std::mutex> lock_traj(trajectory_opt_mutex_);
+            trajectory_opt_->setInitialState(initial_state);
             trajectory_opt_->optimize();
 
+            UpdateSolutionInterface();
+        }
+
+        void LeggedInterface::UpdateSolutionInterface()
+        {
+            std::vector<opt::solution::solution_segment_data_t> solution_segments = trajectory_opt_->getSolutionSegments();
+            std::vector<std::vector<opt::ConstraintData>> constraint_data_segments = trajectory_opt_->getConstraintDataSegments();
+            if (!solution_log_file_.empty())
+            {
+                // The log is kept open, as the solve path should not pay for opening it every time.
+                if (!solution_log_stream_.is_open())
+                    solution_log_stream_.open(solution_log_file_, std::ios::binary | std::ios::app);
+                opt::solution::SolutionLog::AppendSolution(solution_log_stream_, solution_segments, constraint_data_segments);
+            }
+
             std::lock_guard<std::mutex> lock_sol(solution_mutex_);
             //@todo Akshay5312, reevaluate thread safety
-            solution_interface_->UpdateSolution(trajectory_opt_->getSolutionSegments());
+            solution_interface_->UpdateSolution(solution_segments);
 
-            solution_interface_->UpdateConstraints(trajectory_opt_->getConstraintDataSegments());
+            solution_interface_->UpdateConstraints(constraint_data_segments);
         }
 
         bool LeggedInterface::GetSolution(const Eigen::VectorXd &query_times, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result)
@@ -300,6 +518,32 @@ namespace galileo
             return solution_interface_->GetSolution(query_times, state_result, input_result);
         }
 
+        bool LeggedInterface::GetSolution(const Eigen::Ref<const Eigen::VectorXd> &query_times, opt::solution::query_workspace_t &workspace,
+                                          Eigen::Ref<Eigen::MatrixXd> state_result, Eigen::Ref<Eigen::MatrixXd> input_result)
+        {
+            std::lock_guard<std::mutex> lock_sol(solution_mutex_);
+            return solution_interface_->GetSolution(query_times, workspace, state_result, input_result);
+        }
+
+        bool LeggedInterface::GetSolution(opt::solution::prepared_query_t &query, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result)
+        {
+            std::lock_guard<std::mutex> lock_sol(solution_mutex_);
+            return solution_interface_->GetSolution(query, state_result, input_result);
+        }
+
+        bool LeggedInterface::GetSolution(opt::solution::prepared_query_t &query, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result,
+                                          std::vector<Eigen::MatrixXd> &state_derivatives, std::vector<Eigen::MatrixXd> &input_derivatives)
+        {
+            std::lock_guard<std::mutex> lock_sol(solution_mutex_);
+            return solution_interface_->GetSolution(query, state_result, input_result, state_derivatives, input_derivatives);
+        }
+
+        bool LeggedInterface::ExportMonomial(opt::solution::piecewise_monomial_t &state_monomial, opt::solution::piecewise_monomial_t &input_monomial)
+        {
+            std::lock_guard<std::mutex> lock_sol(solution_mutex_);
+            return solution_interface_->ExportMonomial(state_monomial, input_monomial);
+        }
+
         void LeggedInterface::VisualizeSolutionAndConstraints(const Eigen::VectorXd &query_times, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result)
         {
             std::unique_lock<std::mutex> lock_sol(solution_mutex_);
@@ -342,16 +586,15 @@ namespace galileo
 
         void LeggedInterface::UpdateProblemBoundaries(const T_ROBOT_STATE &initial_state, const T_ROBOT_STATE &target_state)
         {
+            // The initial guess of the phases built later, by advancing the horizon or refining the mesh, starts from this state.
             problem_data_->legged_decision_problem_data.X0 = (initial_state);
+            problem_data_->legged_decision_problem_data.Xf = (target_state);
 
-            // Create a new cost
-            casadi::Function Phi;
-            CreateCost(initial_state, target_state, Phi);
-
-            problem_data_->gp_data->Phi = Phi;
+            casadi::DM cost_params = casadi::DM::vertcat({target_state, cost_params_.terminal_weight});
 
             std::lock_guard<std::mutex> lock(trajectory_opt_mutex_);
-            trajectory_opt_->initFiniteElements(1, initial_state);
+            trajectory_opt_->setInitialState(initial_state);
+            trajectory_opt_->setParameters(cost_params);
         }
 
     }
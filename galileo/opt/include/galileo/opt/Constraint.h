@@ -23,12 +23,14 @@ namespace galileo
                 deviations back to the actual state space
              * @param Fdiff_ Continuous-time function. The ineverse function of Fint. This is used to generate the initial guess for the states.
              * @param Phi_ Terminal cost
+             * @param np_ Number of problem parameters. If nonzero, the parameters are the second input of Phi and the third input of the phase costs
              */
-            GeneralProblemData(casadi::Function Fint_, casadi::Function Fdiff_, casadi::Function Phi_)
+            GeneralProblemData(casadi::Function Fint_, casadi::Function Fdiff_, casadi::Function Phi_, casadi_int np_ = 0)
             {
                 this->Fint = Fint_;
                 this->Fdiff = Fdiff_;
                 this->Phi = Phi_;
+                this->np = np_;
             }
 
             /**
@@ -50,6 +52,12 @@ namespace galileo
              *
              */
             casadi::Function Phi;
+
+            /**
+             * @brief Number of problem parameters. These can change between solves without rebuilding the solver.
+             *
+             */
+            casadi_int np = 0;
         };
 
                     /**
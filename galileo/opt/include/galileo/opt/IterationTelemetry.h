@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace galileo
+{
+    namespace opt
+    {
+        /**
+         * @brief Summary of a single solver iteration.
+         *
+         */
+        struct IterationRecord
+        {
+            /**
+             * @brief Index of the iteration within its solve.
+             *
+             */
+            uint64_t iteration = 0;
+
+            /**
+             * @brief Objective value.
+             *
+             */
+            double objective = 0.0;
+
+            /**
+             * @brief Largest violation of the constraint bounds.
+             *
+             */
+            double infeasibility = 0.0;
+
+            /**
+             * @brief Euclidean norm of the decision variables.
+             *
+             */
+            double x_norm = 0.0;
+
+            /**
+             * @brief Smallest decision variable.
+             *
+             */
+            double x_min = 0.0;
+
+            /**
+             * @brief Largest decision variable.
+             *
+             */
+            double x_max = 0.0;
+        };
+
+        /**
+         * @brief Fixed capacity ring buffer of iteration records, written by the solver thread and read by any other thread.
+         * Writing and reading never allocate or lock. When the buffer is full, the oldest records are overwritten.
+         *
+         */
+        class IterationRingBuffer
+        {
+        public:
+            /**
+             * @brief Construct a new Iteration Ring Buffer object. All memory is allocated here.
+             *
+             * @param capacity_ The number of records kept
+             */
+            explicit IterationRingBuffer(size_t capacity_ = 1024) : slots(capacity_ > 0 ? capacity_ : 1) {}
+
+            /**
+             * @brief Append a record. Only one thread may write.
+             *
+             * @param record The record to append
+             */
+            void push(const IterationRecord &record)
+            {
+                uint64_t index = write_index.load(std::memory_order_relaxed);
+                Slot &slot = slots[index % slots.size()];
+                /*An odd sequence number marks the slot as being written*/
+                uint64_t seq = slot.sequence.load(std::memory_order_relaxed);
+                slot.sequence.store(seq + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                slot.record = record;
+                slot.sequence.store(seq + 2, std::memory_order_release);
+                write_index.store(index + 1, std::memory_order_release);
+            }
+
+            /**
+             * @brief Read the records written since the cursor. Records which were overwritten before they could be read are skipped.
+             *
+             * @param cursor The index of the next record to read, updated to the index after the last record read
+             * @param out Output buffer of records
+             * @param max_records Size of the output buffer
+             * @return size_t The number of records read
+             */
+            size_t read(uint64_t &cursor, IterationRecord *out, size_t max_records) const
+            {
+                uint64_t end = write_index.load(std::memory_order_acquire);
+                if (end - cursor > slots.size())
+                    cursor = end - slots.size();
+
+                size_t count = 0;
+                while (cursor < end && count < max_records)
+                {
+                    const Slot &slot = slots[cursor % slots.size()];
+                    /*Each lap over the buffer advances the sequence number of a slot by 2*/
+                    uint64_t expected_seq = 2 * (cursor / slots.size() + 1);
+                    uint64_t seq_before = slot.sequence.load(std::memory_order_acquire);
+                    IterationRecord record = slot.record;
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    uint64_t seq_after = slot.sequence.load(std::memory_order_relaxed);
+                    if (seq_before != expected_seq || seq_after != expected_seq)
+                    {
+                        /*The writer lapped the reader while this slot was being read, skip ahead to the records still in the buffer*/
+                        uint64_t newest = write_index.load(std::memory_order_acquire);
+                        cursor = newest - std::min<uint64_t>(newest, slots.size() - 1);
+                        continue;
+                    }
+                    out[count++] = record;
+                    ++cursor;
+                }
+                return count;
+            }
+
+            /**
+             * @brief Total number of records written so far.
+             *
+             * @return uint64_t The number of records written
+             */
+            uint64_t written() const { return write_index.load(std::memory_order_acquire); }
+
+            /**
+             * @brief The number of records kept.
+             *
+             * @return size_t The capacity
+             */
+            size_t capacity() const { return slots.size(); }
+
+        private:
+            /**
+             * @brief A record together with its sequence number, which is odd while the record is being written.
+             *
+             */
+            struct Slot
+            {
+                std::atomic<uint64_t> sequence{0};
+                IterationRecord record;
+            };
+
+            /**
+             * @brief Preallocated storage.
+             *
+             */
+            std::vector<Slot> slots;
+
+            /**
+             * @brief Index of the next record to write.
+             *
+             */
+            std::atomic<uint64_t> write_index{0};
+        };
+    }
+}
@@ -26,9 +26,9 @@ namespace galileo
              * Use d_ = 0 for a piecewise constant polynomial.
              *
              * @param d_ Degree of the polynomial
-             * @param scheme Collocation scheme: "radau" or "legendre"
+             * @param scheme_ Collocation scheme: "radau" or "legendre"
              */
-            LagrangePolynomial(int d_, const std::string &scheme = "radau");
+            LagrangePolynomial(int d_, const std::string &scheme_ = "radau");
 
             /**
              * @brief Perform symbolic Lagrange Interpolation, which, given a time from the Lagrange time scale, interpolates terms to find the value at time t.
@@ -49,6 +49,27 @@ namespace galileo
              */
             Eigen::VectorXd barycentricInterpolation(double t, const Eigen::MatrixXd &terms) const;
 
+            /**
+             * @brief Compute the weights which interpolate the terms at a time from the Lagrange time scale, so that the interpolated
+             * value is terms * weights. The weights are shared by all the rows of the terms.
+             *
+             * @param t Time to interpolate at
+             * @param weights [out] The weight of each term
+             */
+            void interpolationWeights(double t, Eigen::VectorXd &weights) const;
+
+            /**
+             * @brief Compute the weights which interpolate the terms and their time derivatives at a time from the Lagrange time scale,
+             * so that the k-th derivative of the interpolant w.r.t. the Lagrange time scale is terms * weights.col(k). The derivative
+             * weights are the value weights multiplied by powers of the differentiation matrix.
+             *
+             * @param t Time to interpolate at
+             * @param derivative_order The highest derivative to compute weights for
+             * @param weights [out] The weights of each term, one column per derivative order starting from the value. Must be of size
+             * (d + 1) x (derivative_order + 1), so that it can be a block of a preallocated buffer.
+             */
+            void interpolationWeights(double t, int derivative_order, Eigen::Ref<Eigen::MatrixXd> weights) const;
+
             /**
              * @brief If true, interprets the polynomial as a piecewise constant value
              * 
@@ -61,6 +82,12 @@ namespace galileo
              */
             int d;
 
+            /**
+             * @brief Collocation scheme of the roots.
+             *
+             */
+            std::string scheme;
+
             /**
              * @brief The roots of the polynomial.
              *
@@ -79,6 +106,20 @@ namespace galileo
              */
             std::vector<std::vector<double>> C;
 
+            /**
+             * @brief Differentiation matrix, the collocation coefficients C as a matrix. Given the values of the polynomial at the roots,
+             * their product with it is the time derivative of the polynomial at the roots. Zero for a piecewise constant polynomial.
+             *
+             */
+            Eigen::MatrixXd differentiation_matrix;
+
+            /**
+             * @brief Monomial matrix. Given the values of the polynomial at the roots as a row, its product with it is the coefficients
+             * of the polynomial in the monomial basis, lowest power first. Only the constant coefficient is set for a piecewise constant polynomial.
+             *
+             */
+            Eigen::MatrixXd monomial_matrix;
+
             /**
              * @brief Continuity coefficients.
              *
@@ -90,6 +131,15 @@ namespace galileo
              * 
              */
             std::vector<double> barycentric_weights;
+
+        private:
+            /**
+             * @brief Compute the weights which interpolate the terms at a time from the Lagrange time scale.
+             *
+             * @param t Time to interpolate at
+             * @param weights [out] The weight of each term, of size d + 1
+             */
+            void basisWeights(double t, Eigen::Ref<Eigen::VectorXd> weights) const;
         };
     }
 }
\ No newline at end of file
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <pinocchio/autodiff/casadi.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+namespace galileo
+{
+    namespace opt
+    {
+        /**
+         * @brief How the evaluations of a mapped function are distributed.
+         *
+         */
+        enum class MapParallelization
+        {
+            SERIAL,
+            OPENMP,
+            THREAD
+        };
+
+        /**
+         * @brief Execution policy shared by the maps of the segments and the solution.
+         *
+         */
+        struct MapPolicy
+        {
+            /**
+             * @brief How the evaluations of a map are distributed.
+             *
+             */
+            MapParallelization parallelization = MapParallelization::OPENMP;
+
+            /**
+             * @brief Largest number of threads of a map in thread mode. 0 uses the hardware concurrency.
+             * OpenMP maps use the thread count of the OpenMP runtime.
+             *
+             */
+            casadi_int max_workers = 0;
+
+            /**
+             * @brief Maps with fewer evaluations than this are evaluated serially, since spreading them costs more than it saves.
+             *
+             */
+            casadi_int min_batch_size = 1;
+
+            /**
+             * @brief Map a function n times with this policy, for use in a symbolic graph. The mapped functions are cached, so mapping
+             * the same function again returns the same map.
+             *
+             * @param f The function to map
+             * @param n The number of evaluations
+             * @return casadi::Function The mapped function
+             */
+            casadi::Function map(const casadi::Function &f, casadi_int n) const;
+
+            /**
+             * @brief Map a function n times serially, for numeric evaluations. Numeric evaluations are small and called once per
+             * update, so starting a parallel region for them costs more than it saves. The mapped functions are cached.
+             *
+             * @param f The function to map
+             * @param n The number of evaluations
+             * @return casadi::Function The mapped function
+             */
+            casadi::Function serialMap(const casadi::Function &f, casadi_int n) const;
+
+            /**
+             * @brief Parse a parallelization from its name, "serial", "openmp", or "thread".
+             *
+             * @param name The name of the parallelization
+             * @return MapParallelization The parallelization
+             */
+            static MapParallelization parallelizationFromString(const std::string &name);
+
+            /**
+             * @brief Number of mapped functions kept by the cache. The least recently used map is dropped when it is full.
+             *
+             */
+            size_t map_cache_capacity = 256;
+
+        private:
+            /**
+             * @brief Struct for a cached map. It holds the function it maps, so the function outlives its entry and its address
+             * is not reused by another function while it is in the cache.
+             *
+             */
+            struct map_cache_entry_t
+            {
+                /**
+                 * @brief The function which is mapped.
+                 *
+                 */
+                casadi::Function f;
+
+                /**
+                 * @brief The mapped function.
+                 *
+                 */
+                casadi::Function mapped;
+
+                /**
+                 * @brief Use count at the last use of the entry, to find the least recently used entry.
+                 *
+                 */
+                size_t last_use = 0;
+            };
+
+            /**
+             * @brief Struct for the cache of mapped functions. Copies of a policy share it, and the segments are built from several
+             * threads, so it is locked.
+             *
+             */
+            struct map_cache_t
+            {
+                /**
+                 * @brief The cached maps, by the function, the number of evaluations, the parallelization and the number of workers.
+                 *
+                 */
+                std::map<std::tuple<const void *, casadi_int, MapParallelization, casadi_int>, map_cache_entry_t> entries;
+
+                /**
+                 * @brief Number of uses of the cache.
+                 *
+                 */
+                size_t uses = 0;
+
+                /**
+                 * @brief Lock of the cache.
+                 *
+                 */
+                std::mutex mutex;
+            };
+
+            /**
+             * @brief Get a map from the cache, mapping the function if it is not cached.
+             *
+             * @param f The function to map
+             * @param n The number of evaluations
+             * @param mode The parallelization of the map
+             * @param workers The number of threads in thread mode
+             * @return casadi::Function The mapped function
+             */
+            casadi::Function cachedMap(const casadi::Function &f, casadi_int n, MapParallelization mode, casadi_int workers) const;
+
+            /**
+             * @brief The cache of mapped functions.
+             *
+             */
+            std::shared_ptr<map_cache_t> map_cache = std::make_shared<map_cache_t>();
+        };
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "galileo/opt/Solution.h"
+#include <vector>
+
+namespace galileo
+{
+    namespace opt
+    {
+        /**
+         * @brief Options of the adaptive mesh refinement.
+         *
+         */
+        struct MeshRefinementOptions
+        {
+            /**
+             * @brief Largest accepted error of a knot segment, the dynamics defect between the collocation points integrated over the knot segment.
+             *
+             */
+            double tolerance = 1e-3;
+
+            /**
+             * @brief Largest number of refine and re-solve iterations after the first solve.
+             *
+             */
+            int max_iterations = 3;
+
+            /**
+             * @brief Largest degree of the state polynomial of a phase.
+             *
+             */
+            int max_degree = 5;
+
+            /**
+             * @brief Largest number of knot points of a phase.
+             *
+             */
+            int max_knot_points = 100;
+
+            /**
+             * @brief Number of samples between each pair of consecutive collocation points.
+             *
+             */
+            int samples_per_interval = 2;
+        };
+
+        /**
+         * @brief Estimates the discretization error of a solved segment, and refines the mesh of its phase where the error is high.
+         *
+         */
+        class MeshRefinement
+        {
+        public:
+            /**
+             * @brief Estimate the error of each knot segment of a solution segment. The dynamics defect, the difference between
+             * the time derivative of the state polynomial and F, is sampled between the collocation points, where collocation does
+             * not enforce it. The error of a knot segment is the largest defect times the length of the knot segment.
+             *
+             * @param segment The solution segment
+             * @param F Dynamics function
+             * @param Fdiff Function which maps two states and a time step to the tangent space derivative between them
+             * @param samples_per_interval Number of samples between each pair of consecutive collocation points
+             * @return std::vector<double> The error of each knot segment
+             */
+            static std::vector<double> estimateKnotErrors(const solution::solution_segment_data_t &segment, casadi::Function F, casadi::Function Fdiff, int samples_per_interval);
+
+            /**
+             * @brief Choose a refined mesh for a phase. The knots of a phase are uniformly spaced, so instead of splitting the
+             * knot segments whose error is above the tolerance, as many knots are added to the phase. If most knot segments are above the
+             * tolerance, the error is spread over the phase and the degree is raised instead.
+             *
+             * @param knot_errors The error of each knot segment of the phase
+             * @param options The mesh refinement options
+             * @param knot_points [in/out] The number of knot points of the phase
+             * @param degree [in/out] The degree of the state polynomial of the phase
+             * @return true If the mesh of the phase was refined
+             */
+            static bool refinePhase(const std::vector<double> &knot_errors, const MeshRefinementOptions &options, int &knot_points, int &degree);
+
+            /**
+             * @brief Create a function of time which linearly interpolates the state and input of a solution, for use as an initial guess.
+             *
+             * @param solution_segments The solution segments
+             * @param nx Number of states
+             * @param nu Number of inputs
+             * @return casadi::Function The function t -> (x, u)
+             */
+            static casadi::Function createInitialGuess(const std::vector<solution::solution_segment_data_t> &solution_segments, casadi_int nx, casadi_int nu);
+        };
+    }
+}
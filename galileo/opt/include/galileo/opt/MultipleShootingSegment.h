@@ -0,0 +1,521 @@
+#pragma once
+
+#include "galileo/opt/Segment.h"
+#include "galileo/tools/CasadiConversions.h"
+
+namespace galileo
+{
+    namespace opt
+    {
+
+        /**
+         * @brief MultipleShootingSegment class. Each knot segment is integrated with a fixed-step explicit Runge-Kutta 4 scheme, and the
+         * integrated state must match the state at the next knot. The input is piecewise constant over each knot segment.
+         *
+         * Compared to a PseudospectralSegment, there are no collocation states or inputs, so there are several times fewer decision
+         * variables per knot. The general constraints are evaluated at the knots instead of at the collocation points.
+         *
+         */
+        class MultipleShootingSegment : public Segment
+        {
+        public:
+            /**
+             * @brief Construct a new Multiple Shooting Segment object.
+             *
+             * @param problem Pointer to the problem data
+             * @param F Dynamics function
+             * @param L Cost function
+             * @param st_m_ Pointer to the state indices helper
+             * @param knot_num_ Number of knots in the segment
+             * @param h_ Period of each knot segment
+             * @param steps_per_knot_ Number of Runge-Kutta 4 steps per knot segment
+             * @param stage_wise_ordering_ Order the decision variables and constraints knot by knot instead of by kind
+             *
+             */
+            MultipleShootingSegment(std::shared_ptr<GeneralProblemData> problem, casadi::Function F, casadi::Function L, std::shared_ptr<States> st_m_, int knot_num_, double h_, int steps_per_knot_ = 1, bool stage_wise_ordering_ = false);
+
+            /**
+             * @brief Initialize the vector of segment times which constraints are evaluated at.
+             *
+             * @param global_times Vector of global times
+             */
+            void initializeSegmentTimeVector(casadi::DM &global_times) override;
+
+            /**
+             * @brief Initialize the vector of times which coincide to the decision variables U occur at.
+             *
+             * @param global_times Vector of global times
+             */
+            void initializeInputTimeVector(casadi::DM &global_times) override;
+
+            /**
+             * @brief Create all the knot segments.
+             *
+             * @param x0_global Global starting state to integrate from (used for initial guess)
+             * @param x0_local Local starting state to integrate from
+             * @param parameters Problem parameters the cost depends on
+             * @param knot_length_ Period of each knot segment, a parameter of the NLP
+             *
+             */
+            void initializeKnotSegments(casadi::DM x0_global, casadi::MX x0_local, casadi::MX parameters, casadi::MX knot_length_) override;
+
+            /**
+             * @brief Build the function graph.
+             *
+             * @param G Vector of constraint data
+             * @param Wdata Decision bound and initial guess data for the state and input
+             */
+            void initializeExpressionGraph(std::vector<ConstraintData> G, std::shared_ptr<DecisionData> Wdata) override;
+
+            /**
+             * @brief Evaluate the bounds of the constraints and of the decision variables at the current segment times.
+             *
+             * @param G Vector of constraint data, with the same constraints the expression graph was built with
+             * @param Wdata Decision bound and initial guess data for the state and input
+             */
+            void updateBounds(const std::vector<ConstraintData> &G, std::shared_ptr<DecisionData> Wdata) override;
+
+            /**
+             * @brief Evaluate the initial guess at the current segment times.
+             *
+             * @param Wdata Decision bound and initial guess data for the state and input
+             */
+            void updateInitialGuess(std::shared_ptr<DecisionData> Wdata) override;
+
+            /**
+             * @brief Evaluate the expressions with the actual decision variables.
+             *
+             * @param J0 Accumulated cost so far
+             * @param w Decision variable vector to fill
+             * @param g Constraint vector to fill
+             */
+            void evaluateExpressionGraph(casadi::MX &J0, casadi::MXVector &w, casadi::MXVector &g) override;
+
+            /**
+             * @brief Extract the numeric solution of the segment from the decision variable vector of the NLP.
+             *
+             * @param w Decision variable vector of the NLP, in NLP order
+             * @param solx [out] The states of the segment, one column per node
+             * @param solu [out] The inputs of the segment, one column per node
+             */
+            void extractSolution(const std::vector<double> &w, Eigen::MatrixXd &solx, Eigen::MatrixXd &solu) const override;
+
+            /**
+             * @brief Get the initial state.
+             *
+             * @return casadi::MX The initial state
+             */
+            casadi::MX getInitialState() const override;
+
+            /**
+             * @brief Get the initial state deviant.
+             *
+             * @return casadi::MX The initial state deviant
+             */
+            casadi::MX getInitialStateDeviant() const override;
+
+            /**
+             * @brief Get the final state deviant.
+             *
+             * @return casadi::MX The final state deviant
+             */
+            casadi::MX getFinalStateDeviant() const override;
+
+            /**
+             * @brief Get the actual final state.
+             *
+             * @return casadi::MX The final state.
+             */
+            casadi::MX getFinalState() const override;
+
+            /**
+             * @brief Get the segment times vector. Each knot segment contributes its start and end time.
+             *
+             * @return casadi::DM The segment times vector
+             */
+            casadi::DM getSegmentTimes() const override;
+
+            /**
+             * @brief Get the segment times vector of the input. Each knot segment contributes its start and end time.
+             *
+             * @return casadi::DM The segment times vector
+             */
+            casadi::DM getUSegmentTimes() const override;
+
+            /**
+             * @brief Get the knot times vector.
+             *
+             * @return casadi::DM The knot times vector
+             */
+            casadi::DM getKnotTimes() const;
+
+            /**
+             * @brief Fills the lower bounds on decision variable (lbw) and upper bounds on decision variable (ubw) vectors with values.
+             *
+             * @param lbw The vector to be filled with lower bound values on decision variables.
+             * @param ubw The vector to be filled with upper bound values on decision variables.
+             */
+            void fill_lbw_ubw(std::vector<double> &lbw, std::vector<double> &ubw) override;
+
+            /**
+             * @brief Fills the lower bounds on general constraints (lbg) and upper bounds on general constraints (ubg) vectors with values.
+             *
+             * @param lbg The vector to be filled with general lower bound values.
+             * @param ubg The vector to be filled with general upper bound values.
+             */
+            void fill_lbg_ubg(std::vector<double> &lbg, std::vector<double> &ubg) override;
+
+            /**
+             * @brief Fills the initial guess vector (w0) with values.
+             *
+             * @param w0 The vector to be filled with initial guess values.
+             */
+            void fill_w0(std::vector<double> &w0) const override;
+
+            /**
+             * @brief Overwrites this segment's initial guess with its slice of a full initial guess vector, such as the previous solution.
+             *
+             * @param all_w0 The full initial guess vector, laid out like the one filled by fill_w0.
+             */
+            void update_w0(const std::vector<double> &all_w0) override;
+
+            /**
+             * @brief Fills the initial guesses of the multipliers of the decision variable bounds (lam_w0) and of the constraints (lam_g0).
+             *
+             * @param lam_w0 The vector to be filled with the decision variable bound multipliers, laid out like w0.
+             * @param lam_g0 The vector to be filled with the constraint multipliers, laid out like lbg.
+             */
+            void fill_lam0(std::vector<double> &lam_w0, std::vector<double> &lam_g0) const override;
+
+            /**
+             * @brief Overwrites this segment's multiplier guesses with its slices of full multiplier vectors, such as the previous solution.
+             *
+             * @param all_lam_w0 The full decision variable bound multiplier vector, laid out like the one filled by fill_lam0.
+             * @param all_lam_g0 The full constraint multiplier vector, laid out like the one filled by fill_lam0.
+             */
+            void update_lam0(const std::vector<double> &all_lam_w0, const std::vector<double> &all_lam_g0) override;
+
+            /**
+             * @brief Returns the starting and ending index in w.
+             *
+             * @return tuple_size_t The range of indices
+             */
+            tuple_size_t get_range_idx_decision_variables() const override;
+
+            /**
+             * @brief Returns the starting and ending index in g (call after evaluate_expression_graph!).
+             *
+             * @return tuple_size_t The range of indices
+             */
+            tuple_size_t get_range_idx_constraint_expressions() const override;
+
+            /**
+             * @brief Returns the starting and ending index in lbg/ubg.
+             *
+             * @return tuple_size_t The range of indices
+             */
+            tuple_size_t get_range_idx_constraint_bounds() const override;
+
+            /**
+             * @brief Returns the starting and ending index in lbw/ubw.
+             *
+             * @return tuple_size_t The range of indices
+             */
+            tuple_size_t get_range_idx_decision_bounds() const override;
+
+            /**
+             * @brief Get the stages of the segment in NLP order, one per knot and one for the final knot.
+             *
+             * @return std::vector<stage_structure_t> The stages
+             */
+            std::vector<stage_structure_t> getStageStructure() const override;
+
+            /**
+             * @brief Get the per-knot functions of the segment.
+             *
+             * @return std::vector<casadi::Function> The per-knot functions
+             */
+            std::vector<casadi::Function> getKnotFunctions() const override;
+
+            /**
+             * @brief Get the dXPoly object. The state is interpolated linearly between the knots.
+             *
+             * @return const std::shared_ptr<LagrangePolynomial>
+             */
+            const std::shared_ptr<LagrangePolynomial> get_dXPoly() const override
+            {
+                return std::make_shared<LagrangePolynomial>(dX_poly);
+            }
+
+            /**
+             * @brief Get the UPoly object. The input is piecewise constant.
+             *
+             * @return const std::shared_ptr<LagrangePolynomial>
+             */
+            const std::shared_ptr<LagrangePolynomial> get_UPoly() const override
+            {
+                return std::make_shared<LagrangePolynomial>(U_poly);
+            }
+
+            /**
+             * @brief Get the degree
+             *
+             * @return int The degree
+             */
+            int getStateDegree() const override
+            {
+                return dX_poly.d;
+            }
+
+            /**
+             * @brief Get the input degree
+             *
+             * @return int The input degree
+             */
+            int getInputDegree() const override
+            {
+                return U_poly.d;
+            }
+
+            /**
+             * @brief Get the knot num
+             *
+             * @return int The knot num
+             */
+            int getKnotNum() const override
+            {
+                return knot_num;
+            }
+
+        private:
+            /**
+             * @brief Build the per-knot functions from the dynamics, the cost and the constraints.
+             *
+             * @param G Vector of constraint data
+             */
+            void buildKnotFunctions(const std::vector<ConstraintData> &G);
+
+            /**
+             * @brief Map the per-knot functions over the current number of knot segments.
+             *
+             */
+            void initializeFunctionMaps();
+
+            /**
+             * @brief The (number of blocks, block size) of each region of the decision variables, in storage order: [dX0, U0].
+             *
+             */
+            std::vector<std::tuple<casadi_int, casadi_int>> decisionVariableRegions() const;
+
+            /**
+             * @brief The (number of blocks, block size) of each region of the constraints, in storage order: [shooting, general constraints...].
+             *
+             */
+            std::vector<std::tuple<casadi_int, casadi_int>> constraintRegions() const;
+
+            /**
+             * @brief Compute the permutations from the storage order to the stage-wise order, if stage-wise ordering is enabled.
+             *
+             */
+            void initializeOrdering();
+
+            /**
+             * @brief State polynomial used to interpolate the solution, linear between the knots.
+             *
+             */
+            LagrangePolynomial dX_poly;
+
+            /**
+             * @brief Input polynomial used to interpolate the solution, piecewise constant.
+             *
+             */
+            LagrangePolynomial U_poly;
+
+            /**
+             * @brief Knot point deviants state decision variables.
+             *
+             */
+            casadi::MXVector dX0_var_vec;
+
+            /**
+             * @brief Knot point state expressions (integral functions of the deviants).
+             *
+             */
+            casadi::MXVector X0_var_vec;
+
+            /**
+             * @brief Knot point input decision variables, one for each knot segment.
+             *
+             */
+            casadi::MXVector U0_var_vec;
+
+            /**
+             * @brief Per-knot state deviant at the end of the knot segment, integrated from the knot.
+             *
+             */
+            casadi::Function shooting_constraint;
+
+            /**
+             * @brief Per-knot cost accumulation.
+             *
+             */
+            casadi::Function q_cost;
+
+            /**
+             * @brief Per-knot user defined constraints, evaluated at the knot.
+             *
+             */
+            std::vector<casadi::Function> general_constraints;
+
+            /**
+             * @brief Implicit discrete-time function map. The map which matches the integrated final state with the state at the next knot.
+             *
+             */
+            casadi::Function shooting_constraint_map;
+
+            /**
+             * @brief The accumulated cost across all the knot segments found using the Runge-Kutta quadrature.
+             *
+             */
+            casadi::Function q_cost_fold;
+
+            /**
+             * @brief The cost of each knot segment, to be summed. Used instead of the fold when the map policy reduces the cost.
+             *
+             */
+            casadi::Function q_cost_map;
+
+            /**
+             * @brief User defined constraints mapped over the knots.
+             *
+             */
+            std::vector<casadi::Function> general_constraint_maps;
+
+            /**
+             * @brief Lower bounds associated with the constraints.
+             *
+             */
+            casadi::DM general_lbg;
+
+            /**
+             * @brief Upper bounds associated with the constraints.
+             *
+             */
+            casadi::DM general_ubg;
+
+            /**
+             * @brief Lower bounds associated with the decision variables.
+             *
+             */
+            casadi::DM general_lbw;
+
+            /**
+             * @brief Upper bounds associated with the decision variables.
+             *
+             */
+            casadi::DM general_ubw;
+
+            /**
+             * @brief Initial guess for associated with this segment
+             */
+            casadi::DM w0;
+
+            /**
+             * @brief Initial guess for the multipliers of the decision variable bounds associated with this segment
+             */
+            casadi::DM lam_w0;
+
+            /**
+             * @brief Initial guess for the multipliers of the constraints associated with this segment
+             */
+            casadi::DM lam_g0;
+
+            /**
+             * @brief If true, the decision variables and constraints are ordered knot by knot, which keeps the KKT system block banded.
+             */
+            bool stage_wise_ordering = false;
+
+            /**
+             * @brief For each decision variable in NLP order, its index in storage order. Empty when the orders coincide.
+             */
+            std::vector<casadi_int> w_permutation;
+
+            /**
+             * @brief For each constraint in NLP order, its index in storage order. Empty when the orders coincide.
+             */
+            std::vector<casadi_int> g_permutation;
+
+            /**
+             * @brief Integrator function.
+             *
+             */
+            casadi::Function Fint;
+
+            /**
+             * @brief Difference function.
+             *
+             */
+            casadi::Function Fdiff;
+
+            /**
+             * @brief Dynamics function.
+             *
+             */
+            casadi::Function F;
+
+            /**
+             * @brief Cost function.
+             *
+             */
+            casadi::Function L;
+
+            /**
+             * @brief Problem parameters used to build the expression graphs.
+             *
+             */
+            casadi::SX P;
+
+            /**
+             * @brief Knot length used to build the expression graphs.
+             *
+             */
+            casadi::SX H;
+
+            /**
+             * @brief Helper for indexing the state variables.
+             *
+             */
+            std::shared_ptr<States> st_m;
+
+            /**
+             * @brief Number of knot segments.
+             *
+             */
+            int knot_num;
+
+            /**
+             * @brief Number of Runge-Kutta 4 steps per knot segment.
+             *
+             */
+            int steps_per_knot;
+
+            /**
+             * @brief Ordered vector of segment times w.r.t global time. Each knot segment contributes its start and end time.
+             *
+             */
+            casadi::DM segment_times;
+
+            /**
+             * @brief Ordered vector of knot times for this segment w.r.t global time. Note that this coincides with the times for the decision variables of dX0.
+             *
+             */
+            casadi::DM knot_times;
+
+            /**
+             * @brief Ordered vector of input knot times for this segment w.r.t global time, without the final knot. Note that this coincides with the times for the decision variables of U0.
+             *
+             */
+            casadi::DM u_knot_times;
+        };
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cassert>
+#include <string>
 #include <vector>
 #include <pinocchio/autodiff/casadi.hpp>
 
@@ -7,6 +9,16 @@ namespace galileo
 {
     namespace opt
     {
+        /**
+         * @brief How the trajectory of a phase is transcribed into the NLP.
+         *
+         */
+        enum class TranscriptionMethod
+        {
+            PSEUDOSPECTRAL,   // Collocation with Lagrange polynomials at each knot segment
+            MULTIPLE_SHOOTING // Runge-Kutta 4 integration of each knot segment
+        };
+
         /**
          * @brief Class for holding simple Phase sequence metadata.
          *
@@ -83,6 +95,21 @@ namespace galileo
                  * @brief The time value for the phase.
                  */
                 double time_value = 1;
+
+                /**
+                 * @brief How the trajectory of this phase is transcribed.
+                 */
+                TranscriptionMethod transcription = TranscriptionMethod::PSEUDOSPECTRAL;
+
+                /**
+                 * @brief Degree of the state polynomial of the phase. A value of 0 uses the degree the trajectory was initialized with.
+                 */
+                int degree = 0;
+
+                /**
+                 * @brief Collocation scheme of the phase: "radau" or "legendre".
+                 */
+                std::string scheme = "radau";
             };
 
             /**
@@ -162,6 +189,13 @@ namespace galileo
              */
             const double &getDT() { return dt_; }
 
+            /**
+             * @brief Get the time at which the first phase in the sequence starts. Non-zero once leading phases have been dropped.
+             *
+             * @return double The start time.
+             */
+            double getStartTime() const { return phase_offset_.empty() ? 0.0 : phase_offset_.front().t0_offset; }
+
             /**
              * @brief Get the total number of knots in the Phase sequence.
              *
@@ -207,6 +241,64 @@ namespace galileo
                 return phase_sequence_[phase_idx];
             }
 
+            /**
+             * @brief Sets how the trajectory of the specified phase is transcribed.
+             */
+            const Phase &FillPhaseTranscription(int phase_idx, TranscriptionMethod transcription)
+            {
+                phase_sequence_[phase_idx].transcription = transcription;
+                return phase_sequence_[phase_idx];
+            }
+
+            /**
+             * @brief Sets the degree of the state polynomial of the specified phase.
+             */
+            const Phase &FillPhaseDegree(int phase_idx, int degree)
+            {
+                phase_sequence_[phase_idx].degree = degree;
+                return phase_sequence_[phase_idx];
+            }
+
+            /**
+             * @brief Sets the collocation scheme, "radau" or "legendre", of the specified phase.
+             */
+            const Phase &FillPhaseScheme(int phase_idx, const std::string &scheme)
+            {
+                phase_sequence_[phase_idx].scheme = scheme;
+                return phase_sequence_[phase_idx];
+            }
+
+            /**
+             * @brief Sets the number of knot points of the specified phase, shifting the knot offsets of the phases after it.
+             */
+            const Phase &FillPhaseKnotPoints(int phase_idx, int knot_points)
+            {
+                int knot_change = knot_points - phase_sequence_[phase_idx].knot_points;
+                phase_sequence_[phase_idx].knot_points = knot_points;
+                for (size_t i = phase_idx + 1; i < phase_offset_.size(); ++i)
+                {
+                    phase_offset_[i].knot0_offset += knot_change;
+                }
+                total_knots_ += knot_change;
+                return phase_sequence_[phase_idx];
+            }
+
+            /**
+             * @brief Append a copy of an existing phase, including its dynamics and cost, to the end of the sequence.
+             *
+             * @param phase The phase to append.
+             * @return The index of the newly added phase.
+             */
+            int appendPhase(const Phase &phase);
+
+            /**
+             * @brief Drop the first phases of the sequence, so that a receding horizon does not grow it without bound.
+             * The remaining phases keep their start times and knot offsets, and the indices of the phases shift down by n.
+             *
+             * @param n The number of leading phases to drop.
+             */
+            void dropLeadingPhases(int n);
+
         protected:
             /**
              * @brief A vector of Phase objects.
@@ -369,17 +461,36 @@ namespace galileo
             return phase_sequence_.size() - 1;
         }
 
+        template <typename MODE_T>
+        int PhaseSequence<MODE_T>::appendPhase(const Phase &phase)
+        {
+            int phase_index = commonAddPhase(phase.mode, phase.knot_points, phase.time_value, phase.phase_dynamics);
+            phase_sequence_[phase_index].phase_cost = phase.phase_cost;
+            phase_sequence_[phase_index].transcription = phase.transcription;
+            phase_sequence_[phase_index].degree = phase.degree;
+            phase_sequence_[phase_index].scheme = phase.scheme;
+            return phase_index;
+        }
+
+        template <typename MODE_T>
+        void PhaseSequence<MODE_T>::dropLeadingPhases(int n)
+        {
+            assert(n >= 0 && n < getNumPhases() && "Can only drop a strict subset of the phases");
+            phase_sequence_.erase(phase_sequence_.begin(), phase_sequence_.begin() + n);
+            phase_offset_.erase(phase_offset_.begin(), phase_offset_.begin() + n);
+        }
+
         // TODO: There's a very strange bug with this function! Accessing dt_ causes a segfault when called in LeggedRos, even though it is properly initialized....
         template <typename MODE_T>
         int PhaseSequence<MODE_T>::getPhaseIndexAtTime(double t, PHASE_SEQUENCE_ERROR &error_status) const
         {
-            if ((t < 0) || (t > dt_))
+            if ((t < getStartTime()) || (t > dt_))
             {
                 error_status = PHASE_SEQUENCE_ERROR::NOT_IN_DT;
                 return -1;
             }
 
-            for (int i = getNumPhases() - 1; i > 0; i--)
+            for (int i = getNumPhases() - 1; i >= 0; i--)
             {
                 bool is_in_phase_i = (t >= phase_offset_[i].t0_offset);
                 std::cout << "t: " << t << " t0_offset: " << phase_offset_[i].t0_offset << " is_in_phase_i: " << is_in_phase_i << std::endl;
@@ -395,13 +506,13 @@ namespace galileo
         template <typename MODE_T>
         int PhaseSequence<MODE_T>::getPhaseIndexAtKnot(int knot_idx, PHASE_SEQUENCE_ERROR &error_status) const
         {
-            if ((knot_idx < 0) || (knot_idx >= total_knots_))
+            if (getNumPhases() == 0 || (knot_idx < phase_offset_.front().knot0_offset) || (knot_idx >= total_knots_))
             {
                 error_status = PHASE_SEQUENCE_ERROR::NOT_IN_DT;
                 return -1;
             }
 
-            for (int i = getNumPhases() - 1; i > 0; i--)
+            for (int i = getNumPhases() - 1; i >= 0; i--)
             {
                 bool is_in_phase_i = (knot_idx >= phase_offset_[i].knot0_offset);
                 if (is_in_phase_i)
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace galileo
+{
+    namespace opt
+    {
+        namespace solution
+        {
+            /**
+             * @brief Evaluate a polynomial with Horner's method. Only multiplications and additions, so it suits embedded consumers.
+             *
+             * @param coefficients The coefficients of the polynomial, highest power first
+             * @param order The number of coefficients
+             * @param s The value to evaluate the polynomial at
+             * @return double The value of the polynomial
+             */
+            inline double hornerEvaluate(const double *coefficients, uint32_t order, double s)
+            {
+                double value = coefficients[0];
+                for (uint32_t m = 1; m < order; ++m)
+                {
+                    value = value * s + coefficients[m];
+                }
+                return value;
+            }
+
+            /**
+             * @brief Allocator which aligns to a cache line of 64 bytes. Eigen::aligned_allocator only guarantees the alignment of
+             * its vectorization, which is 16 or 32 bytes.
+             *
+             * @tparam T The type of the elements
+             */
+            template <class T>
+            struct cache_aligned_allocator
+            {
+                using value_type = T;
+
+                /**
+                 * @brief The alignment of the allocations in bytes.
+                 *
+                 */
+                static const size_t alignment = 64;
+
+                cache_aligned_allocator() = default;
+
+                template <class U>
+                cache_aligned_allocator(const cache_aligned_allocator<U> &) noexcept {}
+
+                T *allocate(size_t n)
+                {
+                    if (n > (SIZE_MAX - alignment) / sizeof(T))
+                        throw std::bad_alloc();
+                    /*aligned_alloc requires the size to be a multiple of the alignment*/
+                    size_t bytes = (n * sizeof(T) + alignment - 1) / alignment * alignment;
+                    void *ptr = std::aligned_alloc(alignment, bytes == 0 ? alignment : bytes);
+                    if (ptr == nullptr)
+                        throw std::bad_alloc();
+                    return static_cast<T *>(ptr);
+                }
+
+                void deallocate(T *ptr, size_t) noexcept { std::free(ptr); }
+
+                template <class U>
+                bool operator==(const cache_aligned_allocator<U> &) const noexcept { return true; }
+
+                template <class U>
+                bool operator!=(const cache_aligned_allocator<U> &) const noexcept { return false; }
+            };
+
+            /**
+             * @brief Struct for storing a piecewise polynomial in monomial form. Each interval holds, for each row, the coefficients
+             * of a polynomial of the time since the start of the interval, highest power first. The coefficients of an interval
+             * are contiguous and padded to a whole number of cache lines.
+             *
+             */
+            struct piecewise_monomial_t
+            {
+                /**
+                 * @brief Identifies a serialized piecewise monomial.
+                 *
+                 */
+                static const uint32_t magic = 0x4E4D5047;
+
+                /**
+                 * @brief Version of the serialized layout.
+                 *
+                 */
+                static const uint32_t version = 1;
+
+                /**
+                 * @brief Number of doubles in a cache line, the alignment of the intervals.
+                 *
+                 */
+                static const uint32_t cache_line_doubles = 8;
+
+                /**
+                 * @brief Resize the piecewise polynomial, and set all of its coefficients and breakpoints to zero.
+                 *
+                 * @param num_rows_ The number of rows, each an independent polynomial
+                 * @param order_ The number of coefficients of each polynomial
+                 * @param num_intervals_ The number of intervals
+                 */
+                void Resize(uint32_t num_rows_, uint32_t order_, uint32_t num_intervals_);
+
+                /**
+                 * @brief Get the coefficients of a row of an interval.
+                 *
+                 * @param interval The index of the interval
+                 * @param row The row
+                 * @return double* The order coefficients of the row, highest power first
+                 */
+                double *Coefficients(uint32_t interval, uint32_t row) { return coefficients.data() + interval * interval_stride + row * order; }
+
+                /**
+                 * @brief Get the coefficients of a row of an interval.
+                 *
+                 * @param interval The index of the interval
+                 * @param row The row
+                 * @return const double* The order coefficients of the row, highest power first
+                 */
+                const double *Coefficients(uint32_t interval, uint32_t row) const { return coefficients.data() + interval * interval_stride + row * order; }
+
+                /**
+                 * @brief Evaluate every row at a time. A time on a breakpoint is evaluated on the interval which starts there.
+                 *
+                 * @param t The time
+                 * @param result The value of each row, of size num_rows
+                 * @return bool True if t is within the breakpoints
+                 */
+                bool Evaluate(double t, Eigen::Ref<Eigen::VectorXd> result) const;
+
+                /**
+                 * @brief Serialize to a contiguous blob in host byte order: a header of six uint32 values (magic, version, num_rows,
+                 * order, num_intervals, interval_stride), the breakpoints, and the coefficients starting at a multiple of 64 bytes from
+                 * the start of the blob. The blob itself is 64-byte aligned, so the coefficients of every interval start on a cache line;
+                 * a consumer which copies it must keep that alignment for the same to hold.
+                 *
+                 * @return std::vector<uint8_t, cache_aligned_allocator<uint8_t>> The blob
+                 */
+                std::vector<uint8_t, cache_aligned_allocator<uint8_t>> Serialize() const;
+
+                /**
+                 * @brief Deserialize a blob written by Serialize. The sizes in the header are checked against the size of the blob before
+                 * anything is allocated, so a truncated or corrupt blob is rejected rather than read out of bounds.
+                 *
+                 * @param data The blob
+                 * @param size The size of the blob in bytes
+                 * @param monomial [out] The piecewise polynomial
+                 * @return bool True if the blob is a valid piecewise monomial of this version
+                 */
+                static bool Deserialize(const uint8_t *data, size_t size, piecewise_monomial_t &monomial);
+
+                /**
+                 * @brief The number of rows, each an independent polynomial.
+                 *
+                 */
+                uint32_t num_rows = 0;
+
+                /**
+                 * @brief The number of coefficients of each polynomial, the highest degree plus one.
+                 *
+                 */
+                uint32_t order = 0;
+
+                /**
+                 * @brief The number of intervals.
+                 *
+                 */
+                uint32_t num_intervals = 0;
+
+                /**
+                 * @brief The number of doubles between the coefficients of consecutive intervals.
+                 *
+                 */
+                uint32_t interval_stride = 0;
+
+                /**
+                 * @brief The start time of each interval, followed by the end time of the last interval.
+                 *
+                 */
+                std::vector<double> breakpoints;
+
+                /**
+                 * @brief The coefficients of each interval, row by row, with the highest power first. 64-byte aligned, so each interval
+                 * starts on a cache line.
+                 *
+                 */
+                std::vector<double, cache_aligned_allocator<double>> coefficients;
+            };
+        }
+    }
+}
@@ -1,7 +1,6 @@
 #pragma once
 
 #include "galileo/opt/Segment.h"
-#include "galileo/opt/LagrangePolynomial.h"
 #include "galileo/tools/CasadiConversions.h"
 #include <chrono>
 
@@ -27,16 +26,20 @@ namespace galileo
              * @param d Polynomial degree
              * @param knot_num_ Number of knots in the segment
              * @param h_ Period of each knot segment
+             * @param stage_wise_ordering_ Order the decision variables and constraints knot by knot instead of by kind
+             * @param scheme Collocation scheme: "radau" or "legendre"
+             * @param fused_kernel_ Evaluate the defects, constraints, and cost of each knot segment with a single function, so their common subexpressions are evaluated once
              *
              */
-            PseudospectralSegment(std::shared_ptr<GeneralProblemData> problem, casadi::Function F, casadi::Function L, std::shared_ptr<States> st_m_, int d, int knot_num_, double h_);
+            PseudospectralSegment(std::shared_ptr<GeneralProblemData> problem, casadi::Function F, casadi::Function L, std::shared_ptr<States> st_m_, int d, int knot_num_, double h_, bool stage_wise_ordering_ = false, const std::string &scheme = "radau", bool fused_kernel_ = false);
 
             /**
              * @brief Initialize the relevant expressions.
              *
              * @param d Polynomial degree
+             * @param scheme Collocation scheme: "radau" or "legendre"
              */
-            void initializeExpressionVariables(int d);
+            void initializeExpressionVariables(int d, const std::string &scheme);
 
             /**
              * @brief Initialize the vector of segment times which constraints are evaluated at.
@@ -57,9 +60,11 @@ namespace galileo
              *
              * @param x0_global Global starting state to integrate from (used for initial guess)
              * @param x0_local Local starting state to integrate from
+             * @param parameters Problem parameters the cost depends on
+             * @param knot_length_ Period of each knot segment, a parameter of the NLP
              *
              */
-            void initializeKnotSegments(casadi::DM x0_global, casadi::MX x0_local) override;
+            void initializeKnotSegments(casadi::DM x0_global, casadi::MX x0_local, casadi::MX parameters, casadi::MX knot_length_) override;
 
             /**
              * @brief Build the function graph.
@@ -69,6 +74,21 @@ namespace galileo
              */
             void initializeExpressionGraph(std::vector<ConstraintData> G, std::shared_ptr<DecisionData> Wdata) override;
 
+            /**
+             * @brief Evaluate the bounds of the constraints and of the decision variables at the current segment times.
+             *
+             * @param G Vector of constraint data, with the same constraints the expression graph was built with
+             * @param Wdata Decision bound and initial guess data for the state and input
+             */
+            void updateBounds(const std::vector<ConstraintData> &G, std::shared_ptr<DecisionData> Wdata) override;
+
+            /**
+             * @brief Evaluate the initial guess at the current segment times.
+             *
+             * @param Wdata Decision bound and initial guess data for the state and input
+             */
+            void updateInitialGuess(std::shared_ptr<DecisionData> Wdata) override;
+
             /**
              * @brief Evaluate the expressions with the actual decision variables.
              *
@@ -79,12 +99,13 @@ namespace galileo
             void evaluateExpressionGraph(casadi::MX &J0, casadi::MXVector &w, casadi::MXVector &g) override;
 
             /**
-             * @brief Extract the solution from the decision variable vector.
+             * @brief Extract the numeric solution of the segment from the decision variable vector of the NLP.
              *
-             * @param w Decision variable vector
-             * @return casadi::MX Solution values
+             * @param w Decision variable vector of the NLP, in NLP order
+             * @param solx [out] The states of the segment, one column per node
+             * @param solu [out] The inputs of the segment, one column per node
              */
-            casadi::MXVector extractSolution(casadi::MX &w) const override;
+            void extractSolution(const std::vector<double> &w, Eigen::MatrixXd &solx, Eigen::MatrixXd &solu) const override;
 
             /**
              * @brief Get the initial state.
@@ -140,7 +161,7 @@ namespace galileo
              *
              * @return casadi::DM The segment times vector
              */
-            casadi::DM getUSegmentTimes() const;
+            casadi::DM getUSegmentTimes() const override;
 
             /**
              * @brief Get the knot times vector of the input.
@@ -188,6 +209,29 @@ namespace galileo
              */
             void fill_w0(std::vector<double> &w0) const override;
 
+            /**
+             * @brief Overwrites this segment's initial guess with its slice of a full initial guess vector, such as the previous solution.
+             *
+             * @param all_w0 The full initial guess vector, laid out like the one filled by fill_w0.
+             */
+            void update_w0(const std::vector<double> &all_w0) override;
+
+            /**
+             * @brief Fills the initial guesses of the multipliers of the decision variable bounds (lam_w0) and of the constraints (lam_g0).
+             *
+             * @param lam_w0 The vector to be filled with the decision variable bound multipliers, laid out like w0.
+             * @param lam_g0 The vector to be filled with the constraint multipliers, laid out like lbg.
+             */
+            void fill_lam0(std::vector<double> &lam_w0, std::vector<double> &lam_g0) const override;
+
+            /**
+             * @brief Overwrites this segment's multiplier guesses with its slices of full multiplier vectors, such as the previous solution.
+             *
+             * @param all_lam_w0 The full decision variable bound multiplier vector, laid out like the one filled by fill_lam0.
+             * @param all_lam_g0 The full constraint multiplier vector, laid out like the one filled by fill_lam0.
+             */
+            void update_lam0(const std::vector<double> &all_lam_w0, const std::vector<double> &all_lam_g0) override;
+
             /**
              * @brief Returns the starting and ending index in w.
              *
@@ -216,12 +260,26 @@ namespace galileo
              */
             tuple_size_t get_range_idx_decision_bounds() const override;
 
+            /**
+             * @brief Get the stages of the segment in NLP order, one per knot and one for the final knot.
+             *
+             * @return std::vector<stage_structure_t> The stages
+             */
+            std::vector<stage_structure_t> getStageStructure() const override;
+
+            /**
+             * @brief Get the per-knot functions of the segment.
+             *
+             * @return std::vector<casadi::Function> The per-knot functions
+             */
+            std::vector<casadi::Function> getKnotFunctions() const override;
+
             /**
              * @brief Get the dXPoly object.
              *
              * @return const std::shared_ptr<LagrangePolynomial>
              */
-            const std::shared_ptr<LagrangePolynomial> get_dXPoly() const
+            const std::shared_ptr<LagrangePolynomial> get_dXPoly() const override
             {
                 return std::make_shared<LagrangePolynomial>(dX_poly);
             }
@@ -231,7 +289,7 @@ namespace galileo
              *
              * @return const std::shared_ptr<LagrangePolynomial>
              */
-            const std::shared_ptr<LagrangePolynomial> get_UPoly() const
+            const std::shared_ptr<LagrangePolynomial> get_UPoly() const override
             {
                 return std::make_shared<LagrangePolynomial>(U_poly);
             }
@@ -241,7 +299,7 @@ namespace galileo
              *
              * @return int The degree
              */
-            int getStateDegree() const
+            int getStateDegree() const override
             {
                 return dX_poly.d;
             }
@@ -251,7 +309,7 @@ namespace galileo
              *
              * @return int The input degree
              */
-            int getInputDegree() const
+            int getInputDegree() const override
             {
                 return U_poly.d;
             }
@@ -261,7 +319,7 @@ namespace galileo
              *
              * @return int The knot num
              */
-            int getKnotNum() const
+            int getKnotNum() const override
             {
                 return knot_num;
             }
@@ -287,6 +345,37 @@ namespace galileo
              */
             casadi::MX processOffsetVector(casadi::MXVector &vec) const;
 
+            /**
+             * @brief Build the per-knot functions from the dynamics, the cost and the constraints.
+             *
+             * @param G Vector of constraint data
+             */
+            void buildKnotFunctions(const std::vector<ConstraintData> &G);
+
+            /**
+             * @brief Map the per-knot functions over the current number of knot segments.
+             *
+             */
+            void initializeFunctionMaps();
+
+            /**
+             * @brief The (number of blocks, block size) of each region of the decision variables, in storage order: [dX0, dXc, U0, Uc].
+             *
+             */
+            std::vector<std::tuple<casadi_int, casadi_int>> decisionVariableRegions() const;
+
+            /**
+             * @brief The (number of blocks, block size) of each region of the constraints, in storage order: [collocation, xf, uf, general constraints...].
+             *
+             */
+            std::vector<std::tuple<casadi_int, casadi_int>> constraintRegions() const;
+
+            /**
+             * @brief Compute the permutations from the storage order to the stage-wise order, if stage-wise ordering is enabled.
+             *
+             */
+            void initializeOrdering();
+
             /**
              * @brief Input polynomial. Helper object to store polynomial information for the input.
              *
@@ -344,16 +433,40 @@ namespace galileo
             casadi::MXVector U0_var_vec;
 
             /**
-             * @brief casadi::Function map for extracting the solution from the ocp solution vector.
+             * @brief Per-knot function for extracting the solution from the ocp solution vector.
              *
              */
-            casadi::Function sol_map_func;
+            casadi::Function sol_map;
 
             /**
-             * @brief Solution function.
+             * @brief Per-knot collocation equations. Kept so the maps can be resized without rebuilding the expression graph.
              *
              */
-            casadi::Function get_sol_func;
+            casadi::Function collocation_constraint;
+
+            /**
+             * @brief Per-knot final state expression.
+             *
+             */
+            casadi::Function xf_constraint;
+
+            /**
+             * @brief Per-knot final input expression.
+             *
+             */
+            casadi::Function uf_constraint;
+
+            /**
+             * @brief Per-knot cost accumulation.
+             *
+             */
+            casadi::Function q_cost;
+
+            /**
+             * @brief Per-knot user defined constraints, evaluated at each collocation point.
+             *
+             */
+            std::vector<casadi::Function> general_constraints;
 
             /**
              * @brief Implicit discrete-time function map. This function map returns the vector of collocation equations
@@ -383,12 +496,31 @@ namespace galileo
              */
             casadi::Function q_cost_fold;
 
+            /**
+             * @brief Implicit discrete-time function map. The cost of each knot segment, to be summed. Used instead of the fold when the map policy reduces the cost.
+             *
+             */
+            casadi::Function q_cost_map;
+
             /**
              * @brief User defined constraints, which are functions with certain bounds associated with them.
              *
              */
             std::vector<casadi::Function> general_constraint_maps;
 
+            /**
+             * @brief Per-knot function returning the collocation equations, the final state and input, the general constraints, and the
+                cost contribution of a knot segment, with common subexpressions eliminated across all of them. Only built in fused mode.
+             *
+             */
+            casadi::Function knot_kernel;
+
+            /**
+             * @brief Map of the knot kernel over the knot segments.
+             *
+             */
+            casadi::Function knot_kernel_map;
+
             /**
              * @brief Lower bounds associated with the general constraint maps.
              *
@@ -418,6 +550,36 @@ namespace galileo
              */
             casadi::DM w0;
 
+            /**
+             * @brief Initial guess for the multipliers of the decision variable bounds associated with this segment
+             */
+            casadi::DM lam_w0;
+
+            /**
+             * @brief Initial guess for the multipliers of the constraints associated with this segment
+             */
+            casadi::DM lam_g0;
+
+            /**
+             * @brief If true, the decision variables and constraints are ordered knot by knot, which keeps the KKT system block banded.
+             */
+            bool stage_wise_ordering = false;
+
+            /**
+             * @brief If true, each knot segment is evaluated by the knot kernel instead of by one function per constraint kind.
+             */
+            bool fused_kernel = false;
+
+            /**
+             * @brief For each decision variable in NLP order, its index in storage order. Empty when the orders coincide.
+             */
+            std::vector<casadi_int> w_permutation;
+
+            /**
+             * @brief For each constraint in NLP order, its index in storage order. Empty when the orders coincide.
+             */
+            std::vector<casadi_int> g_permutation;
+
             /**
              * @brief Integrator function.
              *
@@ -478,6 +640,18 @@ namespace galileo
              */
             casadi::SX Lc;
 
+            /**
+             * @brief Problem parameters used to build the expression graphs.
+             *
+             */
+            casadi::SX P;
+
+            /**
+             * @brief Knot length used to build the expression graphs.
+             *
+             */
+            casadi::SX H;
+
             /**
              * @brief Helper for indexing the state variables.
              *
@@ -2,6 +2,8 @@
 
 #include "galileo/opt/States.h"
 #include "galileo/opt/Constraint.h"
+#include "galileo/opt/LagrangePolynomial.h"
+#include "galileo/opt/MapPolicy.h"
 #include <cassert>
 
 namespace galileo
@@ -11,6 +13,39 @@ namespace galileo
 
         using tuple_size_t = std::tuple<size_t, size_t>;
 
+        /**
+         * @brief Struct for the structure of a stage of an optimal control problem, as seen by a structure exploiting solver. The
+         * decision variables of a stage are its states followed by its controls, and the gap closing constraints of a stage
+         * determine the states of the next stage.
+         *
+         */
+        struct stage_structure_t
+        {
+            /**
+             * @brief Number of states of the stage.
+             *
+             */
+            casadi_int nx = 0;
+
+            /**
+             * @brief Number of controls of the stage.
+             *
+             */
+            casadi_int nu = 0;
+
+            /**
+             * @brief Rows of the gap closing constraints, relative to the first constraint of the segment in NLP order.
+             *
+             */
+            std::vector<casadi_int> gap_closing_rows;
+
+            /**
+             * @brief Rows of the path constraints, relative to the first constraint of the segment in NLP order.
+             *
+             */
+            std::vector<casadi_int> path_rows;
+        };
+
         /**
          * @brief Base class for a segment used in TrajectoryOpt.
          *
@@ -25,12 +60,13 @@ namespace galileo
             virtual ~Segment() = default;
 
             /**
-             * @brief Extract the solution from the decision variable vector.
+             * @brief Extract the numeric solution of the segment from the decision variable vector of the NLP.
              *
-             * @param w Decision variable vector
-             * @return casadi::MX Solution values
+             * @param w Decision variable vector of the NLP, in NLP order
+             * @param solx [out] The states of the segment, one column per node
+             * @param solu [out] The inputs of the segment, one column per node
              */
-            virtual casadi::MXVector extractSolution(casadi::MX &w) const = 0;
+            virtual void extractSolution(const std::vector<double> &w, Eigen::MatrixXd &solx, Eigen::MatrixXd &solu) const = 0;
 
             /**
              * @brief Get the initial state.
@@ -74,6 +110,41 @@ namespace galileo
              */
             virtual casadi::DM getUSegmentTimes() const = 0;
 
+            /**
+             * @brief Get the state polynomial used to interpolate the solution within each knot segment.
+             *
+             * @return const std::shared_ptr<LagrangePolynomial> The state polynomial
+             */
+            virtual const std::shared_ptr<LagrangePolynomial> get_dXPoly() const = 0;
+
+            /**
+             * @brief Get the input polynomial used to interpolate the solution within each knot segment.
+             *
+             * @return const std::shared_ptr<LagrangePolynomial> The input polynomial
+             */
+            virtual const std::shared_ptr<LagrangePolynomial> get_UPoly() const = 0;
+
+            /**
+             * @brief Get the degree of the state polynomial. Each knot segment of the solution holds degree + 1 states.
+             *
+             * @return int The state degree
+             */
+            virtual int getStateDegree() const = 0;
+
+            /**
+             * @brief Get the degree of the input polynomial. Each knot segment of the solution holds degree + 1 inputs.
+             *
+             * @return int The input degree
+             */
+            virtual int getInputDegree() const = 0;
+
+            /**
+             * @brief Get the number of knot segments.
+             *
+             * @return int The number of knot segments
+             */
+            virtual int getKnotNum() const = 0;
+
             /**
              * @brief Initialize the vector of segment times which constraints are evaluated at.
              *
@@ -92,9 +163,11 @@ namespace galileo
              *
              * @param x0_global Global starting state to integrate from (used for initial guess)
              * @param x0_local Local starting state to integrate from
+             * @param parameters Problem parameters the cost depends on
+             * @param knot_length_ Period of each knot segment, a parameter of the NLP
              *
              */
-            virtual void initializeKnotSegments(casadi::DM x0_global, casadi::MX x0_local) = 0;
+            virtual void initializeKnotSegments(casadi::DM x0_global, casadi::MX x0_local, casadi::MX parameters, casadi::MX knot_length_) = 0;
 
             /**
              * @brief Build the function graph.
@@ -104,6 +177,22 @@ namespace galileo
              */
             virtual void initializeExpressionGraph(std::vector<ConstraintData> G, std::shared_ptr<DecisionData> Wdata) = 0;
 
+            /**
+             * @brief Evaluate the bounds of the constraints and of the decision variables at the current segment times.
+             * The expression graph does not depend on the bounds, so this is all that changes when the segment is moved or stretched in time.
+             *
+             * @param G Vector of constraint data, with the same constraints the expression graph was built with
+             * @param Wdata Decision bound and initial guess data for the state and input
+             */
+            virtual void updateBounds(const std::vector<ConstraintData> &G, std::shared_ptr<DecisionData> Wdata) = 0;
+
+            /**
+             * @brief Evaluate the initial guess at the current segment times.
+             *
+             * @param Wdata Decision bound and initial guess data for the state and input
+             */
+            virtual void updateInitialGuess(std::shared_ptr<DecisionData> Wdata) = 0;
+
             /**
              * @brief Evaluate the expressions with the actual decision variables.
              *
@@ -145,6 +234,29 @@ namespace galileo
              */
             virtual void fill_w0(std::vector<double> &w0) const = 0;
 
+            /**
+             * @brief Overwrites this segment's initial guess with its slice of a full initial guess vector, such as the previous solution.
+             *
+             * @param all_w0 The full initial guess vector, laid out like the one filled by fill_w0.
+             */
+            virtual void update_w0(const std::vector<double> &all_w0) = 0;
+
+            /**
+             * @brief Fills the initial guesses of the multipliers of the decision variable bounds (lam_w0) and of the constraints (lam_g0).
+             *
+             * @param lam_w0 The vector to be filled with the decision variable bound multipliers, laid out like w0.
+             * @param lam_g0 The vector to be filled with the constraint multipliers, laid out like lbg.
+             */
+            virtual void fill_lam0(std::vector<double> &lam_w0, std::vector<double> &lam_g0) const = 0;
+
+            /**
+             * @brief Overwrites this segment's multiplier guesses with its slices of full multiplier vectors, such as the previous solution.
+             *
+             * @param all_lam_w0 The full decision variable bound multiplier vector, laid out like the one filled by fill_lam0.
+             * @param all_lam_g0 The full constraint multiplier vector, laid out like the one filled by fill_lam0.
+             */
+            virtual void update_lam0(const std::vector<double> &all_lam_w0, const std::vector<double> &all_lam_g0) = 0;
+
             /**
              * @brief Returns the starting and ending index in w.
              *
@@ -173,6 +285,166 @@ namespace galileo
              */
             virtual tuple_size_t get_range_idx_decision_bounds() const = 0;
 
+            /**
+             * @brief Get the stages of the segment in NLP order, one per knot and one for the final knot. Only valid with stage-wise
+             * ordering. The final knot has no constraints of its own: the constraint joining it to the next segment closes its gap.
+             *
+             * @return std::vector<stage_structure_t> The stages
+             */
+            virtual std::vector<stage_structure_t> getStageStructure() const = 0;
+
+            /**
+             * @brief Set the execution policy of the maps of the segment. Takes effect when the expression graph is initialized.
+             *
+             * @param policy The map policy
+             */
+            void setMapPolicy(const MapPolicy &policy) { map_policy = policy; }
+
+            /**
+             * @brief Evaluate the cost with a map over the knots followed by a sum, instead of a fold. A fold chains the knots
+             * through the accumulated cost, so neither the cost nor its derivatives can be evaluated in parallel. Takes effect
+             * when the expression graph is initialized.
+             *
+             * @param enable True to map and reduce the cost
+             */
+            void setMapReduceCost(bool enable) { map_reduce_cost = enable; }
+
+            /**
+             * @brief Set the period of each knot segment. The knot length is a parameter of the NLP, so only the segment times,
+             * the bounds, and the value of the parameter change.
+             *
+             * @param h_ The period of each knot segment
+             */
+            void setKnotLength(double h_)
+            {
+                assert(h_ > 0 && "h must be a positive duration");
+                h = h_;
+                T = getKnotNum() * h;
+            }
+
+            /**
+             * @brief Get the per-knot functions of the segment. They only depend on the dynamics, cost, constraints and discretization
+             * of the segment, so they can be shared with segments which have the same ones. Empty before the expression graph is initialized.
+             *
+             * @return std::vector<casadi::Function> The per-knot functions, in an order defined by the segment type
+             */
+            virtual std::vector<casadi::Function> getKnotFunctions() const = 0;
+
+            /**
+             * @brief Reuse the per-knot functions of another segment of the same type, dynamics, cost, constraints and discretization.
+             * Takes effect when the expression graph is initialized, which then only computes the bounds and the initial guess.
+             *
+             * @param knot_functions The per-knot functions returned by getKnotFunctions
+             */
+            void reuseKnotFunctions(const std::vector<casadi::Function> &knot_functions) { reused_knot_functions = knot_functions; }
+
+        protected:
+            /**
+             * @brief Build the permutation which interleaves the blocks of the regions stage by stage.
+             *
+             * @param regions The (number of blocks, block size) of each region, in storage order
+             * @param stage_order The order in which the regions contribute their blocks to each stage
+             * @return std::vector<casadi_int> For each element in stage order, its index in storage order
+             */
+            static std::vector<casadi_int> stageWisePermutation(const std::vector<std::tuple<casadi_int, casadi_int>> &regions, const std::vector<size_t> &stage_order);
+
+            /**
+             * @brief Order a vector stored by kind in the order of the NLP.
+             *
+             * @param vec The vector in storage order
+             * @param permutation The permutation to apply, empty for the identity
+             * @return std::vector<double> The vector in NLP order
+             */
+            static std::vector<double> toNLPOrder(const casadi::DM &vec, const std::vector<casadi_int> &permutation);
+
+            /**
+             * @brief Order a slice of a vector in the order of the NLP in storage order.
+             *
+             * @param begin Start of the slice in NLP order
+             * @param end End of the slice in NLP order
+             * @param permutation The permutation applied by toNLPOrder, empty for the identity
+             * @return casadi::DM The slice in storage order
+             */
+            static casadi::DM fromNLPOrder(std::vector<double>::const_iterator begin, std::vector<double>::const_iterator end, const std::vector<casadi_int> &permutation);
+
+            /**
+             * @brief Set the function which extracts the solution of the segment, and allocate its buffers once, so extracting a
+             * solution does not allocate.
+             *
+             * @param extraction Function (x0_global, w in storage order, h) -> (solx, solu), with dense outputs
+             */
+            void initializeExtraction(const casadi::Function &extraction);
+
+            /**
+             * @brief Evaluate the extraction function on the slice of w of this segment, straight into solx and solu.
+             *
+             * @param w The solution vector of the NLP
+             * @param permutation The permutation of the decision variables of the segment applied by toNLPOrder, empty for the identity
+             * @param solx [out] The states of the segment
+             * @param solu [out] The inputs of the segment
+             */
+            void evaluateExtraction(const std::vector<double> &w, const std::vector<casadi_int> &permutation, Eigen::MatrixXd &solx, Eigen::MatrixXd &solu) const;
+
+            /**
+             * @brief Execution policy of the maps of the segment.
+             *
+             */
+            MapPolicy map_policy;
+
+            /**
+             * @brief True if the cost is a map over the knots followed by a sum, false if it is a fold.
+             *
+             */
+            bool map_reduce_cost = false;
+
+            /**
+             * @brief Per-knot functions of another segment to use instead of building them, empty to build them.
+             *
+             */
+            std::vector<casadi::Function> reused_knot_functions;
+
+            /**
+             * @brief Function (x0_global, w in storage order, h) -> (solx, solu) which extracts the solution of the segment.
+             *
+             */
+            casadi::Function extraction_func;
+
+            /**
+             * @brief Memory of extraction_func checked out for the extraction.
+             *
+             */
+            int extraction_memory = -1;
+
+            /**
+             * @brief Buffer for the slice of w of the segment in storage order.
+             *
+             */
+            mutable std::vector<double> extraction_w;
+
+            /**
+             * @brief Input pointers of extraction_func.
+             *
+             */
+            mutable std::vector<const double *> extraction_arg;
+
+            /**
+             * @brief Output pointers of extraction_func.
+             *
+             */
+            mutable std::vector<double *> extraction_res;
+
+            /**
+             * @brief Integer work vector of extraction_func.
+             *
+             */
+            mutable std::vector<casadi_int> extraction_iw;
+
+            /**
+             * @brief Work vector of extraction_func.
+             *
+             */
+            mutable std::vector<double> extraction_work;
+
         public:
             /**
              * @brief Local initial state.
@@ -186,6 +458,18 @@ namespace galileo
              */
             casadi::DM x0_global;
 
+            /**
+             * @brief Problem parameters the cost depends on.
+             *
+             */
+            casadi::MX parameters;
+
+            /**
+             * @brief Period of each knot segment in the expression graph. A parameter of the NLP, whose value is h.
+             *
+             */
+            casadi::MX knot_length;
+
             /**
              * @brief Period of EACH KNOT SEGMENT within this pseudospectral segment.
              *
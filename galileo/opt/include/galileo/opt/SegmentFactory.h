@@ -0,0 +1,46 @@
+#pragma once
+
+#include "galileo/opt/PseudospectralSegment.h"
+#include "galileo/opt/MultipleShootingSegment.h"
+#include "galileo/opt/PhaseSequence.h"
+
+namespace galileo
+{
+    namespace opt
+    {
+        /**
+         * @brief Creates the segment of a phase for its transcription method.
+         *
+         */
+        class SegmentFactory
+        {
+        public:
+            /**
+             * @brief Create a segment.
+             *
+             * @param transcription The transcription method
+             * @param problem Pointer to the problem data
+             * @param F Dynamics function
+             * @param L Cost function
+             * @param st_m Pointer to the state indices helper
+             * @param d Polynomial degree, used by pseudospectral segments
+             * @param scheme Collocation scheme, "radau" or "legendre", used by pseudospectral segments
+             * @param knot_num Number of knots in the segment
+             * @param h Period of each knot segment
+             * @param stage_wise_ordering Order the decision variables and constraints knot by knot instead of by kind
+             * @param fused_kernel Evaluate each knot segment with a single function, used by pseudospectral segments
+             * @return std::shared_ptr<Segment> The segment
+             */
+            static std::shared_ptr<Segment> createSegment(TranscriptionMethod transcription, std::shared_ptr<GeneralProblemData> problem, casadi::Function F, casadi::Function L,
+                                                          std::shared_ptr<States> st_m, int d, const std::string &scheme, int knot_num, double h, bool stage_wise_ordering = false, bool fused_kernel = false);
+
+            /**
+             * @brief Parse a transcription method from its name, "pseudospectral" or "multiple_shooting".
+             *
+             * @param name The name of the transcription method
+             * @return TranscriptionMethod The transcription method
+             */
+            static TranscriptionMethod transcriptionFromString(const std::string &name);
+        };
+    }
+}
@@ -2,8 +2,11 @@
 
 #include "galileo/opt/LagrangePolynomial.h"
 #include "galileo/opt/Constraint.h"
+#include "galileo/opt/MapPolicy.h"
+#include "galileo/opt/PiecewiseMonomial.h"
 #include "galileo/tools/CasadiConversions.h"
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 #include <string>
 
 #include <chrono>
@@ -151,6 +154,96 @@ namespace galileo
                 LagrangePolynomial input_poly;
             };
 
+            /**
+             * @brief Struct for storing a query of the solution at a fixed set of times. The interpolation weights of the query are
+             * prepared once for the layout of the solution, so that each new solution with the same layout is evaluated by one
+             * sparse matrix product.
+             *
+             */
+            struct prepared_query_t
+            {
+                /**
+                 * @brief Default constructor.
+                 *
+                 */
+                prepared_query_t() {}
+
+                /**
+                 * @brief Construct a new prepared_query_t object.
+                 *
+                 * @param times_ A vector of times at which the solution is evaluated, relative to the start of the solution.
+                 */
+                prepared_query_t(Eigen::VectorXd times_) { this->times = times_; }
+
+                /**
+                 * @brief A vector of times at which the solution is evaluated, relative to the start of the solution.
+                 *
+                 */
+                Eigen::VectorXd times;
+
+                /**
+                 * @brief The weight of each state column of the solution at each query time, one column per query time.
+                 *
+                 */
+                Eigen::SparseMatrix<double> state_weights;
+
+                /**
+                 * @brief The weight of each input column of the solution at each query time, one column per query time.
+                 *
+                 */
+                Eigen::SparseMatrix<double> input_weights;
+
+                /**
+                 * @brief The highest time derivative of the state and input to evaluate along with their values.
+                 *
+                 */
+                int derivative_order = 0;
+
+                /**
+                 * @brief The weights of the k-th time derivative of the state at each query time, for k from 1 to derivative_order.
+                 *
+                 */
+                std::vector<Eigen::SparseMatrix<double>> state_derivative_weights;
+
+                /**
+                 * @brief The weights of the k-th time derivative of the input at each query time, for k from 1 to derivative_order.
+                 *
+                 */
+                std::vector<Eigen::SparseMatrix<double>> input_derivative_weights;
+
+                /**
+                 * @brief The version of the solution layout the weights were prepared for, 0 if they are not prepared.
+                 *
+                 */
+                size_t layout_version = 0;
+            };
+
+            /**
+             * @brief Struct for storing the buffers of solution queries. Queries which use a prepared workspace and write into
+             * preallocated results do not allocate, so that they can run in real-time loops.
+             *
+             */
+            struct query_workspace_t
+            {
+                /**
+                 * @brief The highest time derivative the workspace is prepared for.
+                 *
+                 */
+                int derivative_order = 0;
+
+                /**
+                 * @brief The interpolation weights of the state polynomial of the current query, one column per derivative order.
+                 *
+                 */
+                Eigen::MatrixXd state_weights;
+
+                /**
+                 * @brief The interpolation weights of the input polynomial of the current query, one column per derivative order.
+                 *
+                 */
+                Eigen::MatrixXd input_weights;
+            };
+
             /**
              * @brief Class for storing and retrieving solutions.
              *
@@ -205,6 +298,111 @@ namespace galileo
                  */
                 bool GetSolution(const Eigen::VectorXd &query_times, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result, AccessSolutionError &sol_error) const;
 
+                /**
+                 * @brief Get the solution and its time derivatives at a set of query times. The derivatives are those of the
+                 * interpolating polynomials, computed with their differentiation matrices in the same pass as the values.
+                 *
+                 * @param query_times A vector of times at which to query the solution.
+                 * @param derivative_order The highest time derivative to evaluate.
+                 * @param state_results The k-th time derivative of the state at each query time, for k from 0 to derivative_order.
+                 * @param input_results The k-th time derivative of the input at each query time, for k from 0 to derivative_order.
+                 * @param sol_error An error code that is set if this fails to get a solution.
+                 *
+                 * @return bool True if the solution exists at the query times.
+                 */
+                bool GetSolution(const Eigen::VectorXd &query_times, int derivative_order, std::vector<Eigen::MatrixXd> &state_results, std::vector<Eigen::MatrixXd> &input_results, AccessSolutionError &sol_error) const;
+
+                /**
+                 * @brief Prepare a workspace for the polynomials of the current solution. The workspace stays valid for later
+                 * solutions unless their polynomials have a higher degree.
+                 *
+                 * @param workspace The workspace to prepare.
+                 * @param derivative_order The highest time derivative to evaluate with the workspace.
+                 */
+                void PrepareWorkspace(query_workspace_t &workspace, int derivative_order = 0) const;
+
+                /**
+                 * @brief Get the solution and its time derivatives at a set of query times without allocating. The results must
+                 * have a column per query time, and the derivatives one matrix of that size per derivative order from 1.
+                 *
+                 * @param query_times A vector of times at which to query the solution.
+                 * @param workspace A workspace prepared for at least as many derivatives as requested.
+                 * @param state_result The state result at each query time.
+                 * @param input_result The input result at each query time.
+                 * @param state_derivatives The k-th time derivative of the state at each query time, for k from 1.
+                 * @param input_derivatives The k-th time derivative of the input at each query time, for k from 1.
+                 * @param sol_error An error code that is set if this fails to get a solution.
+                 *
+                 * @return bool True if the solution exists at the query times.
+                 */
+                bool GetSolution(const Eigen::Ref<const Eigen::VectorXd> &query_times, query_workspace_t &workspace,
+                                 Eigen::Ref<Eigen::MatrixXd> state_result, Eigen::Ref<Eigen::MatrixXd> input_result,
+                                 std::vector<Eigen::MatrixXd> &state_derivatives, std::vector<Eigen::MatrixXd> &input_derivatives,
+                                 AccessSolutionError &sol_error) const;
+
+                /**
+                 * @brief Get the solution at a set of query times without allocating.
+                 *
+                 * @param query_times A vector of times at which to query the solution.
+                 * @param workspace A prepared workspace.
+                 * @param state_result The state result at each query time.
+                 * @param input_result The input result at each query time.
+                 *
+                 * @return bool True if the solution exists at the query times.
+                 */
+                bool GetSolution(const Eigen::Ref<const Eigen::VectorXd> &query_times, query_workspace_t &workspace,
+                                 Eigen::Ref<Eigen::MatrixXd> state_result, Eigen::Ref<Eigen::MatrixXd> input_result) const
+                {
+                    AccessSolutionError sol_error;
+                    std::vector<Eigen::MatrixXd> no_derivatives;
+                    return GetSolution(query_times, workspace, state_result, input_result, no_derivatives, no_derivatives, sol_error);
+                }
+
+                /**
+                 * @brief Prepare the interpolation weights of a query for the layout of the current solution.
+                 *
+                 * @param query The query to prepare. Query times outside of the solution get zero weights.
+                 */
+                void PrepareQuery(prepared_query_t &query) const;
+
+                /**
+                 * @brief Get the solution at the times of a prepared query. The query is prepared again if the layout of the
+                 * solution changed since it was prepared, which happens when the knots, degrees, or schemes of the segments change.
+                 *
+                 * @param query The prepared query.
+                 * @param state_result The state result at each query time.
+                 * @param input_result The input result at each query time.
+                 *
+                 * @return bool True if the solution exists.
+                 */
+                bool GetSolution(prepared_query_t &query, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result) const;
+
+                /**
+                 * @brief Get the solution and its time derivatives up to the derivative order of a prepared query.
+                 *
+                 * @param query The prepared query.
+                 * @param state_result The state result at each query time.
+                 * @param input_result The input result at each query time.
+                 * @param state_derivatives The k-th time derivative of the state at each query time, for k from 1 to the derivative order.
+                 * @param input_derivatives The k-th time derivative of the input at each query time, for k from 1 to the derivative order.
+                 *
+                 * @return bool True if the solution exists.
+                 */
+                bool GetSolution(prepared_query_t &query, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result,
+                                 std::vector<Eigen::MatrixXd> &state_derivatives, std::vector<Eigen::MatrixXd> &input_derivatives) const;
+
+                /**
+                 * @brief Export the solution as piecewise polynomials in monomial form, one interval per knot, for consumers which
+                 * evaluate it with Horner's method. The polynomials are in seconds since the start of their knot. Unlike GetSolution,
+                 * a time shared by two segments is evaluated on the later one.
+                 *
+                 * @param state_monomial [out] The state polynomials.
+                 * @param input_monomial [out] The input polynomials.
+                 *
+                 * @return bool True if the solution exists.
+                 */
+                bool ExportMonomial(piecewise_monomial_t &state_monomial, piecewise_monomial_t &input_monomial) const;
+
                 /**
                  * @brief Update the constraints with new constraint data segments.
                  *
@@ -243,18 +441,138 @@ namespace galileo
                  */
                 bool isSolutionSet() const { return !solution_segments_.empty(); }
 
+                /**
+                 * @brief Set the execution policy of the maps which evaluate the constraints.
+                 *
+                 * @param policy The map policy
+                 */
+                void setMapPolicy(const MapPolicy &policy) { map_policy_ = policy; }
+
             private:
+                /**
+                 * @brief Find the segment which contains a query time, searching from a given segment onward.
+                 *
+                 * @param t The query time
+                 * @param first_segment The first segment to search
+                 * @return size_t The index of the segment, or the number of segments if no segment contains t
+                 */
+                size_t findSegment(double t, size_t first_segment) const;
+
+                /**
+                 * @brief Find the knot of a segment whose interval contains a query time.
+                 *
+                 * @param knot_times The start time of each knot of the segment
+                 * @param t The query time
+                 * @return size_t The index of the knot
+                 */
+                static size_t findKnot(const std::vector<double> &knot_times, double t);
+
+                /**
+                 * @brief Locate a query time in the solution, and compute the interpolation weights of the columns of its knot
+                 * up to the derivative order of the workspace. The weights of a polynomial with d + 1 roots are written to the
+                 * first d + 1 rows of the weights of the workspace.
+                 *
+                 * @param t The query time
+                 * @param segment [in/out] The first segment to search, and the segment which contains t
+                 * @param state_column [out] The first column of the knot in the state solution of the segment
+                 * @param input_column [out] The first column of the knot in the input solution of the segment
+                 * @param workspace [in/out] A prepared workspace, which receives the weights
+                 * @return bool True if a segment contains t
+                 */
+                bool locateQuery(double t, size_t &segment, Eigen::Index &state_column, Eigen::Index &input_column, query_workspace_t &workspace) const;
+
+                /**
+                 * @brief Convert the state or input solution of every knot to monomial form.
+                 *
+                 * @param input True to convert the input solution, false for the state solution
+                 * @param monomial [out] The piecewise polynomial
+                 */
+                void exportMonomial(bool input, piecewise_monomial_t &monomial) const;
+
                 /**
                  * @brief The solution segments.
                  *
                  */
                 std::vector<solution_segment_data_t> solution_segments_;
 
+                /**
+                 * @brief The end time of each solution segment, for the binary search of the segment of a query.
+                 *
+                 */
+                std::vector<double> segment_end_times_;
+
+                /**
+                 * @brief The start time of each knot of the state polynomial of each solution segment.
+                 *
+                 */
+                std::vector<std::vector<double>> state_knot_times_;
+
+                /**
+                 * @brief The start time of each knot of the input polynomial of each solution segment.
+                 *
+                 */
+                std::vector<std::vector<double>> input_knot_times_;
+
+                /**
+                 * @brief The state solutions of all segments, side by side.
+                 *
+                 */
+                Eigen::MatrixXd solx_;
+
+                /**
+                 * @brief The input solutions of all segments, side by side.
+                 *
+                 */
+                Eigen::MatrixXd solu_;
+
+                /**
+                 * @brief The first column of each segment in solx_.
+                 *
+                 */
+                std::vector<Eigen::Index> state_column_offsets_;
+
+                /**
+                 * @brief The first column of each segment in solu_.
+                 *
+                 */
+                std::vector<Eigen::Index> input_column_offsets_;
+
+                /**
+                 * @brief The largest number of roots of the state polynomials of the segments.
+                 *
+                 */
+                Eigen::Index max_state_nodes_ = 0;
+
+                /**
+                 * @brief The largest number of roots of the input polynomials of the segments.
+                 *
+                 */
+                Eigen::Index max_input_nodes_ = 0;
+
+                /**
+                 * @brief The times of the segments and knots relative to the start of the solution, and the degrees and roots of
+                 * the polynomials of the segments. Prepared queries stay valid while it does not change.
+                 *
+                 */
+                std::vector<double> layout_;
+
+                /**
+                 * @brief Incremented each time the layout of the solution changes.
+                 *
+                 */
+                size_t layout_version_ = 0;
+
                 /**
                  * @brief The constraint data segments.
                  *
                  */
                 std::vector<std::vector<galileo::opt::ConstraintData>> constraint_data_segments_;
+
+                /**
+                 * @brief The execution policy of the constraint maps.
+                 *
+                 */
+                MapPolicy map_policy_;
             };
         }
     }
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "galileo/opt/Solution.h"
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace galileo
+{
+    namespace opt
+    {
+        namespace solution
+        {
+            /**
+             * @brief A binary log of solutions, one record per solve. A record holds the times, solution coefficients, degrees and
+             * collocation schemes of every segment, and the metadata of its constraints, in host byte order with every field 8 bytes
+             * wide. The log is memory mapped for replay: opening it only walks the record headers, and reading a solution copies
+             * the coefficients straight out of the mapping.
+             *
+             */
+            class SolutionLog
+            {
+            public:
+                /**
+                 * @brief Identifies a solution record.
+                 *
+                 */
+                static const uint32_t magic = 0x4C4F5347;
+
+                /**
+                 * @brief Version of the record layout.
+                 *
+                 */
+                static const uint32_t version = 1;
+
+                /**
+                 * @brief The highest polynomial degree read from a log, the highest casadi has collocation points for.
+                 *
+                 */
+                static const int64_t max_degree = 9;
+
+                /**
+                 * @brief Construct a new Solution Log object, with no log open.
+                 *
+                 */
+                SolutionLog() {}
+
+                /**
+                 * @brief Destroy the Solution Log object, unmapping its log.
+                 *
+                 */
+                ~SolutionLog() { Close(); }
+
+                SolutionLog(const SolutionLog &) = delete;
+                SolutionLog &operator=(const SolutionLog &) = delete;
+
+                /**
+                 * @brief Append a solution to the end of a log, creating the log if it does not exist.
+                 *
+                 * @param file_name The log file
+                 * @param solution_segments The solution segments
+                 * @param constraint_data_segments The constraint data of each segment, of which only the metadata is logged
+                 * @return bool True if the record was written
+                 */
+                static bool AppendSolution(const std::string &file_name, const std::vector<solution_segment_data_t> &solution_segments,
+                                           const std::vector<std::vector<ConstraintData>> &constraint_data_segments = {});
+
+                /**
+                 * @brief Append a solution to a log which is kept open, so a log written every solve is not reopened each time. The
+                 * record is written at once and flushed.
+                 *
+                 * @param file The log, opened in binary append mode
+                 * @param solution_segments The solution segments
+                 * @param constraint_data_segments The constraint data of each segment, of which only the metadata is logged
+                 * @return bool True if the record was written
+                 */
+                static bool AppendSolution(std::ostream &file, const std::vector<solution_segment_data_t> &solution_segments,
+                                           const std::vector<std::vector<ConstraintData>> &constraint_data_segments = {});
+
+                /**
+                 * @brief Map a log and index its records. A truncated record at the end of the log, left by an interrupted write, is ignored.
+                 *
+                 * @param file_name The log file
+                 * @return bool True if the log was mapped
+                 */
+                bool Open(const std::string &file_name);
+
+                /**
+                 * @brief Unmap the log.
+                 *
+                 */
+                void Close();
+
+                /**
+                 * @brief Get the number of solutions in the log.
+                 *
+                 * @return size_t The number of solutions
+                 */
+                size_t NumSolutions() const { return record_offsets_.size(); }
+
+                /**
+                 * @brief Read a solution from the log.
+                 *
+                 * @param index The index of the solution
+                 * @param solution_segments [out] The solution segments
+                 * @param constraint_metadata [out] The metadata of the constraints of each segment
+                 * @return bool True if the record is valid
+                 */
+                bool ReadSolution(size_t index, std::vector<solution_segment_data_t> &solution_segments,
+                                  std::vector<std::vector<constraint_metadata_t>> &constraint_metadata);
+
+                /**
+                 * @brief Read a solution from the log into a solution interface.
+                 *
+                 * @param index The index of the solution
+                 * @param solution The solution interface to update
+                 * @return bool True if the record is valid
+                 */
+                bool LoadSolution(size_t index, Solution &solution);
+
+            private:
+                /**
+                 * @brief Struct for reading the fields of a record in order, with bounds checks.
+                 *
+                 */
+                struct cursor_t
+                {
+                    /**
+                     * @brief The start of the record.
+                     *
+                     */
+                    const uint8_t *data;
+
+                    /**
+                     * @brief The size of the record in bytes.
+                     *
+                     */
+                    size_t size;
+
+                    /**
+                     * @brief The offset of the next field.
+                     *
+                     */
+                    size_t offset;
+                };
+
+                /**
+                 * @brief Append an integer field to a record.
+                 *
+                 * @param record The record
+                 * @param value The value
+                 */
+                static void writeInt(std::vector<uint8_t> &record, int64_t value);
+
+                /**
+                 * @brief Append doubles to a record.
+                 *
+                 * @param record The record
+                 * @param values The values
+                 * @param size The number of values
+                 */
+                static void writeDoubles(std::vector<uint8_t> &record, const double *values, size_t size);
+
+                /**
+                 * @brief Append a string to a record, as its length followed by its characters padded to 8 bytes.
+                 *
+                 * @param record The record
+                 * @param value The string
+                 */
+                static void writeString(std::vector<uint8_t> &record, const std::string &value);
+
+                /**
+                 * @brief Read an integer field of a record.
+                 *
+                 * @param cursor The cursor of the record
+                 * @param value [out] The value
+                 * @return bool True if the field is within the record
+                 */
+                static bool readInt(cursor_t &cursor, int64_t &value);
+
+                /**
+                 * @brief Read the number of elements which follow, each taking at least min_fields fields of the record.
+                 *
+                 * @param cursor The cursor of the record
+                 * @param count [out] The number of elements
+                 * @param min_fields The least number of 8 byte fields an element takes
+                 * @return bool True if the count is not negative and that many elements can fit in the rest of the record
+                 */
+                static bool readCount(cursor_t &cursor, int64_t &count, size_t min_fields);
+
+                /**
+                 * @brief Check that a block of doubles fits in the rest of a record, before it is allocated.
+                 *
+                 * @param cursor The cursor of the record
+                 * @param rows The number of rows of the block
+                 * @param cols The number of columns of the block
+                 * @return bool True if the sizes are not negative and the block fits
+                 */
+                static bool fitsDoubles(const cursor_t &cursor, int64_t rows, int64_t cols);
+
+                /**
+                 * @brief Read doubles of a record.
+                 *
+                 * @param cursor The cursor of the record
+                 * @param values [out] The values
+                 * @param size The number of values
+                 * @return bool True if the values are within the record
+                 */
+                static bool readDoubles(cursor_t &cursor, double *values, size_t size);
+
+                /**
+                 * @brief Read a string of a record.
+                 *
+                 * @param cursor The cursor of the record
+                 * @param value [out] The string
+                 * @return bool True if the string is within the record
+                 */
+                static bool readString(cursor_t &cursor, std::string &value);
+
+                /**
+                 * @brief Read a polynomial of a record, reusing the polynomials already built with the same degree and scheme. Only the
+                 * radau and legendre schemes up to max_degree are accepted.
+                 *
+                 * @param cursor The cursor of the record
+                 * @param poly [out] The polynomial
+                 * @return bool True if the polynomial is within the record
+                 */
+                bool readPolynomial(cursor_t &cursor, LagrangePolynomial &poly);
+
+                /**
+                 * @brief The mapped log.
+                 *
+                 */
+                const uint8_t *data_ = nullptr;
+
+                /**
+                 * @brief The size of the mapped log in bytes.
+                 *
+                 */
+                size_t size_ = 0;
+
+                /**
+                 * @brief The offset of each record in the log.
+                 *
+                 */
+                std::vector<size_t> record_offsets_;
+
+                /**
+                 * @brief The polynomials read so far, by degree and scheme, since building one computes its coefficients.
+                 *
+                 */
+                std::map<std::pair<int64_t, std::string>, LagrangePolynomial> polynomials_;
+            };
+        }
+    }
+}
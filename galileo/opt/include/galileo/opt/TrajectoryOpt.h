@@ -2,17 +2,165 @@
 
 #include "galileo/opt/Solution.h"
 #include "galileo/opt/Segment.h"
-#include "galileo/opt/PseudospectralSegment.h"
+#include "galileo/opt/SegmentFactory.h"
 #include "galileo/opt/PhaseSequence.h"
+#include "galileo/opt/IterationTelemetry.h"
+#include "galileo/opt/MeshRefinement.h"
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
 
 namespace galileo
 {
     namespace opt
     {
 
+        /**
+         * @brief Statistics of a single solve, along with the cost of building the NLP it solved.
+         * Times are wall times in seconds.
+         *
+         */
+        struct SolveStats
+        {
+            /**
+             * @brief Time spent building the expression graph of each phase, in the order of the phases in the horizon.
+             *
+             */
+            std::vector<double> phase_build_times;
+
+            /**
+             * @brief Total time spent building and stitching the expression graph.
+             *
+             */
+            double graph_build_time = 0.0;
+
+            /**
+             * @brief Time spent constructing the nonlinear solver.
+             *
+             */
+            double solver_construction_time = 0.0;
+
+            /**
+             * @brief Number of segments which reused the per-knot functions of the segment function cache when the NLP was built.
+             *
+             */
+            size_t segment_function_cache_hits = 0;
+
+            /**
+             * @brief Name of the shared object generated and compiled when the NLP was built, empty if code generation is disabled
+             * or the shared object was loaded from the cache.
+             *
+             */
+            std::string compiled_library;
+
+            /**
+             * @brief Time spent evaluating the objective.
+             *
+             */
+            double t_nlp_f = 0.0;
+
+            /**
+             * @brief Time spent evaluating the constraints.
+             *
+             */
+            double t_nlp_g = 0.0;
+
+            /**
+             * @brief Time spent evaluating the gradient of the objective.
+             *
+             */
+            double t_nlp_grad_f = 0.0;
+
+            /**
+             * @brief Time spent evaluating the Jacobian of the constraints.
+             *
+             */
+            double t_nlp_jac_g = 0.0;
+
+            /**
+             * @brief Time spent evaluating the Hessian of the Lagrangian.
+             *
+             */
+            double t_nlp_hess_l = 0.0;
+
+            /**
+             * @brief Total time of the solve.
+             *
+             */
+            double t_total = 0.0;
+
+            /**
+             * @brief Time of the solve spent outside of the NLP functions.
+             *
+             */
+            double t_solver = 0.0;
+
+            /**
+             * @brief Number of iterations of the solver.
+             *
+             */
+            int iterations = 0;
+
+            /**
+             * @brief Number of iterations saved by warm starting, compared to the last cold solve of the same NLP. Zero if the solve
+             * was not warm started, or if the NLP has not been solved cold yet.
+             *
+             */
+            int warm_start_iterations_saved = 0;
+
+            /**
+             * @brief Return status reported by the solver.
+             *
+             */
+            std::string return_status;
+
+            /**
+             * @brief True if the solver reported success.
+             *
+             */
+            bool success = false;
+
+            /**
+             * @brief Largest violation of the constraint bounds at the solution. In real-time iteration mode, this is the violation of the linearized constraints.
+             *
+             */
+            double constraint_violation = 0.0;
+
+            /**
+             * @brief Time spent in the preparation phase of a real-time iteration. Zero otherwise.
+             *
+             */
+            double t_preparation = 0.0;
+
+            /**
+             * @brief Time spent in the feedback phase of a real-time iteration. Zero otherwise.
+             *
+             */
+            double t_feedback = 0.0;
+        };
+
         /**
          * @brief Callback function called at each iteration, used for debugging and plotting.
+         * Each call summarizes the iterate into an IterationRecord and pushes it to a ring buffer which other threads can read.
+         * The callback evaluates on raw buffers, so it does not allocate while the solver runs.
          *
          */
         class IterationCallback : public casadi::Callback
@@ -57,10 +205,23 @@ namespace galileo
             /**
              * @brief Construct a new Iteration Callback object.
              *
+             * @param name Name of the callback function
+             * @param nx Number of decision variables
+             * @param np Number of parameters
+             * @param lbg Lower bounds of the constraints, used to compute the infeasibility
+             * @param ubg Upper bounds of the constraints, used to compute the infeasibility
+             * @param telemetry_ The ring buffer the iteration records are pushed to
+             * @param step_ The number of solver iterations between calls
              */
-            IterationCallback()
+            IterationCallback(const std::string &name, casadi_int nx, casadi_int np, const std::vector<double> &lbg, const std::vector<double> &ubg,
+                              std::shared_ptr<IterationRingBuffer> telemetry_, casadi_int step_ = 1)
+                : x_(casadi::Sparsity::dense(nx, 1)), f_(casadi::Sparsity::dense(1, 1)), g_(casadi::Sparsity::dense(lbg.size(), 1)),
+                  lam_x_(casadi::Sparsity::dense(nx, 1)), lam_g_(casadi::Sparsity::dense(lbg.size(), 1)), lam_p_(casadi::Sparsity::dense(np, 1)),
+                  lbg_(lbg), ubg_(ubg), telemetry(telemetry_), step(step_)
             {
-                construct("f");
+                assert(lbg.size() == ubg.size() && "lbg and ubg must have the same size");
+                assert(telemetry != nullptr && "The callback needs a ring buffer to write to");
+                construct(name);
             }
 
             /**
@@ -70,23 +231,18 @@ namespace galileo
             ~IterationCallback() override {}
 
             /**
-             * @brief Set the sparsity of the decision variables, objective function, constraints, Lagrange multipliers for the decision variables, constraints, and parameters.
+             * @brief Reset the iteration count, and take the constraint bounds of the next solve, which change as the horizon advances.
+             * Called before each solve.
              *
-             * @param x Sparsity of the decision variables
-             * @param f Sparsity of the objective function
-             * @param g Sparsity of the constraints
-             * @param lam_x Sparsity of the Lagrange multipliers for the decision variables
-             * @param lam_g Sparsity of the Lagrange multipliers for the constraints
-             * @param lam_p Sparsity of the Lagrange multipliers for the parameters
+             * @param lbg Lower bounds of the constraints
+             * @param ubg Upper bounds of the constraints
              */
-            void set_sparsity(casadi::Sparsity x, casadi::Sparsity f, casadi::Sparsity g, casadi::Sparsity lam_x, casadi::Sparsity lam_g, casadi::Sparsity lam_p)
+            void beginSolve(const std::vector<double> &lbg, const std::vector<double> &ubg)
             {
-                this->x_ = x;
-                this->f_ = f;
-                this->g_ = g;
-                this->lam_x_ = lam_x;
-                this->lam_g_ = lam_g;
-                this->lam_p_ = lam_p;
+                assert(lbg.size() == lbg_.size() && ubg.size() == ubg_.size() && "The bounds must match the constraints of the solver");
+                lbg_ = lbg;
+                ubg_ = ubg;
+                calls = 0;
             }
 
             /**
@@ -112,7 +268,61 @@ namespace galileo
             casadi_int get_n_out() override { return 1; }
 
             /**
-             * @brief Evaluate the callback function.
+             * @brief The callback is evaluated on raw buffers.
+             *
+             */
+            bool has_eval_buffer() const override { return true; }
+
+            /**
+             * @brief Evaluate the callback function on raw buffers.
+             *
+             * @param arg Pointers to the inputs: x, f, g, lam_x, lam_g, lam_p
+             * @param sizes_arg Sizes of the inputs
+             * @param res Pointers to the outputs
+             * @param sizes_res Sizes of the outputs
+             * @return int 0 on success
+             */
+            int eval_buffer(const double **arg, const std::vector<casadi_int> &sizes_arg,
+                            double **res, const std::vector<casadi_int> &sizes_res) const override
+            {
+                IterationRecord record;
+                record.iteration = calls * step;
+                ++calls;
+
+                const double *x = arg[0];
+                if (x != nullptr && sizes_arg[0] > 0)
+                {
+                    double sum_sq = 0.0;
+                    record.x_min = x[0];
+                    record.x_max = x[0];
+                    for (casadi_int i = 0; i < sizes_arg[0]; ++i)
+                    {
+                        sum_sq += x[i] * x[i];
+                        record.x_min = std::min(record.x_min, x[i]);
+                        record.x_max = std::max(record.x_max, x[i]);
+                    }
+                    record.x_norm = std::sqrt(sum_sq);
+                }
+                if (arg[1] != nullptr)
+                    record.objective = arg[1][0];
+                const double *g = arg[2];
+                if (g != nullptr)
+                {
+                    for (casadi_int i = 0; i < sizes_arg[2]; ++i)
+                    {
+                        record.infeasibility = std::max(record.infeasibility, std::max(lbg_[i] - g[i], g[i] - ubg_[i]));
+                    }
+                }
+                telemetry->push(record);
+
+                /*Returning nonzero would stop the solver*/
+                if (res[0] != nullptr)
+                    res[0][0] = 0;
+                return 0;
+            }
+
+            /**
+             * @brief Evaluate the callback function. Only used if the buffer evaluation is not available.
              *
              * @param arg The arguments to the callback function
              * @return std::vector<casadi::DM> The result of the callback function
@@ -145,6 +355,37 @@ namespace galileo
                 else
                     throw std::runtime_error("Invalid input index");
             }
+
+        private:
+            /**
+             * @brief Lower bounds of the constraints.
+             *
+             */
+            std::vector<double> lbg_;
+
+            /**
+             * @brief Upper bounds of the constraints.
+             *
+             */
+            std::vector<double> ubg_;
+
+            /**
+             * @brief The ring buffer the iteration records are pushed to.
+             *
+             */
+            std::shared_ptr<IterationRingBuffer> telemetry;
+
+            /**
+             * @brief The number of solver iterations between calls.
+             *
+             */
+            casadi_int step;
+
+            /**
+             * @brief Number of calls in the current solve.
+             *
+             */
+            mutable uint64_t calls = 0;
         };
 
         /**
@@ -164,12 +405,17 @@ namespace galileo
              * @param builders_ Constraint builders used to build the constraints
              * @param decision_builder_ Decision builder used to build the decision data
              * @param opts_ Options to pass to the solver
-             * @param nonlinear_solver_name_ Nonlinear solver name to use for the optimization
+             * @param nonlinear_solver_name_ Nonlinear solver name to use for the optimization. "fatrop" solves the NLP with
+             * Riccati based linear algebra, whose cost grows linearly with the number of knots. It always orders the
+             * decision variables and constraints stage-wise, and is given the dimensions of every stage
              */
             TrajectoryOpt(std::shared_ptr<ProblemData> problem_, std::shared_ptr<PhaseSequence<MODE_T>> phase_sequence, std::vector<std::shared_ptr<ConstraintBuilder<ProblemData>>> builders_, std::shared_ptr<DecisionDataBuilder<ProblemData>> decision_builder_, casadi::Dict opts_, std::string nonlinear_solver_name_ = "ipopt");
 
             /**
-             * @brief Initialize the finite elements.
+             * @brief Initialize the finite elements and create the solver. The horizon covers all the phases of the sequence,
+             * and keeps this duration as it advances.
+             * The initial state, the problem parameters, and the knot length of each segment are parameters of the NLP, so the
+             * solver does not need to be recreated when they change.
              *
              * @param d The degree of the finite element polynomials
              * @param X0 The initial state to deviate from
@@ -177,249 +423,1311 @@ namespace galileo
             void initFiniteElements(int d, casadi::DM X0);
 
             /**
-             * @brief Advance the finite elements.
-             * 
-             * @param time_advance The time to advance the finite elements
-             * @param X0 The new initial state
-             * @param phase The next phase (we check if we actually need the next phase based on the time_advance)
+             * @brief Set the initial state used by the next solve.
+             *
+             * @param X0 The initial state
              */
-            void advanceFiniteElements(double time_advance, casadi::DM X0, typename PhaseSequence<MODE_T>::Phase phase);
+            void setInitialState(casadi::DM X0);
 
             /**
-             * @brief Optimize and return the solution.
+             * @brief Set the problem parameters used by the next solve.
              *
-             * @return SXVector The solution
+             * @param params The problem parameters (np x 1)
              */
-            casadi::MXVector optimize();
+            void setParameters(casadi::DM params);
 
             /**
-             * @brief Collect the solution segments for each phase
+             * @brief Enable or disable primal-dual warm starting. When enabled, the multipliers of the last solve are kept,
+             * shifted with the horizon, and passed to the solver together with the primal solution. For ipopt, the solves which
+             * have multipliers to start from use a second solver, created the first time it is needed, whose options add the warm
+             * start options unless they are already set. The first solve is a cold solve with the options as given.
              *
-             * @return std::vector<solution::solution_segment_data_t> The solution segments
+             * @param enable True to enable warm starting
              */
-            std::vector<solution::solution_segment_data_t> getSolutionSegments();
+            void setWarmStart(bool enable) { warm_start = enable; }
 
             /**
-             * @brief Get the constraint data segments for each phase.
+             * @brief Get the number of iterations saved by warm starting the last solve, compared to the last cold solve.
              *
-             * @return std::vector<std::vector<ConstraintData>> The constraint data segments
+             * @return int The number of iterations saved
              */
-            std::vector<std::vector<ConstraintData>> getConstraintDataSegments() const;
+            int getWarmStartIterationsSaved() const { return solve_stats.warm_start_iterations_saved; }
 
-        private:
             /**
-             * @brief A Trajectory is made up of segments of finite elements.
+             * @brief Set the number of threads used to build the segments of the phases concurrently. The phases share
+             * expressions, so they are only built concurrently if CasADi is built with thread-safe symbolics
+             * (CASADI_WITH_THREADSAFE_SYMBOLICS). Otherwise they are built sequentially, and a warning is printed once if more
+             * than one thread is requested.
              *
+             * @param num_threads The number of threads. 1 builds the segments sequentially
              */
-            std::vector<std::shared_ptr<Segment>> trajectory;
+            void setConstructionThreads(size_t num_threads)
+            {
+                num_construction_threads = std::max<size_t>(num_threads, 1);
+#ifndef CASADI_WITH_THREADSAFE_SYMBOLICS
+                static std::once_flag warned;
+                if (num_construction_threads > 1)
+                {
+                    std::call_once(warned, []()
+                                   { std::cerr << "Warning: CasADi is not built with thread-safe symbolics, so the phases are built on a single thread" << std::endl; });
+                }
+#endif
+            }
 
             /**
-             * @brief The ranges of the segment times.
+             * @brief Order the decision variables and constraints knot by knot instead of by kind, so sparse linear solvers
+             * see a block banded KKT system. Takes effect the next time the finite elements are initialized.
              *
+             * @param enable True to order stage-wise
              */
-            std::vector<tuple_size_t> segment_times_ranges;
+            void setStageWiseOrdering(bool enable) { stage_wise_ordering = enable; }
 
             /**
-             * @brief The solution vector.
+             * @brief Evaluate the collocation equations, constraints, and cost of each knot segment with a single function, with
+             * common subexpressions eliminated across them. Kinematics shared by several constraints are then evaluated once per
+             * collocation point. Takes effect the next time the finite elements are initialized.
              *
+             * @param enable True to fuse the per-knot functions
              */
-            casadi::MXVector sol;
+            void setFusedKnotKernel(bool enable) { fused_knot_kernel = enable; }
 
             /**
-             * @brief Problem data containing constraints problem data.
+             * @brief Evaluate the cost of each segment with a map over its knots followed by a sum, instead of a fold, so the
+             * knot costs and their derivatives are evaluated in parallel by the map policy. Takes effect the next time the finite
+             * elements are initialized.
              *
+             * @param enable True to map and reduce the cost
              */
-            std::shared_ptr<ProblemData> problem;
+            void setMapReduceCost(bool enable) { map_reduce_cost = enable; }
 
             /**
-             * @brief Problem data containing the objective function and dynamics.
+             * @brief Set the execution policy of the maps of the segments. Takes effect the next time the finite elements are initialized.
              *
+             * @param policy The map policy
              */
-            std::shared_ptr<GeneralProblemData> gp_data;
+            void setMapPolicy(const MapPolicy &policy) { map_policy = policy; }
 
             /**
-             * @brief Constraint builders used to build the constraints.
+             * @brief Get the execution policy of the maps of the segments.
              *
+             * @return const MapPolicy& The map policy
              */
-            std::vector<std::shared_ptr<ConstraintBuilder<ProblemData>>> builders;
+            const MapPolicy &getMapPolicy() const { return map_policy; }
 
             /**
-             * @brief Decision builder used to build the decision data.
+             * @brief Share the per-knot functions between segments whose phases have the same dynamics, cost, constraints and
+             * discretization, such as the repeated phases of a periodic gait. Only the first of them builds the functions.
+             * Takes effect the next time the finite elements are initialized.
              *
+             * @param enable True to cache the per-knot functions of the segments
              */
-            std::shared_ptr<DecisionDataBuilder<ProblemData>> decision_builder;
+            void setSegmentFunctionCache(bool enable)
+            {
+                segment_function_cache_enabled = enable;
+                if (!enable)
+                    segment_function_cache.clear();
+            }
 
             /**
-             * @brief Constraint datas for each phase.
+             * @brief Set the number of NLPs kept for the horizon to return to. An NLP is identified by the per-knot functions and
+             * the number of knots of each of its segments, so the horizon of a periodic gait cycles through a few of them, and
+             * advancing into one which is kept only updates the parameters, the bounds, and the initial guess. The least recently
+             * used NLP is dropped first. NLPs are only kept if the segment function cache is enabled.
              *
+             * @param capacity The number of NLPs kept. 0 rebuilds the NLP every time the phases in the horizon change
              */
-            std::vector<std::vector<ConstraintData>> constraint_datas_for_phase;
+            void setNLPCacheCapacity(size_t capacity)
+            {
+                nlp_cache_capacity = capacity;
+                nlp_cache.clear();
+                current_nlp_key = 0;
+            }
 
             /**
-             * @brief Casadi solver options.
+             * @brief Check if the nonlinear solver exploits the multi-stage structure of the problem.
              *
+             * @return true If the decision variables and constraints must be ordered stage-wise
              */
-            casadi::Dict opts;
+            bool isStructureExploitingSolver() const { return nonlinear_solver_name == "fatrop"; }
 
             /**
-             * @brief Nonlinear solver to use.
+             * @brief Record a summary of every step-th solver iteration into a ring buffer, which can be read from another thread while the solver runs.
+             * Takes effect the next time the finite elements are initialized.
              *
+             * @param capacity The number of iteration records kept
+             * @param step The number of solver iterations between records
              */
-            std::string nonlinear_solver_name;
+            void enableTelemetry(size_t capacity = 1024, casadi_int step = 1)
+            {
+                telemetry = std::make_shared<IterationRingBuffer>(capacity);
+                telemetry_step = step;
+            }
 
             /**
-             * @brief Nonlinear function solver.
+             * @brief Get the iteration telemetry ring buffer.
              *
+             * @return std::shared_ptr<const IterationRingBuffer> The ring buffer, or nullptr if telemetry is not enabled
              */
-            casadi::Function solver;
+            std::shared_ptr<const IterationRingBuffer> getTelemetry() const { return telemetry; }
 
             /**
-             * @brief Slicer to get the states.
+             * @brief Generate C code for the NLP functions, compile it, and solve with the compiled functions.
+             * The shared objects are cached on disk, keyed by a hash of the NLP, the solver, and its options. The knot lengths,
+             * the initial state, and the problem parameters are parameters of the NLP, so a library is compiled once for each
+             * sequence of phases the horizon holds, and advancing the horizon within a phase or over a periodic gait does not
+             * compile again. Takes effect the next time the finite elements are initialized.
              *
+             * @param cache_directory Directory in which the shared objects are cached
+             * @param compiler The C compiler
+             * @param compiler_flags Flags passed to the compiler
              */
-            std::shared_ptr<States> state_indices;
+            void enableCodegen(std::string cache_directory, std::string compiler = "gcc", std::string compiler_flags = "-O3 -march=native")
+            {
+                if (compiler.empty())
+                    throw std::invalid_argument("The compiler for code generation must not be empty");
+                codegen_cache_directory = cache_directory;
+                codegen_compiler = compiler;
+                codegen_compiler_flags = compiler_flags;
+                codegen = true;
+            }
 
             /**
-             * @brief Sequence of phases including dynamics and timing information
+             * @brief Solve with real-time iterations instead of the nonlinear solver. Each solve is a single SQP step from the
+             * last solution, split into a preparation phase, which linearizes the NLP before the new initial state is known,
+             * and a feedback phase, which only corrects the constraints and the objective gradient for the new parameters and
+             * solves one QP. The linearization function and the QP solver are created once for each sequence of phases in the
+             * horizon, and are kept as the horizon advances.
+             * Takes effect the next time the finite elements are initialized.
              *
+             * @param qpsol The CasADi QP solver plugin, e.g. "qpoases" or "osqp"
+             * @param qpsol_opts Options to pass to the QP solver. Iteration limits of the QP solver bound the feedback latency
+             * @param exact_hessian True to use the Hessian of the Lagrangian. Otherwise the Hessian of the objective is used,
+             * which is positive semi-definite for least squares costs
              */
-            std::shared_ptr<PhaseSequence<MODE_T>> sequence;
+            void enableRealTimeIteration(std::string qpsol = "qpoases", casadi::Dict qpsol_opts = casadi::Dict(), bool exact_hessian = false)
+            {
+                rti_qpsol = qpsol;
+                rti_qpsol_opts = qpsol_opts;
+                rti_exact_hessian = exact_hessian;
+                rti = true;
+            }
 
             /**
-             * @brief Range of decision variables per phase.
+             * @brief Preparation phase of a real-time iteration. Linearizes the NLP at the current initial guess, which after
+             * advanceFiniteElements is the shifted last solution, and at the current initial state and parameters.
+             * Called by optimize if the current linearization is stale.
              *
              */
-            std::vector<tuple_size_t> ranges_decision_variables;
+            void prepareRealTimeIteration();
 
             /**
-             * @brief Vector of all decision variables.
+             * @brief Advance the finite elements in a receding horizon fashion, keeping the duration of the horizon fixed.
+             *
+             * Each segment covers the part of its phase inside the horizon, so the knots of the first segment shrink and those
+             * of the last segment grow as the horizon advances. The knot lengths are parameters of the NLP, so within a phase
+             * only the parameters, the bounds, and the initial state change, and the solver is kept.
+             * Phases which end before the horizon starts are dropped, and phases are appended to the phase sequence until it
+             * covers the end of the horizon, one for each call of next_phase. When phases are dropped or appended, the NLP of the
+             * new phases is taken from the NLP cache if the horizon held the same phases before, as it does for a periodic gait,
+             * and is only rebuilt otherwise. Phases far enough before the horizon are dropped from the phase sequence, so it does not grow without bound.
              *
+             * The knots of a segment are not dropped as they are consumed. The segment keeps its number of knots over the shorter
+             * part of its phase left in the horizon, so the structure of the NLP is fixed within a phase, and a segment only
+             * disappears with its phase. The initial guess of the retained segments is the last solution evaluated at the new knot
+             * times, so it is shifted in time, with the final value of the last solution held past its end. The multipliers stay
+             * with their knots.
+             *
+             * @param time_advance The time to advance the finite elements
+             * @param X0 The new initial state
+             * @param next_phase Returns the next phase to append to the phase sequence. Called as many times as needed to cover the horizon
              */
-            casadi::MXVector w;
+            void advanceFiniteElements(double time_advance, casadi::DM X0, std::function<typename PhaseSequence<MODE_T>::Phase()> next_phase);
 
             /**
-             * @brief Vector of all constraint expressions.
+             * @brief Get the time, on the phase sequence time line, at which the current horizon starts.
              *
+             * @return double The start time of the horizon
              */
-            casadi::MXVector g;
+            double getHorizonStartTime() const { return horizon_start_time; }
 
             /**
-             * @brief Vector of all general constraint lower bounds.
+             * @brief Get the duration of the horizon, which is kept fixed as it advances.
              *
+             * @return double The duration of the horizon
              */
-            std::vector<double> lbg;
+            double getHorizonDuration() const { return horizon_duration; }
 
             /**
-             * @brief Vector of all general constraint upper bounds.
+             * @brief Optimize the trajectory. The solution can be collected with getSolutionSegments.
+             * In real-time iteration mode, this runs the feedback phase of a real-time iteration, preparing first if needed.
              *
+             * @return SolveStats The statistics of the solve
              */
-            std::vector<double> ubg;
+            SolveStats optimize();
 
             /**
-             * @brief  Lower bounds associated with the decision variables.
+             * @brief Optimize the trajectory, then refine the mesh of the phases whose discretization error is above the tolerance
+             * and optimize again, until the error is below the tolerance or the iterations run out. A refined phase gets more knots,
+             * or a higher degree if its error is spread over the whole phase. Each re-solve is warm started from an interpolation
+             * of the last solution; the multipliers are not kept, since the constraints change with the mesh.
+             * Only pseudospectral phases are refined. The phase sequence is changed in place, so this must be called before the
+             * horizon is advanced.
              *
+             * @param options The mesh refinement options
+             * @return SolveStats The statistics of the last solve
              */
-            std::vector<double> lbw;
+            SolveStats optimizeWithMeshRefinement(const MeshRefinementOptions &options = MeshRefinementOptions());
 
             /**
-             * @brief Upper bounds associated with the decision variables.
+             * @brief Get the error of each knot segment of each phase, estimated by the last mesh refinement iteration.
+             * Phases which are not refined have no errors.
              *
+             * @return const std::vector<std::vector<double>>& The knot errors of each phase
              */
-            std::vector<double> ubw;
+            const std::vector<std::vector<double>> &getMeshErrors() const { return mesh_errors; }
 
             /**
-             * @brief Initial guess for the decision variables.
+             * @brief Get the statistics of the last solve.
+             *
+             * @return const SolveStats& The statistics of the last solve
              */
-            std::vector<double> w0;
+            const SolveStats &getSolveStats() const { return solve_stats; }
 
             /**
-             * @brief Expression for objective cost.
+             * @brief Collect the solution segments for each phase
              *
+             * @return std::vector<solution::solution_segment_data_t> The solution segments
              */
-            casadi::MX J;
+            std::vector<solution::solution_segment_data_t> getSolutionSegments();
 
             /**
-             * @brief Vector of all times where decision variables are evaluated.
+             * @brief Get the constraint data segments for each phase.
              *
+             * @return std::vector<std::vector<ConstraintData>> The constraint data segments
              */
-            casadi::DM global_times;
+            std::vector<std::vector<ConstraintData>> getConstraintDataSegments() const;
 
+        private:
             /**
-             * @brief Callback function called at each iteration, used for debugging and plotting.
+             * @brief Build the constraint and decision data for a phase, and append its segment to the end of the trajectory.
              *
+             * @param phase_index The index of the phase in the phase sequence
              */
-            IterationCallback callback;
-        };
-
-        template <class ProblemData, class MODE_T>
-        TrajectoryOpt<ProblemData, MODE_T>::TrajectoryOpt(std::shared_ptr<ProblemData> problem_, std::shared_ptr<PhaseSequence<MODE_T>> phase_sequence, std::vector<std::shared_ptr<ConstraintBuilder<ProblemData>>> builders_, std::shared_ptr<DecisionDataBuilder<ProblemData>> decision_builder_, casadi::Dict opts_, std::string nonlinear_solver_name_)
-        {
-            this->problem = problem_;
-            this->gp_data = problem_->gp_data;
-            this->builders = builders_;
-            this->decision_builder = decision_builder_;
-            this->state_indices = problem_->states;
-            this->sequence = phase_sequence;
-            this->opts = opts_;
-            this->nonlinear_solver_name = nonlinear_solver_name_;
-        }
+            void appendSegment(size_t phase_index);
 
-        template <class ProblemData, class MODE_T>
-        void TrajectoryOpt<ProblemData, MODE_T>::initFiniteElements(int d, casadi::DM X0)
-        {
-            assert(X0.size1() == state_indices->nx && X0.size2() == 1 && "Initial state must be a column vector");
-            trajectory.clear();
-            global_times = casadi::DM(0, 0);
-            w.clear();
-            g.clear();
-            lbg.clear();
-            ubg.clear();
-            lbw.clear();
-            ubw.clear();
-            w0.clear();
-            J = 0;
+            /**
+             * @brief Build the constraint and decision data and the segment of a phase into an existing slot of the trajectory.
+             * Different slots can be built concurrently.
+             *
+             * @param phase_index The index of the phase in the phase sequence
+             * @param slot The index in the trajectory to build into
+             */
+            void buildSegment(size_t phase_index, size_t slot);
 
-            casadi::MX prev_final_state = X0;
-            casadi::MX prev_final_state_deviant;
-            casadi::MX curr_initial_state_deviant;
+            /**
+             * @brief Compute the key of the per-knot functions of a segment in the segment function cache. The functions are
+             * identified by their serialization, so phases of the same mode with the same constraints get the same key.
+             *
+             * @param functions The dynamics, cost and constraint functions of the phase
+             * @param discretization Description of the transcription, degree and scheme of the phase
+             * @return std::size_t The key, or 0 if the functions can not be serialized and the segment can not be cached
+             */
+            std::size_t segmentFunctionKey(const std::vector<casadi::Function> &functions, const std::string &discretization) const;
 
-            std::vector<double> equality_back_nx(state_indices->nx, 0.0);
-            std::vector<double> equality_back_ndx(state_indices->ndx, 0.0);
+            /**
+             * @brief Call f(i) for i in [0, n) on up to num_construction_threads threads. Exceptions thrown by f are rethrown.
+             * Runs sequentially unless CasADi is built with thread-safe symbolics, since expressions are shared between phases.
+             *
+             * @param n The number of calls
+             * @param f The function to call
+             */
+            template <class F>
+            void parallelFor(size_t n, F f) const;
 
-            std::vector<ConstraintData> G;
-            std::shared_ptr<DecisionData> Wdata = std::make_shared<DecisionData>();
+            /**
+             * @brief Stitch the segments of the trajectory together into the decision variables, constraints, bounds, and cost of the NLP.
+             * Segments whose expression graph has not been initialized yet are initialized here. The solver is recreated.
+             *
+             */
+            void stitchFiniteElements();
 
-            size_t num_phases = sequence->getNumPhases();
-            std::cout << "Starting initialization" << std::endl;
+            /**
+             * @brief Compute the key of the current NLP in the NLP cache, from the segment function key and the number of knots of each segment.
+             *
+             * @return std::size_t The key, or 0 if a segment is not in the segment function cache and the NLP can not be cached
+             */
+            std::size_t nlpKey() const;
 
-            for (size_t i = 0; i < num_phases; ++i)
-            {
-                G.clear();
-                for (auto builder : builders)
-                {
-                    ConstraintData con_data;
-                    builder->buildConstraint(*problem, i, con_data);
-                    G.push_back(con_data);
-                }
-                decision_builder->buildDecisionData(*problem, i, *Wdata);
+            /**
+             * @brief Keep the current NLP in the NLP cache, dropping the least recently used NLP if the cache is full.
+             *
+             */
+            void storeNLP();
 
-                constraint_datas_for_phase.push_back(G);
-                auto phase = sequence->getPhase(i);
+            /**
+             * @brief Switch to an NLP of the NLP cache, whose segments then take the place of those of the trajectory.
+             * Only their times, bounds, and the initial guess of the segments from new_segments on are updated.
+             *
+             * @param key The key of the NLP
+             * @param new_segments The index of the first segment which was not in the horizon before
+             * @return true If the NLP was in the cache
+             */
+            bool restoreNLP(std::size_t key, size_t new_segments);
 
-                std::shared_ptr<Segment> segment = std::make_shared<PseudospectralSegment>(gp_data, phase.phase_dynamics, phase.phase_cost, state_indices, d, phase.knot_points, phase.time_value / phase.knot_points);
-                segment->initializeSegmentTimeVector(global_times);
-                segment->initializeInputTimeVector(global_times);
-                segment->initializeKnotSegments(X0, prev_final_state);
-                segment->initializeExpressionGraph(G, Wdata);
-                segment->evaluateExpressionGraph(J, w, g);
+            /**
+             * @brief Fit the segments to the horizon. Each segment covers the part of its phase inside the horizon. Updates the
+             * knot lengths, the time vectors, and the bounds of the segments whose expression graph is initialized.
+             *
+             */
+            void updateHorizonTimes();
+
+            /**
+             * @brief Gather the bounds of the segments into lbg, ubg, lbw and ubw, in the layout of the current NLP.
+             *
+             */
+            void fillBounds();
+
+            /**
+             * @brief Create a function of time which evaluates the last solution, holding its first and last values before and after it.
+             *
+             * @return casadi::Function The last solution, (t) -> (x, u), or an empty function if the current segments have not been solved
+             */
+            casadi::Function lastSolutionGuess();
+
+            /**
+             * @brief Set the initial guess of the first segments of the trajectory to a function of time, evaluated at their
+             * current times, and gather the initial guess of all the segments into w0.
+             *
+             * @param guess The initial guess, (t) -> (x, u)
+             * @param num_segments The number of leading segments whose guess is set
+             */
+            void shiftInitialGuess(const casadi::Function &guess, size_t num_segments);
+
+            /**
+             * @brief Get the value of the parameters of the NLP: the initial state, the problem parameters, and the knot length of each segment.
+             *
+             * @return casadi::DM The parameter values
+             */
+            casadi::DM getParameterValues() const { return vertcat(initial_state_value, parameter_values, knot_length_values); }
+
+            /**
+             * @brief Create the nonlinear solver. If code generation is enabled, the NLP functions are loaded from the cached
+             * shared object, which is generated and compiled first if it does not exist.
+             *
+             * @param nlp The NLP
+             * @param solver_opts Options to pass to the solver
+             * @param runtime_opts Options added to solver_opts which do not change the generated NLP functions, so they are left
+             * out of the key of the shared object and solvers differing only in them share it
+             * @return casadi::Function The nonlinear solver
+             */
+            casadi::Function createSolver(const casadi::MXDict &nlp, const casadi::Dict &solver_opts, const casadi::Dict &runtime_opts = casadi::Dict());
+
+            /**
+             * @brief Get the solver of the warm started solves. For ipopt, it is created from the current NLP the first time it is
+             * needed, with the warm start options added to the solver options. The warm start options only change the iterations of
+             * ipopt, so with code generation it loads the shared object of the cold solver. Other solvers use the same solver for
+             * every solve.
+             *
+             * @return casadi::Function The warm start solver
+             */
+            casadi::Function getWarmStartSolver();
+
+            /**
+             * @brief Create the linearization function and the QP solver of the real-time iterations. They are kept with the NLP
+             * in the NLP cache, so they are only created once for each sequence of phases in the horizon.
+             *
+             * @param nlp The NLP
+             */
+            void createRealTimeIteration(const casadi::MXDict &nlp);
+
+            /**
+             * @brief Feedback phase of a real-time iteration. Solves the QP prepared by prepareRealTimeIteration, with the
+             * constraints and the objective gradient corrected to first order for the change of the initial state, the problem
+             * parameters, and the knot lengths since the preparation, and takes the full step. The Hessian is not corrected.
+             *
+             * @return SolveStats The statistics of the step
+             */
+            SolveStats feedbackRealTimeIteration();
+
+            /**
+             * @brief Split the solution into the segments, and store it for getSolutionSegments.
+             *
+             * @param x The decision variables of the solution
+             */
+            void storeSolution(const casadi::DM &x);
+
+            /**
+             * @brief A Trajectory is made up of segments of finite elements.
+             *
+             */
+            std::vector<std::shared_ptr<Segment>> trajectory;
+
+            /**
+             * @brief The ranges of the segment times.
+             *
+             */
+            std::vector<tuple_size_t> segment_times_ranges;
+
+            /**
+             * @brief The states of the solution of each segment, one column per node. Reused between solves.
+             *
+             */
+            std::vector<Eigen::MatrixXd> solx_segments;
+
+            /**
+             * @brief The inputs of the solution of each segment, one column per node. Reused between solves.
+             *
+             */
+            std::vector<Eigen::MatrixXd> solu_segments;
+
+            /**
+             * @brief Problem data containing constraints problem data.
+             *
+             */
+            std::shared_ptr<ProblemData> problem;
+
+            /**
+             * @brief Problem data containing the objective function and dynamics.
+             *
+             */
+            std::shared_ptr<GeneralProblemData> gp_data;
+
+            /**
+             * @brief Constraint builders used to build the constraints.
+             *
+             */
+            std::vector<std::shared_ptr<ConstraintBuilder<ProblemData>>> builders;
+
+            /**
+             * @brief Decision builder used to build the decision data.
+             *
+             */
+            std::shared_ptr<DecisionDataBuilder<ProblemData>> decision_builder;
+
+            /**
+             * @brief Constraint datas for each phase.
+             *
+             */
+            std::vector<std::vector<ConstraintData>> constraint_datas_for_phase;
+
+            /**
+             * @brief Casadi solver options.
+             *
+             */
+            casadi::Dict opts;
+
+            /**
+             * @brief Nonlinear solver to use.
+             *
+             */
+            std::string nonlinear_solver_name;
+
+            /**
+             * @brief Nonlinear function solver.
+             *
+             */
+            casadi::Function solver;
+
+            /**
+             * @brief Nonlinear function solver of the warm started solves, if it differs from solver. Empty until first needed.
+             *
+             */
+            casadi::Function warm_start_solver;
+
+            /**
+             * @brief The current NLP, from which the warm start solver is created.
+             *
+             */
+            casadi::MXDict current_nlp;
+
+            /**
+             * @brief Options of the solver of the current NLP.
+             *
+             */
+            casadi::Dict current_solver_opts;
+
+            /**
+             * @brief For each constraint in the order of the solver, its index in lbg/ubg. Empty when the orders coincide.
+             *
+             */
+            std::vector<casadi_int> solver_g_permutation;
+
+            /**
+             * @brief Order a vector of constraint values in the order of the solver.
+             *
+             * @param values The values, in the order of lbg/ubg
+             * @return std::vector<double> The values in the order of the solver
+             */
+            std::vector<double> toSolverOrder(const std::vector<double> &values) const
+            {
+                if (solver_g_permutation.empty())
+                    return values;
+                std::vector<double> result(values.size());
+                for (size_t i = 0; i < solver_g_permutation.size(); ++i)
+                    result[i] = values[solver_g_permutation[i]];
+                return result;
+            }
+
+            /**
+             * @brief Order a vector of constraint values returned by the solver in the order of lbg/ubg.
+             *
+             * @param values The values, in the order of the solver
+             * @return std::vector<double> The values in the order of lbg/ubg
+             */
+            std::vector<double> fromSolverOrder(const std::vector<double> &values) const
+            {
+                if (solver_g_permutation.empty())
+                    return values;
+                std::vector<double> result(values.size());
+                for (size_t i = 0; i < solver_g_permutation.size(); ++i)
+                    result[solver_g_permutation[i]] = values[i];
+                return result;
+            }
+
+            /**
+             * @brief Slicer to get the states.
+             *
+             */
+            std::shared_ptr<States> state_indices;
+
+            /**
+             * @brief Sequence of phases including dynamics and timing information
+             *
+             */
+            std::shared_ptr<PhaseSequence<MODE_T>> sequence;
+
+            /**
+             * @brief Range of decision variables per phase.
+             *
+             */
+            std::vector<tuple_size_t> ranges_decision_variables;
+
+            /**
+             * @brief Vector of all decision variables.
+             *
+             */
+            casadi::MXVector w;
+
+            /**
+             * @brief Vector of all constraint expressions.
+             *
+             */
+            casadi::MXVector g;
+
+            /**
+             * @brief Vector of all general constraint lower bounds.
+             *
+             */
+            std::vector<double> lbg;
+
+            /**
+             * @brief Vector of all general constraint upper bounds.
+             *
+             */
+            std::vector<double> ubg;
+
+            /**
+             * @brief  Lower bounds associated with the decision variables.
+             *
+             */
+            std::vector<double> lbw;
+
+            /**
+             * @brief Upper bounds associated with the decision variables.
+             *
+             */
+            std::vector<double> ubw;
+
+            /**
+             * @brief Initial guess for the decision variables.
+             */
+            std::vector<double> w0;
+
+            /**
+             * @brief Expression for objective cost.
+             *
+             */
+            casadi::MX J;
+
+            /**
+             * @brief Vector of all times where decision variables are evaluated.
+             *
+             */
+            casadi::DM global_times;
+
+            /**
+             * @brief Decision data for each phase.
+             *
+             */
+            std::vector<std::shared_ptr<DecisionData>> decision_datas_for_phase;
+
+            /**
+             * @brief Key of the per-knot functions of each phase in the segment function cache, 0 if not cached.
+             *
+             */
+            std::vector<std::size_t> segment_keys_for_phase;
+
+            /**
+             * @brief Per-knot functions of the built segments, by key.
+             *
+             */
+            std::map<std::size_t, std::vector<casadi::Function>> segment_function_cache;
+
+            /**
+             * @brief An NLP built for a sequence of segments, kept so that the horizon can return to it without rebuilding it.
+             * Each NLP owns its segments, since they hold the layout of its decision variables and constraints.
+             *
+             */
+            struct nlp_cache_entry_t
+            {
+                /**
+                 * @brief The segments of the NLP.
+                 *
+                 */
+                std::vector<std::shared_ptr<Segment>> trajectory;
+
+                /**
+                 * @brief Range of decision variables per segment.
+                 *
+                 */
+                std::vector<tuple_size_t> ranges_decision_variables;
+
+                /**
+                 * @brief The ranges in lbg/ubg of the initial state and continuity constraints of each segment.
+                 *
+                 */
+                std::vector<tuple_size_t> ranges_boundary_constraints;
+
+                /**
+                 * @brief Callback of the solver. Declared before the solver, so it outlives it.
+                 *
+                 */
+                std::shared_ptr<IterationCallback> callback;
+
+                /**
+                 * @brief The nonlinear solver.
+                 *
+                 */
+                casadi::Function solver;
+
+                /**
+                 * @brief The nonlinear solver of the warm started solves, empty until first needed.
+                 *
+                 */
+                casadi::Function warm_start_solver;
+
+                /**
+                 * @brief Number of iterations of the last cold solve of the NLP, -1 if it has not been solved cold.
+                 *
+                 */
+                int cold_start_iterations = -1;
+
+                /**
+                 * @brief The NLP.
+                 *
+                 */
+                casadi::MXDict nlp;
+
+                /**
+                 * @brief Options of the solver.
+                 *
+                 */
+                casadi::Dict solver_opts;
+
+                /**
+                 * @brief Order of the constraints of the solver.
+                 *
+                 */
+                std::vector<casadi_int> solver_g_permutation;
+
+                /**
+                 * @brief Linearization of the NLP for the real-time iterations.
+                 *
+                 */
+                casadi::Function rti_linearization;
+
+                /**
+                 * @brief The QP solver of the real-time iterations.
+                 *
+                 */
+                casadi::Function rti_qp;
+
+                /**
+                 * @brief Value of nlp_cache_uses when the NLP was last used.
+                 *
+                 */
+                size_t last_use = 0;
+            };
+
+            /**
+             * @brief The NLPs kept for the horizon to return to, by key.
+             *
+             */
+            std::map<std::size_t, nlp_cache_entry_t> nlp_cache;
+
+            /**
+             * @brief Number of NLPs kept in the NLP cache.
+             *
+             */
+            size_t nlp_cache_capacity = 16;
+
+            /**
+             * @brief Number of times an NLP was stored in or restored from the NLP cache.
+             *
+             */
+            size_t nlp_cache_uses = 0;
+
+            /**
+             * @brief Key of the current NLP in the NLP cache, 0 if it is not cached.
+             *
+             */
+            std::size_t current_nlp_key = 0;
+
+            /**
+             * @brief Number of leading segments in the trajectory whose expression graphs are initialized.
+             *
+             */
+            size_t num_initialized_segments = 0;
+
+            /**
+             * @brief Degree of the finite element polynomials, used by the phases which do not set their own degree.
+             *
+             */
+            int degree = 1;
+
+            /**
+             * @brief Error of each knot segment of each phase, estimated by the last mesh refinement iteration.
+             *
+             */
+            std::vector<std::vector<double>> mesh_errors;
+
+            /**
+             * @brief The state the decision variables deviate from. This is kept fixed while the horizon advances.
+             *
+             */
+            casadi::DM x0_global;
+
+            /**
+             * @brief Time at which the current horizon starts.
+             *
+             */
+            double horizon_start_time = 0.0;
+
+            /**
+             * @brief Duration of the horizon, kept fixed while it advances.
+             *
+             */
+            double horizon_duration = 0.0;
+
+            /**
+             * @brief Index in the phase sequence of the phase of the first segment.
+             *
+             */
+            size_t horizon_first_phase = 0;
+
+            /**
+             * @brief Parameters of the NLP: the initial state, the problem parameters, and the knot length of each segment.
+             *
+             */
+            casadi::MX p;
+
+            /**
+             * @brief Value of the initial state passed to the solver.
+             *
+             */
+            casadi::DM initial_state_value;
+
+            /**
+             * @brief Value of the problem parameters passed to the solver.
+             *
+             */
+            casadi::DM parameter_values;
+
+            /**
+             * @brief Value of the knot length of each segment passed to the solver.
+             *
+             */
+            casadi::DM knot_length_values;
+
+            /**
+             * @brief True if the multipliers of the last solve are used to warm start the next one.
+             *
+             */
+            bool warm_start = false;
+
+            /**
+             * @brief Initial guess for the multipliers of the decision variable bounds.
+             *
+             */
+            std::vector<double> lam_w0;
+
+            /**
+             * @brief Initial guess for the multipliers of the constraints.
+             *
+             */
+            std::vector<double> lam_g0;
+
+            /**
+             * @brief True if lam_w0 and lam_g0 hold the multipliers of a previous solve.
+             *
+             */
+            bool has_multipliers = false;
+
+            /**
+             * @brief The ranges in lbg/ubg of the initial state and continuity constraints of each segment.
+             *
+             */
+            std::vector<tuple_size_t> ranges_boundary_constraints;
+
+            /**
+             * @brief Number of iterations of the last solve of the current NLP which was not warm started, -1 if there is none. The
+             * warm started solves of an NLP are only compared to its own cold solves.
+             *
+             */
+            int cold_start_iterations = -1;
+
+            /**
+             * @brief Statistics of the last solve.
+             *
+             */
+            SolveStats solve_stats;
+
+            /**
+             * @brief Time spent building the expression graph of each phase the last time the finite elements were stitched.
+             *
+             */
+            std::vector<double> phase_build_times;
+
+            /**
+             * @brief Total time spent the last time the finite elements were stitched.
+             *
+             */
+            double graph_build_time = 0.0;
+
+            /**
+             * @brief Time spent constructing the solver the last time the finite elements were stitched.
+             *
+             */
+            double solver_construction_time = 0.0;
+
+            /**
+             * @brief Number of segments which reused the per-knot functions of the segment function cache the last time the finite elements were stitched.
+             *
+             */
+            size_t segment_function_cache_hits = 0;
+
+            /**
+             * @brief Name of the shared object compiled when the current NLP was built, empty if none was compiled.
+             *
+             */
+            std::string compiled_library;
+
+            /**
+             * @brief Names of the shared objects of the NLPs built so far, by the key of the NLP and the options of the solver, so
+             * the NLP is only serialized and hashed once for each of them. Cleared when the finite elements are initialized.
+             *
+             */
+            std::map<std::pair<std::size_t, std::string>, std::string> codegen_names;
+
+            /**
+             * @brief Callback function called at each iteration, used for debugging and plotting.
+             *
+             */
+            std::shared_ptr<IterationCallback> callback;
+
+            /**
+             * @brief Ring buffer of iteration records written by the callback.
+             *
+             */
+            std::shared_ptr<IterationRingBuffer> telemetry;
+
+            /**
+             * @brief The number of solver iterations between iteration records.
+             *
+             */
+            casadi_int telemetry_step = 1;
+
+            /**
+             * @brief Number of threads used to build the segments of the phases concurrently.
+             *
+             */
+            size_t num_construction_threads = std::max<unsigned int>(std::thread::hardware_concurrency(), 1);
+
+            /**
+             * @brief True if the decision variables and constraints of each segment are ordered knot by knot.
+             *
+             */
+            bool stage_wise_ordering = false;
+
+            /**
+             * @brief True if each knot segment is evaluated by a single fused function.
+             *
+             */
+            bool fused_knot_kernel = false;
+
+            /**
+             * @brief True if the cost of each segment is a map over its knots followed by a sum.
+             *
+             */
+            bool map_reduce_cost = false;
+
+            /**
+             * @brief True if segments with the same per-knot functions share them.
+             *
+             */
+            bool segment_function_cache_enabled = true;
+
+            /**
+             * @brief Execution policy of the maps of the segments.
+             *
+             */
+            MapPolicy map_policy;
+
+            /**
+             * @brief True if the NLP functions are code generated and compiled.
+             *
+             */
+            bool codegen = false;
+
+            /**
+             * @brief Directory in which the compiled NLP functions are cached.
+             *
+             */
+            std::string codegen_cache_directory;
+
+            /**
+             * @brief The C compiler used for the generated code.
+             *
+             */
+            std::string codegen_compiler = "gcc";
+
+            /**
+             * @brief Flags passed to the compiler.
+             *
+             */
+            std::string codegen_compiler_flags = "-O3 -march=native";
+
+            /**
+             * @brief True if the NLP is solved with real-time iterations.
+             *
+             */
+            bool rti = false;
+
+            /**
+             * @brief The QP solver plugin of the real-time iterations.
+             *
+             */
+            std::string rti_qpsol = "qpoases";
+
+            /**
+             * @brief Options of the QP solver of the real-time iterations.
+             *
+             */
+            casadi::Dict rti_qpsol_opts;
+
+            /**
+             * @brief True if the real-time iterations use the Hessian of the Lagrangian instead of the Hessian of the objective.
+             *
+             */
+            bool rti_exact_hessian = false;
+
+            /**
+             * @brief Multiple of the identity added to the QP Hessian, so that variables which do not enter the objective are not singular.
+             *
+             */
+            double rti_regularization = 1e-8;
+
+            /**
+             * @brief Linearization of the NLP. Inputs are (x, p, lam_g), outputs are (f, grad_f, H, g, jac_g_x, jac_g_p, jac_grad_f_p).
+             *
+             */
+            casadi::Function rti_linearization;
+
+            /**
+             * @brief The QP solver of the real-time iterations.
+             *
+             */
+            casadi::Function rti_qp;
+
+            /**
+             * @brief True if the linearization of the current NLP has been prepared and not used yet.
+             *
+             */
+            bool rti_prepared = false;
+
+            /**
+             * @brief Outputs of rti_linearization at the prepared point.
+             *
+             */
+            casadi::DMVector rti_point;
+
+            /**
+             * @brief The parameters at which the linearization was prepared.
+             *
+             */
+            casadi::DM rti_p;
+
+            /**
+             * @brief Time spent in the last preparation phase.
+             *
+             */
+            double rti_preparation_time = 0.0;
+        };
+
+        template <class ProblemData, class MODE_T>
+        TrajectoryOpt<ProblemData, MODE_T>::TrajectoryOpt(std::shared_ptr<ProblemData> problem_, std::shared_ptr<PhaseSequence<MODE_T>> phase_sequence, std::vector<std::shared_ptr<ConstraintBuilder<ProblemData>>> builders_, std::shared_ptr<DecisionDataBuilder<ProblemData>> decision_builder_, casadi::Dict opts_, std::string nonlinear_solver_name_)
+        {
+            this->problem = problem_;
+            this->gp_data = problem_->gp_data;
+            this->builders = builders_;
+            this->decision_builder = decision_builder_;
+            this->state_indices = problem_->states;
+            this->sequence = phase_sequence;
+            this->opts = opts_;
+            this->nonlinear_solver_name = nonlinear_solver_name_;
+            this->parameter_values = casadi::DM::zeros(gp_data->np, 1);
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::initFiniteElements(int d, casadi::DM X0)
+        {
+            assert(X0.size1() == state_indices->nx && X0.size2() == 1 && "Initial state must be a column vector");
+            trajectory.clear();
+            constraint_datas_for_phase.clear();
+            decision_datas_for_phase.clear();
+            segment_keys_for_phase.clear();
+            num_initialized_segments = 0;
+            degree = d;
+            x0_global = X0;
+            initial_state_value = X0;
+            has_multipliers = false;
+            nlp_cache.clear();
+            current_nlp_key = 0;
+            codegen_names.clear();
+            horizon_start_time = sequence->getStartTime();
+            horizon_duration = sequence->getDT() - horizon_start_time;
+            horizon_first_phase = 0;
+
+            size_t num_phases = sequence->getNumPhases();
+
+            /*The phases are independent until they are stitched together*/
+            trajectory.resize(num_phases);
+            constraint_datas_for_phase.resize(num_phases);
+            decision_datas_for_phase.resize(num_phases);
+            segment_keys_for_phase.resize(num_phases, 0);
+            parallelFor(num_phases, [this](size_t i)
+                        { buildSegment(i, i); });
+            stitchFiniteElements();
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::setInitialState(casadi::DM X0)
+        {
+            assert(X0.size1() == state_indices->nx && X0.size2() == 1 && "Initial state must be a column vector");
+            initial_state_value = X0;
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::setParameters(casadi::DM params)
+        {
+            assert(params.size1() == gp_data->np && params.size2() == 1 && "Parameters must be a column vector of size np");
+            parameter_values = params;
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::appendSegment(size_t phase_index)
+        {
+            trajectory.emplace_back();
+            constraint_datas_for_phase.emplace_back();
+            decision_datas_for_phase.emplace_back();
+            segment_keys_for_phase.emplace_back(0);
+            buildSegment(phase_index, trajectory.size() - 1);
+        }
 
-                ranges_decision_variables.push_back(segment->get_range_idx_decision_variables());
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::buildSegment(size_t phase_index, size_t slot)
+        {
+            std::vector<ConstraintData> G;
+            for (auto builder : builders)
+            {
+                ConstraintData con_data;
+                builder->buildConstraint(*problem, phase_index, con_data);
+                G.push_back(con_data);
+            }
+            std::shared_ptr<DecisionData> Wdata = std::make_shared<DecisionData>();
+            decision_builder->buildDecisionData(*problem, phase_index, *Wdata);
 
-                trajectory.push_back(segment);
+            auto phase = sequence->getPhase(phase_index);
+            int phase_degree = phase.degree > 0 ? phase.degree : degree;
+            std::shared_ptr<Segment> segment = SegmentFactory::createSegment(phase.transcription, gp_data, phase.phase_dynamics, phase.phase_cost, state_indices, phase_degree, phase.scheme, phase.knot_points, phase.time_value / phase.knot_points,
+                                                                             stage_wise_ordering || isStructureExploitingSolver(), fused_knot_kernel);
+            segment->setMapPolicy(map_policy);
+            segment->setMapReduceCost(map_reduce_cost);
 
-                segment->fill_lbg_ubg(lbg, ubg);
-                segment->fill_lbw_ubw(lbw, ubw);
-                segment->fill_w0(w0);
+            std::size_t key = 0;
+            if (segment_function_cache_enabled)
+            {
+                std::vector<casadi::Function> functions = {phase.phase_dynamics, phase.phase_cost};
+                for (const ConstraintData &con_data : G)
+                    functions.push_back(con_data.G);
+                std::ostringstream discretization;
+                /*The knot length is a parameter of the NLP, so it does not change the functions*/
+                discretization << int(phase.transcription) << " " << phase_degree << " " << phase.scheme << " " << fused_knot_kernel;
+                key = segmentFunctionKey(functions, discretization.str());
+            }
+
+            constraint_datas_for_phase[slot] = G;
+            decision_datas_for_phase[slot] = Wdata;
+            segment_keys_for_phase[slot] = key;
+            trajectory[slot] = segment;
+        }
+
+        template <class ProblemData, class MODE_T>
+        std::size_t TrajectoryOpt<ProblemData, MODE_T>::segmentFunctionKey(const std::vector<casadi::Function> &functions, const std::string &discretization) const
+        {
+            std::hash<std::string> hasher;
+            std::size_t key = hasher(discretization);
+            for (const casadi::Function &function : functions)
+            {
+                std::string serialized;
+                try
+                {
+                    serialized = function.serialize();
+                }
+                catch (const casadi::CasadiException &)
+                {
+                    /*Functions such as externals can not be told apart by their serialization*/
+                    return 0;
+                }
+                key ^= hasher(serialized) + 0x9e3779b97f4a7c15 + (key << 6) + (key >> 2);
+            }
+            return key == 0 ? 1 : key;
+        }
+
+        template <class ProblemData, class MODE_T>
+        template <class F>
+        void TrajectoryOpt<ProblemData, MODE_T>::parallelFor(size_t n, F f) const
+        {
+#ifdef CASADI_WITH_THREADSAFE_SYMBOLICS
+            size_t num_workers = std::min(n, num_construction_threads);
+#else
+            size_t num_workers = 1;
+#endif
+            if (num_workers <= 1)
+            {
+                for (size_t i = 0; i < n; ++i)
+                    f(i);
+                return;
+            }
+
+            std::atomic<size_t> next_index{0};
+            std::exception_ptr error;
+            std::mutex error_mutex;
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < num_workers; ++t)
+            {
+                workers.emplace_back([&]()
+                                     {
+                    for (size_t i = next_index++; i < n; i = next_index++)
+                    {
+                        try
+                        {
+                            f(i);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(error_mutex);
+                            if (!error)
+                                error = std::current_exception();
+                        }
+                    } });
+            }
+            for (std::thread &worker : workers)
+                worker.join();
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::stitchFiniteElements()
+        {
+            auto build_start = std::chrono::steady_clock::now();
+            phase_build_times.clear();
+            w.clear();
+            g.clear();
+            lbg.clear();
+            ubg.clear();
+            lbw.clear();
+            ubw.clear();
+            w0.clear();
+            lam_w0.clear();
+            lam_g0.clear();
+            ranges_decision_variables.clear();
+            ranges_boundary_constraints.clear();
+            J = 0;
+
+            casadi_int knot_lengths_start = state_indices->nx + gp_data->np;
+            p = casadi::MX::sym("p", knot_lengths_start + trajectory.size(), 1);
+            casadi::MX problem_parameters = p(casadi::Slice(state_indices->nx, knot_lengths_start));
+
+            casadi::MX prev_final_state = p(casadi::Slice(0, state_indices->nx));
+            casadi::MX prev_final_state_deviant;
+
+            std::vector<double> equality_back_nx(state_indices->nx, 0.0);
+            std::vector<double> equality_back_ndx(state_indices->ndx, 0.0);
+
+            /*The time vectors and decision variables chain from one segment to the next*/
+            updateHorizonTimes();
+            for (size_t i = 0; i < trajectory.size(); ++i)
+            {
+                std::shared_ptr<Segment> segment = trajectory[i];
+                segment->initializeKnotSegments(x0_global, prev_final_state, problem_parameters, p(knot_lengths_start + casadi_int(i)));
+                prev_final_state = segment->getFinalState();
+            }
+
+            /*The expression graphs of the segments are independent. The first new segment of each key not yet in the cache builds
+            its per-knot functions, and the others reuse them once they are built*/
+            phase_build_times.resize(trajectory.size(), 0.0);
+            std::vector<size_t> building_segments;
+            std::vector<size_t> reusing_segments;
+            std::set<std::size_t> building_keys;
+            for (size_t i = std::min(num_initialized_segments, trajectory.size()); i < trajectory.size(); ++i)
+            {
+                std::size_t key = segment_keys_for_phase[i];
+                if (key != 0 && (segment_function_cache.count(key) || building_keys.count(key)))
+                    reusing_segments.push_back(i);
+                else
+                {
+                    building_segments.push_back(i);
+                    building_keys.insert(key);
+                }
+            }
+
+            auto build_expression_graph = [this](size_t i)
+            {
+                auto phase_start = std::chrono::steady_clock::now();
+                trajectory[i]->initializeExpressionGraph(constraint_datas_for_phase[i], decision_datas_for_phase[i]);
+                phase_build_times[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - phase_start).count();
+            };
+            parallelFor(building_segments.size(), [&](size_t k)
+                        { build_expression_graph(building_segments[k]); });
+            for (size_t i : building_segments)
+            {
+                if (segment_keys_for_phase[i] != 0)
+                    segment_function_cache[segment_keys_for_phase[i]] = trajectory[i]->getKnotFunctions();
+            }
+            for (size_t i : reusing_segments)
+                trajectory[i]->reuseKnotFunctions(segment_function_cache.at(segment_keys_for_phase[i]));
+            segment_function_cache_hits = reusing_segments.size();
+            compiled_library.clear();
+            parallelFor(reusing_segments.size(), [&](size_t k)
+                        { build_expression_graph(reusing_segments[k]); });
+
+            prev_final_state = p(casadi::Slice(0, state_indices->nx));
+            for (size_t i = 0; i < trajectory.size(); ++i)
+            {
+                auto phase_start = std::chrono::steady_clock::now();
+                std::shared_ptr<Segment> segment = trajectory[i];
 
                 /*Initial state constraint*/
                 if (i == 0)
@@ -430,88 +1738,817 @@ namespace galileo
                     ubg.insert(ubg.end(), equality_back_nx.begin(), equality_back_nx.end());
                 }
                 /*Continuity constraint for the state deviant between phases*/
-                else if (i > 0)
+                else
                 {
-                    curr_initial_state_deviant = segment->getInitialStateDeviant();
+                    auto curr_initial_state_deviant = segment->getInitialStateDeviant();
                     /*For general jump map functions you can use the following syntax:*/
                     // g.push_back(jump_map_function(MXVector{prev_final_state_deviant, curr_initial_state_deviant}).at(0));
                     g.push_back(prev_final_state_deviant - curr_initial_state_deviant);
                     lbg.insert(lbg.end(), equality_back_ndx.begin(), equality_back_ndx.end());
                     ubg.insert(ubg.end(), equality_back_ndx.begin(), equality_back_ndx.end());
                 }
+                ranges_boundary_constraints.push_back(tuple_size_t(lam_g0.size(), lbg.size()));
+                lam_g0.resize(lbg.size(), 0.0);
+
+                segment->evaluateExpressionGraph(J, w, g);
+
+                ranges_decision_variables.push_back(segment->get_range_idx_decision_variables());
+
+                segment->fill_lbg_ubg(lbg, ubg);
+                segment->fill_lbw_ubw(lbw, ubw);
+                segment->fill_w0(w0);
+                segment->fill_lam0(lam_w0, lam_g0);
+
                 prev_final_state = segment->getFinalState();
                 prev_final_state_deviant = segment->getFinalStateDeviant();
+                phase_build_times[i] += std::chrono::duration<double>(std::chrono::steady_clock::now() - phase_start).count();
+            }
 
-                /*Terminal cost*/
-                if (i == num_phases - 1)
+            /*Terminal cost*/
+            if (gp_data->np > 0)
+                J += gp_data->Phi(casadi::MXVector{prev_final_state, problem_parameters}).at(0);
+            else
+                J += gp_data->Phi(casadi::MXVector{prev_final_state}).at(0);
+
+            num_initialized_segments = trajectory.size();
+
+            casadi::MXDict nlp = {{"x", vertcat(w)},
+                                  {"f", J},
+                                  {"g", vertcat(g)},
+                                  {"p", p}};
+
+            solver_g_permutation.clear();
+            if (rti)
+            {
+                auto solver_start = std::chrono::steady_clock::now();
+                graph_build_time = std::chrono::duration<double>(solver_start - build_start).count();
+                createRealTimeIteration(nlp);
+                solver_construction_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - solver_start).count();
+                storeNLP();
+                return;
+            }
+
+            casadi::Dict solver_opts = opts;
+            if (isStructureExploitingSolver())
+            {
+                auto detection = solver_opts.find("structure_detection");
+                if (detection == solver_opts.end() || detection->second.to_string() == "manual")
                 {
-                    J += gp_data->Phi(casadi::MXVector{prev_final_state}).at(0);
+                    /*fatrop expects the decision variables as [x_0, u_0, x_1, u_1, ..., x_N], which is the stage-wise ordering, and
+                    the constraints of each stage as its gap closing constraints x_{k+1} = F(x_k, u_k) followed by its path
+                    constraints. The constraints are reordered for the solver only, so the ranges of the segments are unchanged.
+                    The constraint joining two segments closes the gap of the final knot of the first, and the initial state
+                    constraint, which is nonlinear in dX0_0, is a path constraint of the first stage*/
+                    std::vector<stage_structure_t> stages;
+                    for (size_t i = 0; i < trajectory.size(); ++i)
+                    {
+                        std::vector<casadi_int> boundary_rows;
+                        for (size_t row = std::get<0>(ranges_boundary_constraints[i]); row < std::get<1>(ranges_boundary_constraints[i]); ++row)
+                            boundary_rows.push_back(row);
+                        if (i > 0)
+                            stages.back().gap_closing_rows = boundary_rows;
+
+                        std::vector<stage_structure_t> segment_stages = trajectory[i]->getStageStructure();
+                        casadi_int offset = std::get<0>(trajectory[i]->get_range_idx_constraint_bounds());
+                        for (stage_structure_t &stage : segment_stages)
+                        {
+                            for (casadi_int &row : stage.gap_closing_rows)
+                                row += offset;
+                            for (casadi_int &row : stage.path_rows)
+                                row += offset;
+                        }
+                        if (i == 0)
+                            segment_stages.front().path_rows.insert(segment_stages.front().path_rows.begin(), boundary_rows.begin(), boundary_rows.end());
+                        stages.insert(stages.end(), segment_stages.begin(), segment_stages.end());
+                    }
+
+                    std::vector<casadi_int> nx, nu, ng;
+                    for (size_t k = 0; k < stages.size(); ++k)
+                    {
+                        assert((k + 1 == stages.size() ? stages[k].gap_closing_rows.empty() : casadi_int(stages[k].gap_closing_rows.size()) == stages[k + 1].nx) &&
+                               "The gap closing constraints of a stage must determine the states of the next stage");
+                        solver_g_permutation.insert(solver_g_permutation.end(), stages[k].gap_closing_rows.begin(), stages[k].gap_closing_rows.end());
+                        solver_g_permutation.insert(solver_g_permutation.end(), stages[k].path_rows.begin(), stages[k].path_rows.end());
+                        nx.push_back(stages[k].nx);
+                        nu.push_back(stages[k].nu);
+                        ng.push_back(stages[k].path_rows.size());
+                    }
+                    assert(solver_g_permutation.size() == lbg.size() && "The stages must cover every constraint");
+                    solver_opts["structure_detection"] = "manual";
+                    solver_opts["N"] = casadi_int(stages.size()) - 1;
+                    solver_opts["nx"] = nx;
+                    solver_opts["nu"] = nu;
+                    solver_opts["ng"] = ng;
+                    nlp["g"] = vertcat(g)(casadi::IM(solver_g_permutation));
                 }
+                std::vector<double> solver_lbg = toSolverOrder(lbg);
+                std::vector<double> solver_ubg = toSolverOrder(ubg);
+                std::vector<bool> equality(lbg.size());
+                for (size_t i = 0; i < lbg.size(); ++i)
+                    equality[i] = (solver_lbg[i] == solver_ubg[i]);
+                solver_opts["equality"] = equality;
+            }
+
+            /*The old callback must outlive the old solver, so it is only replaced once the new solver exists*/
+            std::shared_ptr<IterationCallback> new_callback;
+            if (telemetry)
+            {
+                new_callback = std::make_shared<IterationCallback>("iteration_callback", w0.size(), p.size1(), toSolverOrder(lbg), toSolverOrder(ubg), telemetry, telemetry_step);
+                solver_opts["iteration_callback"] = *new_callback;
+                solver_opts["iteration_callback_step"] = telemetry_step;
+            }
+
+            auto solver_start = std::chrono::steady_clock::now();
+            graph_build_time = std::chrono::duration<double>(solver_start - build_start).count();
+            solver = createSolver(nlp, solver_opts);
+            warm_start_solver = casadi::Function();
+            cold_start_iterations = -1;
+            current_nlp = nlp;
+            current_solver_opts = solver_opts;
+            callback = new_callback;
+            solver_construction_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - solver_start).count();
+            storeNLP();
+        }
+
+        template <class ProblemData, class MODE_T>
+        std::size_t TrajectoryOpt<ProblemData, MODE_T>::nlpKey() const
+        {
+            std::size_t key = std::hash<size_t>()(trajectory.size());
+            for (size_t i = 0; i < trajectory.size(); ++i)
+            {
+                if (segment_keys_for_phase[i] == 0)
+                    return 0;
+                key ^= segment_keys_for_phase[i] + 0x9e3779b97f4a7c15 + (key << 6) + (key >> 2);
+                key ^= std::hash<int>()(trajectory[i]->getKnotNum()) + 0x9e3779b97f4a7c15 + (key << 6) + (key >> 2);
             }
-            std::cout << "Finished initialization" << std::endl;
+            return key == 0 ? 1 : key;
         }
 
         template <class ProblemData, class MODE_T>
-        void TrajectoryOpt<ProblemData, MODE_T>::advanceFiniteElements(double time_advance, casadi::DM X0, typename PhaseSequence<MODE_T>::Phase phase)
+        void TrajectoryOpt<ProblemData, MODE_T>::storeNLP()
         {
+            current_nlp_key = nlp_cache_capacity > 0 ? nlpKey() : 0;
+            if (current_nlp_key == 0)
+                return;
+            while (nlp_cache.size() >= nlp_cache_capacity && !nlp_cache.count(current_nlp_key))
+            {
+                auto least_recent = std::min_element(nlp_cache.begin(), nlp_cache.end(), [](const auto &a, const auto &b)
+                                                     { return a.second.last_use < b.second.last_use; });
+                nlp_cache.erase(least_recent);
+            }
+            nlp_cache_entry_t &entry = nlp_cache[current_nlp_key];
+            entry.trajectory = trajectory;
+            entry.ranges_decision_variables = ranges_decision_variables;
+            entry.ranges_boundary_constraints = ranges_boundary_constraints;
+            entry.callback = callback;
+            entry.solver = solver;
+            entry.warm_start_solver = warm_start_solver;
+            entry.cold_start_iterations = cold_start_iterations;
+            entry.nlp = current_nlp;
+            entry.solver_opts = current_solver_opts;
+            entry.solver_g_permutation = solver_g_permutation;
+            entry.rti_linearization = rti_linearization;
+            entry.rti_qp = rti_qp;
+            entry.last_use = ++nlp_cache_uses;
         }
 
         template <class ProblemData, class MODE_T>
-        casadi::MXVector TrajectoryOpt<ProblemData, MODE_T>::optimize()
+        bool TrajectoryOpt<ProblemData, MODE_T>::restoreNLP(std::size_t key, size_t new_segments)
         {
+            auto it = nlp_cache.find(key);
+            if (key == 0 || it == nlp_cache.end())
+                return false;
+
+            auto restore_start = std::chrono::steady_clock::now();
+            nlp_cache_entry_t &entry = it->second;
+            assert(entry.trajectory.size() == trajectory.size() && "A cached NLP must have as many segments as the trajectory");
+            trajectory = entry.trajectory;
+            ranges_decision_variables = entry.ranges_decision_variables;
+            ranges_boundary_constraints = entry.ranges_boundary_constraints;
+            callback = entry.callback;
+            solver = entry.solver;
+            warm_start_solver = entry.warm_start_solver;
+            cold_start_iterations = entry.cold_start_iterations;
+            current_nlp = entry.nlp;
+            current_solver_opts = entry.solver_opts;
+            solver_g_permutation = entry.solver_g_permutation;
+            rti_linearization = entry.rti_linearization;
+            rti_qp = entry.rti_qp;
+            entry.last_use = ++nlp_cache_uses;
+            current_nlp_key = key;
+            num_initialized_segments = trajectory.size();
+
+            /*The symbolic NLP is unchanged, only the numeric data of the segments follows the new phases*/
+            updateHorizonTimes();
+            for (size_t i = new_segments; i < trajectory.size(); ++i)
+                trajectory[i]->updateInitialGuess(decision_datas_for_phase[i]);
+            fillBounds();
+            w0.clear();
+            for (std::shared_ptr<Segment> segment : trajectory)
+                segment->fill_w0(w0);
+            lam_w0.assign(lbw.size(), 0.0);
+            lam_g0.assign(lbg.size(), 0.0);
+
+            phase_build_times.assign(trajectory.size(), 0.0);
+            graph_build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - restore_start).count();
+            solver_construction_time = 0.0;
+            segment_function_cache_hits = 0;
+            compiled_library.clear();
+            rti_prepared = false;
+            return true;
+        }
 
-            casadi::MXDict nlp = {{"x", vertcat(w)},
-                                  {"f", J},
-                                  {"g", vertcat(g)}};
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::updateHorizonTimes()
+        {
+            /*Lower bound on the duration of a segment, so that a phase which only just entered the horizon has a positive knot length*/
+            const double min_duration = 1e-9;
+            typename PhaseSequence<MODE_T>::PHASE_SEQUENCE_ERROR error;
+            double horizon_end = horizon_start_time + horizon_duration;
+
+            /*Segment times are w.r.t. the phase sequence, so the horizon starts wherever the consumed part of the first phase ends*/
+            global_times = horizon_start_time > 0 ? casadi::DM(horizon_start_time) : casadi::DM(0, 0);
+            std::vector<double> knot_lengths(trajectory.size());
+            for (size_t i = 0; i < trajectory.size(); ++i)
+            {
+                size_t phase_index = horizon_first_phase + i;
+                double phase_start;
+                sequence->getTimeAtPhase(phase_index, phase_start, error);
+                double phase_end = phase_start + sequence->getPhase(phase_index).time_value;
+                double duration = std::min(phase_end, horizon_end) - std::max(phase_start, horizon_start_time);
+
+                std::shared_ptr<Segment> segment = trajectory[i];
+                knot_lengths[i] = std::max(duration, min_duration) / segment->getKnotNum();
+                segment->setKnotLength(knot_lengths[i]);
+                segment->initializeSegmentTimeVector(global_times);
+                segment->initializeInputTimeVector(global_times);
+                if (i < num_initialized_segments)
+                    segment->updateBounds(constraint_datas_for_phase[i], decision_datas_for_phase[i]);
+            }
+            knot_length_values = casadi::DM(knot_lengths);
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::fillBounds()
+        {
+            lbg.clear();
+            ubg.clear();
+            lbw.clear();
+            ubw.clear();
+            for (size_t i = 0; i < trajectory.size(); ++i)
+            {
+                /*The initial state constraint, or the continuity constraint with the previous segment*/
+                size_t boundary_size = i == 0 ? state_indices->nx : state_indices->ndx;
+                lbg.insert(lbg.end(), boundary_size, 0.0);
+                ubg.insert(ubg.end(), boundary_size, 0.0);
+                trajectory[i]->fill_lbg_ubg(lbg, ubg);
+                trajectory[i]->fill_lbw_ubw(lbw, ubw);
+            }
+        }
+
+        template <class ProblemData, class MODE_T>
+        casadi::Function TrajectoryOpt<ProblemData, MODE_T>::lastSolutionGuess()
+        {
+            if (trajectory.empty() || solx_segments.size() != trajectory.size())
+                return casadi::Function();
+            std::vector<solution::solution_segment_data_t> solution_segments = getSolutionSegments();
+            casadi::Function interpolant = MeshRefinement::createInitialGuess(solution_segments, state_indices->nx, state_indices->nu);
+            casadi::MX t = casadi::MX::sym("t");
+            casadi::MX t_held = fmin(fmax(t, solution_segments.front().initial_time), solution_segments.back().end_time);
+            return casadi::Function("LastSolutionGuess", casadi::MXVector{t}, interpolant(casadi::MXVector{t_held}));
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::shiftInitialGuess(const casadi::Function &guess, size_t num_segments)
+        {
+            for (size_t i = 0; i < num_segments; ++i)
+            {
+                /*The bounds of the decision data are kept, only its guess is replaced*/
+                std::shared_ptr<DecisionData> Wdata = std::make_shared<DecisionData>(*decision_datas_for_phase[i]);
+                Wdata->initial_guess = guess;
+                trajectory[i]->updateInitialGuess(Wdata);
+            }
+            w0.clear();
+            for (std::shared_ptr<Segment> segment : trajectory)
+                segment->fill_w0(w0);
+        }
+
+        template <class ProblemData, class MODE_T>
+        casadi::Function TrajectoryOpt<ProblemData, MODE_T>::createSolver(const casadi::MXDict &nlp, const casadi::Dict &solver_opts, const casadi::Dict &runtime_opts)
+        {
+            casadi::Dict all_opts = solver_opts;
+            for (const auto &opt : runtime_opts)
+                all_opts[opt.first] = opt.second;
+            if (!codegen)
+                return casadi::nlpsol("solver", nonlinear_solver_name, nlp, all_opts);
+
+            /*The serialized NLP captures the model, the phases in the horizon, and the constraints. The knot lengths, the initial
+            state, and the problem parameters are parameters of the NLP, so advancing the horizon over the same phases gives the
+            same key and reuses the library. FNV-1a is used since it is stable across runs. Serializing the NLP is expensive, so the
+            name is remembered for each NLP key*/
+            std::string options_key = nonlinear_solver_name + casadi::str(solver_opts);
+            std::size_t nlp_key = nlpKey();
+            auto memo = nlp_key == 0 ? codegen_names.end() : codegen_names.find(std::make_pair(nlp_key, options_key));
+            std::string name;
+            if (memo != codegen_names.end())
+                name = memo->second;
+            else
+            {
+                casadi::Function nlp_func = casadi::Function("nlp", casadi::MXVector{nlp.at("x"), nlp.at("p")}, casadi::MXVector{nlp.at("f"), nlp.at("g")});
+                std::string key_data = nlp_func.serialize() + options_key + codegen_compiler + codegen_compiler_flags;
+                uint64_t hash = 14695981039346656037ULL;
+                for (unsigned char c : key_data)
+                {
+                    hash ^= c;
+                    hash *= 1099511628211ULL;
+                }
+                std::stringstream name_stream;
+                name_stream << "galileo_nlp_" << std::hex << std::setw(16) << std::setfill('0') << hash;
+                name = name_stream.str();
+                if (nlp_key != 0)
+                    codegen_names[std::make_pair(nlp_key, options_key)] = name;
+            }
+
+            std::filesystem::path cache_directory(codegen_cache_directory);
+            std::filesystem::create_directories(cache_directory);
+            std::filesystem::path library_path = cache_directory / (name + ".so");
+
+            if (!std::filesystem::exists(library_path))
+            {
+                compiled_library = name;
+                /*Each generation works in its own directory inside the cache, so concurrent generations never share a file, and
+                the finished library is renamed into place within the same file system, which is atomic*/
+                std::string work_template = (cache_directory / (name + ".XXXXXX")).string();
+                std::vector<char> work_buffer(work_template.begin(), work_template.end());
+                work_buffer.push_back('\0');
+                if (mkdtemp(work_buffer.data()) == nullptr)
+                    throw std::runtime_error("Failed to create a directory for the generated NLP functions in " + cache_directory.string());
+                std::filesystem::path work_directory(work_buffer.data());
+
+                try
+                {
+                    /*The generator writes to the working directory, so the source gets a name no other generation uses
+                    before it is moved into the work directory*/
+                    static std::atomic<unsigned int> generation_count{0};
+                    std::string source_name = name + "_" + std::to_string(getpid()) + "_" + std::to_string(generation_count++) + ".c";
+                    casadi::Function solver_to_generate = casadi::nlpsol("solver", nonlinear_solver_name, nlp, solver_opts);
+                    std::string source_file = solver_to_generate.generate_dependencies(source_name);
+                    std::filesystem::path source_path = work_directory / source_name;
+                    std::error_code rename_error;
+                    std::filesystem::rename(source_file, source_path, rename_error);
+                    if (rename_error)
+                    {
+                        /*The working directory is on another file system*/
+                        std::filesystem::copy_file(source_file, source_path);
+                        std::filesystem::remove(source_file);
+                    }
+
+                    std::filesystem::path temporary_path = work_directory / (name + ".so");
+                    /*The compiler is run without a shell, so neither the paths nor the flags are interpreted by one. The flags are
+                    split on whitespace*/
+                    std::vector<std::string> arguments = {codegen_compiler};
+                    std::istringstream flag_stream(codegen_compiler_flags);
+                    for (std::string flag; flag_stream >> flag;)
+                        arguments.push_back(flag);
+                    arguments.insert(arguments.end(), {"-fPIC", "-shared", source_path.string(), "-o", temporary_path.string()});
+                    std::vector<char *> argv;
+                    for (std::string &argument : arguments)
+                        argv.push_back(argument.data());
+                    argv.push_back(nullptr);
+
+                    pid_t compiler_pid;
+                    int status = 0;
+                    if (posix_spawnp(&compiler_pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0 ||
+                        waitpid(compiler_pid, &status, 0) != compiler_pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                        throw std::runtime_error("Failed to compile the generated NLP functions with " + codegen_compiler);
+                    std::filesystem::rename(temporary_path, library_path);
+                }
+                catch (...)
+                {
+                    std::filesystem::remove_all(work_directory);
+                    throw;
+                }
+                std::filesystem::remove_all(work_directory);
+            }
+
+            return casadi::nlpsol("solver", nonlinear_solver_name, library_path.string(), all_opts);
+        }
+
+        template <class ProblemData, class MODE_T>
+        casadi::Function TrajectoryOpt<ProblemData, MODE_T>::getWarmStartSolver()
+        {
+            if (nonlinear_solver_name != "ipopt")
+                return solver;
+            if (warm_start_solver.is_null())
+            {
+                /*Keep the warm started iterate close to where it was handed over, instead of pushing it into the interior*/
+                casadi::Dict warm_start_opts = {{"ipopt.warm_start_init_point", "yes"},
+                                                {"ipopt.warm_start_bound_push", 1e-9},
+                                                {"ipopt.warm_start_bound_frac", 1e-9},
+                                                {"ipopt.warm_start_slack_bound_push", 1e-9},
+                                                {"ipopt.warm_start_slack_bound_frac", 1e-9},
+                                                {"ipopt.warm_start_mult_bound_push", 1e-9},
+                                                {"ipopt.mu_init", 1e-4}};
+                /*The options given by the user take precedence*/
+                casadi::Dict runtime_opts;
+                for (const auto &opt : warm_start_opts)
+                {
+                    if (current_solver_opts.find(opt.first) == current_solver_opts.end())
+                        runtime_opts[opt.first] = opt.second;
+                }
+                warm_start_solver = createSolver(current_nlp, current_solver_opts, runtime_opts);
+                auto it = nlp_cache.find(current_nlp_key);
+                if (it != nlp_cache.end())
+                    it->second.warm_start_solver = warm_start_solver;
+            }
+            return warm_start_solver;
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::createRealTimeIteration(const casadi::MXDict &nlp)
+        {
+            casadi::MX x = nlp.at("x");
+            casadi::MX f = nlp.at("f");
+            casadi::MX g = nlp.at("g");
+            casadi::MX p_nlp = nlp.at("p");
+            casadi::MX lam_g = casadi::MX::sym("lam_g", g.size1(), 1);
+
+            casadi::MX grad_f = gradient(f, x);
+            casadi::MX H = hessian(rti_exact_hessian ? f + dot(lam_g, g) : f, x);
+            H += rti_regularization * casadi::MX::eye(x.size1());
+            casadi::MX jac_g_x = jacobian(g, x);
+            /*The feedback phase corrects the constraints and the objective gradient to first order in the parameters. The initial
+            state enters the constraints linearly, so it is corrected exactly*/
+            casadi::MX jac_g_p = jacobian(g, p_nlp);
+            casadi::MX jac_grad_f_p = jacobian(grad_f, p_nlp);
+
+            rti_linearization = casadi::Function("rti_linearization", casadi::MXVector{x, p_nlp, lam_g},
+                                                 casadi::MXVector{f, grad_f, H, g, jac_g_x, jac_g_p, jac_grad_f_p});
+            casadi::SpDict qp = {{"h", H.sparsity()}, {"a", jac_g_x.sparsity()}};
+            rti_qp = casadi::conic("rti_qp", rti_qpsol, qp, rti_qpsol_opts);
+            rti_prepared = false;
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::prepareRealTimeIteration()
+        {
+            assert(rti && "Real-time iteration must be enabled before the finite elements are initialized");
+            auto start = std::chrono::steady_clock::now();
+            rti_p = getParameterValues();
+            casadi::DM lam_g = lam_g0.size() == lbg.size() ? casadi::DM(lam_g0) : casadi::DM::zeros(lbg.size(), 1);
+            rti_point = rti_linearization(casadi::DMVector{casadi::DM(w0), rti_p, lam_g});
+            rti_prepared = true;
+            rti_preparation_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        template <class ProblemData, class MODE_T>
+        SolveStats TrajectoryOpt<ProblemData, MODE_T>::feedbackRealTimeIteration()
+        {
+            auto start = std::chrono::steady_clock::now();
+            const casadi::DM &f = rti_point[0];
+            const casadi::DM &H = rti_point[2];
+            const casadi::DM &jac_g_x = rti_point[4];
+            casadi::DM dp = getParameterValues() - rti_p;
+            casadi::DM grad_f = rti_point[1] + mtimes(rti_point[6], dp);
+            casadi::DM g = rti_point[3] + mtimes(rti_point[5], dp);
+            casadi::DM w = casadi::DM(w0);
+
+            casadi::DMDict arg = {{"h", H},
+                                  {"g", grad_f},
+                                  {"a", jac_g_x},
+                                  {"lba", casadi::DM(lbg) - g},
+                                  {"uba", casadi::DM(ubg) - g},
+                                  {"lbx", casadi::DM(lbw) - w},
+                                  {"ubx", casadi::DM(ubw) - w}};
+            casadi::DMDict result = rti_qp(arg);
+            casadi::DM dw = result["x"];
+            w0 = (w + dw).get_elements();
+            lam_w0 = result["lam_x"].get_elements();
+            lam_g0 = result["lam_a"].get_elements();
+            has_multipliers = true;
+            /*The next feedback needs a linearization at the new iterate*/
+            rti_prepared = false;
+
+            SolveStats stats;
+            stats.phase_build_times = phase_build_times;
+            stats.graph_build_time = graph_build_time;
+            stats.solver_construction_time = solver_construction_time;
+            stats.segment_function_cache_hits = segment_function_cache_hits;
+            stats.compiled_library = compiled_library;
+            stats.iterations = 1;
+            casadi::Dict qp_stats = rti_qp.stats();
+            if (qp_stats.find("return_status") != qp_stats.end())
+                stats.return_status = qp_stats["return_status"].to_string();
+            if (qp_stats.find("success") != qp_stats.end())
+                stats.success = qp_stats["success"].to_bool();
+
+            std::vector<double> g_lin = (g + mtimes(jac_g_x, dw)).get_elements();
+            for (size_t i = 0; i < g_lin.size(); ++i)
+            {
+                stats.constraint_violation = std::max(stats.constraint_violation, std::max(lbg[i] - g_lin[i], g_lin[i] - ubg[i]));
+            }
+
+            storeSolution(casadi::DM(w0));
+            stats.t_preparation = rti_preparation_time;
+            stats.t_feedback = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.t_total = stats.t_preparation + stats.t_feedback;
+
+            if (telemetry)
+            {
+                IterationRecord record;
+                record.objective = double(f) + double(result["cost"]);
+                record.infeasibility = stats.constraint_violation;
+                record.x_norm = double(norm_2(casadi::DM(w0)));
+                record.x_min = w0.empty() ? 0.0 : *std::min_element(w0.begin(), w0.end());
+                record.x_max = w0.empty() ? 0.0 : *std::max_element(w0.begin(), w0.end());
+                telemetry->push(record);
+            }
+
+            solve_stats = stats;
+            return solve_stats;
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::advanceFiniteElements(double time_advance, casadi::DM X0, std::function<typename PhaseSequence<MODE_T>::Phase()> next_phase)
+        {
+            assert(!trajectory.empty() && "initFiniteElements must be called before advanceFiniteElements");
+            assert(X0.size1() == state_indices->nx && X0.size2() == 1 && "Initial state must be a column vector");
+            assert(time_advance >= 0 && "Can only advance forward in time");
+
+            /*The knots move with the horizon, so the initial guess follows the last solution in time rather than knot by knot.
+            It is taken before the segment times change*/
+            casadi::Function last_solution = lastSolutionGuess();
+
+            /*Small tolerance so that accumulated floating point error does not keep a consumed phase for a whole tick*/
+            const double eps = 1e-9;
+            typename PhaseSequence<MODE_T>::PHASE_SEQUENCE_ERROR error;
+            horizon_start_time += time_advance;
+            double horizon_end = horizon_start_time + horizon_duration;
+
+            size_t num_dropped_phases = 0;
+            while (num_dropped_phases < trajectory.size())
+            {
+                size_t phase_index = horizon_first_phase + num_dropped_phases;
+                double phase_start;
+                sequence->getTimeAtPhase(phase_index, phase_start, error);
+                if (phase_start + sequence->getPhase(phase_index).time_value > horizon_start_time + eps)
+                    break;
+                ++num_dropped_phases;
+            }
+
+            while (sequence->getDT() < horizon_end - eps)
+            {
+                sequence->appendPhase(next_phase());
+            }
+            size_t num_new_phases = 0;
+            for (size_t phase_index = horizon_first_phase + trajectory.size(); phase_index < size_t(sequence->getNumPhases()); ++phase_index)
+            {
+                double phase_start;
+                sequence->getTimeAtPhase(phase_index, phase_start, error);
+                if (phase_start >= horizon_end - eps)
+                    break;
+                ++num_new_phases;
+            }
+
+            initial_state_value = X0;
+            if (num_dropped_phases == 0 && num_new_phases == 0)
+            {
+                /*The NLP is unchanged, only the knot lengths, the times, and the bounds of the segments move with the horizon.
+                Each multiplier stays with its knot, which keeps its relative position in the part of its phase in the horizon*/
+                updateHorizonTimes();
+                fillBounds();
+                if (!last_solution.is_null())
+                    shiftInitialGuess(last_solution, trajectory.size());
+                rti_prepared = false;
+                return;
+            }
+
+            /*The multipliers of the segments that remain in the horizon are kept, so the ranges of their decision variables and
+            constraints in the last NLP are kept to copy them over. Their knots keep their count, so each multiplier stays with its knot*/
+            size_t num_retained = trajectory.size() - num_dropped_phases;
+            std::vector<double> last_w0 = w0;
+            std::vector<double> last_lam_w0 = lam_w0;
+            std::vector<double> last_lam_g0 = lam_g0;
+            std::vector<tuple_size_t> last_w_ranges;
+            std::vector<tuple_size_t> last_g_ranges;
+            std::vector<tuple_size_t> last_boundary_ranges;
+            for (size_t i = num_dropped_phases; i < trajectory.size(); ++i)
+            {
+                last_w_ranges.push_back(trajectory[i]->get_range_idx_decision_bounds());
+                last_g_ranges.push_back(trajectory[i]->get_range_idx_constraint_bounds());
+                /*The initial state constraint of the dropped phases becomes that of the next phase, so their continuity constraints are dropped instead*/
+                last_boundary_ranges.push_back(ranges_boundary_constraints[i == num_dropped_phases ? 0 : i]);
+            }
+            bool keep_multipliers = warm_start && has_multipliers;
+
+            trajectory.erase(trajectory.begin(), trajectory.begin() + num_dropped_phases);
+            constraint_datas_for_phase.erase(constraint_datas_for_phase.begin(), constraint_datas_for_phase.begin() + num_dropped_phases);
+            decision_datas_for_phase.erase(decision_datas_for_phase.begin(), decision_datas_for_phase.begin() + num_dropped_phases);
+            segment_keys_for_phase.erase(segment_keys_for_phase.begin(), segment_keys_for_phase.begin() + num_dropped_phases);
+            num_initialized_segments -= std::min(num_initialized_segments, num_dropped_phases);
+            horizon_first_phase += num_dropped_phases;
+
+            for (size_t k = 0; k < num_new_phases; ++k)
+            {
+                appendSegment(horizon_first_phase + trajectory.size());
+            }
+
+            /*The constraints of a new phase look back through the phases before it, so as many phases as the horizon holds are kept before it*/
+            if (horizon_first_phase > trajectory.size())
+            {
+                size_t num_history_dropped = horizon_first_phase - trajectory.size();
+                sequence->dropLeadingPhases(num_history_dropped);
+                horizon_first_phase -= num_history_dropped;
+            }
+
+            if (!restoreNLP(nlpKey(), num_retained))
+            {
+                /*The segments of a cached NLP belong to it, so the retained segments are rebuilt for the new NLP*/
+                if (nlp_cache.count(current_nlp_key))
+                {
+                    parallelFor(num_retained, [this](size_t i)
+                                { buildSegment(horizon_first_phase + i, i); });
+                    num_initialized_segments = 0;
+                }
+                stitchFiniteElements();
+            }
 
-            // callback.set_sparsity(vertcat(w).sparsity(), J.sparsity(), vertcat(g).sparsity(), vertcat(w).sparsity(), vertcat(g).sparsity(), casadi::Sparsity(0, 0));
+            auto copy_range = [](const std::vector<double> &from, const tuple_size_t &from_range, std::vector<double> &to, const tuple_size_t &to_range)
+            {
+                assert(std::get<1>(from_range) - std::get<0>(from_range) == std::get<1>(to_range) - std::get<0>(to_range) && "A retained segment must keep its size");
+                std::copy(from.begin() + std::get<0>(from_range), from.begin() + std::get<1>(from_range), to.begin() + std::get<0>(to_range));
+            };
+            if (!last_solution.is_null())
+                shiftInitialGuess(last_solution, num_retained);
+            for (size_t i = 0; i < num_retained; ++i)
+            {
+                if (last_solution.is_null())
+                    copy_range(last_w0, last_w_ranges[i], w0, trajectory[i]->get_range_idx_decision_bounds());
+                if (keep_multipliers)
+                {
+                    copy_range(last_lam_w0, last_w_ranges[i], lam_w0, trajectory[i]->get_range_idx_decision_bounds());
+                    copy_range(last_lam_g0, last_g_ranges[i], lam_g0, trajectory[i]->get_range_idx_constraint_bounds());
+                    copy_range(last_lam_g0, last_boundary_ranges[i], lam_g0, ranges_boundary_constraints[i]);
+                }
+            }
+        }
 
-            // opts["iteration_callback"] = callback;
-            // opts["iteration_callback_step"] = 1; // Call the callback function at every iteration
-            solver = casadi::nlpsol("solver", nonlinear_solver_name, nlp, opts);
+        template <class ProblemData, class MODE_T>
+        SolveStats TrajectoryOpt<ProblemData, MODE_T>::optimize()
+        {
+            if (rti)
+            {
+                if (!rti_prepared)
+                    prepareRealTimeIteration();
+                return feedbackRealTimeIteration();
+            }
 
-            double time_from_funcs = 0.0;
-            double time_just_solver = 0.0;
+            /*The solver may order the constraints differently, see solver_g_permutation*/
             casadi::DMDict arg;
-            arg["lbg"] = lbg;
-            arg["ubg"] = ubg;
+            arg["lbg"] = toSolverOrder(lbg);
+            arg["ubg"] = toSolverOrder(ubg);
             arg["lbx"] = lbw;
             arg["ubx"] = ubw;
             arg["x0"] = w0;
-            casadi::DMDict result = solver(arg);
+            arg["p"] = getParameterValues();
+            bool warm_started = warm_start && has_multipliers;
+            if (callback)
+                callback->beginSolve(toSolverOrder(lbg), toSolverOrder(ubg));
+            if (warm_started)
+            {
+                arg["lam_x0"] = lam_w0;
+                arg["lam_g0"] = toSolverOrder(lam_g0);
+            }
+            /*The warm start options of ipopt assume multipliers to start from, so the cold solves use the options as given*/
+            casadi::Function active_solver = warm_started ? getWarmStartSolver() : solver;
+            casadi::DMDict result = active_solver(arg);
             w0 = result["x"].get_elements();
-            casadi::Dict stats = solver.stats();
-            if (nonlinear_solver_name == "ipopt")
+            lam_w0 = result["lam_x"].get_elements();
+            lam_g0 = fromSolverOrder(result["lam_g"].get_elements());
+            has_multipliers = true;
+
+            SolveStats stats;
+            stats.phase_build_times = phase_build_times;
+            stats.graph_build_time = graph_build_time;
+            stats.solver_construction_time = solver_construction_time;
+            stats.segment_function_cache_hits = segment_function_cache_hits;
+            stats.compiled_library = compiled_library;
+
+            casadi::Dict solver_stats = active_solver.stats();
+            /*The plugins do not all report the same entries, so missing entries are left at zero*/
+            auto stat_time = [&solver_stats](const std::string &name)
             {
-                time_from_funcs += (double)stats["t_wall_nlp_jac_g"] + (double)stats["t_wall_nlp_grad_f"] + (double)stats["t_wall_nlp_g"] + (double)stats["t_wall_nlp_f"];
-                if (stats.find("t_wall_nlp_hess_l") != stats.end())
-                    time_from_funcs += (double)stats["t_wall_nlp_hess_l"];
-                time_just_solver += (double)stats["t_wall_total"] - time_from_funcs;
-                std::cout << "Total seconds from Casadi functions: " << time_from_funcs << std::endl;
-                std::cout << "Total seconds from Ipopt w/o function: " << time_just_solver << std::endl;
+                auto it = solver_stats.find("t_wall_" + name);
+                return it == solver_stats.end() ? 0.0 : (double)it->second;
+            };
+            stats.t_nlp_f = stat_time("nlp_f");
+            stats.t_nlp_g = stat_time("nlp_g");
+            stats.t_nlp_grad_f = stat_time("nlp_grad_f");
+            stats.t_nlp_jac_g = stat_time("nlp_jac_g");
+            stats.t_nlp_hess_l = stat_time("nlp_hess_l");
+            if (nonlinear_solver_name == "snopt")
+            {
+                /*snopt evaluates the objective gradient together with the objective, as the Jacobian of f*/
+                stats.t_nlp_grad_f += stat_time("nlp_jac_f") + stat_time("nlp_grad");
             }
-            else if (nonlinear_solver_name == "snopt")
+            stats.t_total = stat_time("total");
+            stats.t_solver = stats.t_total - (stats.t_nlp_f + stats.t_nlp_g + stats.t_nlp_grad_f + stats.t_nlp_jac_g + stats.t_nlp_hess_l);
+
+            if (solver_stats.find("iter_count") != solver_stats.end())
+                stats.iterations = (casadi_int)solver_stats["iter_count"];
+            if (solver_stats.find("return_status") != solver_stats.end())
+                stats.return_status = solver_stats["return_status"].to_string();
+            if (solver_stats.find("success") != solver_stats.end())
+                stats.success = solver_stats["success"].to_bool();
+
+            if (!warm_started)
             {
-                time_from_funcs += (double)stats["t_wall_nlp_grad"] + (double)stats["t_wall_nlp_jac_f"] + (double)stats["t_wall_nlp_jac_g"];
-                time_just_solver += (double)stats["t_wall_total"] - time_from_funcs;
-                std::cout << "Total seconds from Casadi functions: " << time_from_funcs << std::endl;
-                std::cout << "Total seconds from SNOPT w/o function: " << time_just_solver << std::endl;
+                cold_start_iterations = stats.iterations;
+                auto it = nlp_cache.find(current_nlp_key);
+                if (it != nlp_cache.end())
+                    it->second.cold_start_iterations = cold_start_iterations;
             }
-            auto full_sol = casadi::MX(result["x"]);
+            else if (cold_start_iterations >= 0)
+                stats.warm_start_iterations_saved = cold_start_iterations - stats.iterations;
 
-            for (size_t i = 0; i < trajectory.size(); ++i)
+            std::vector<double> g_sol = fromSolverOrder(result["g"].get_elements());
+            for (size_t i = 0; i < g_sol.size(); ++i)
             {
-                auto seg_sol = full_sol(casadi::Slice(0, casadi_int(std::get<1>(ranges_decision_variables[i]))));
-                auto sol_i = trajectory[i]->extractSolution(seg_sol);
-                if (i == 0)
-                    sol = sol_i;
-                else
+                stats.constraint_violation = std::max(stats.constraint_violation, std::max(lbg[i] - g_sol[i], g_sol[i] - ubg[i]));
+            }
+            solve_stats = stats;
+
+            storeSolution(result["x"]);
+            return solve_stats;
+        }
+
+        template <class ProblemData, class MODE_T>
+        SolveStats TrajectoryOpt<ProblemData, MODE_T>::optimizeWithMeshRefinement(const MeshRefinementOptions &options)
+        {
+            assert(horizon_start_time == 0.0 && horizon_first_phase == 0 && trajectory.size() == size_t(sequence->getNumPhases()) && "Mesh refinement must be done before the horizon is advanced");
+
+            SolveStats stats = optimize();
+            for (int iteration = 0; iteration < options.max_iterations; ++iteration)
+            {
+                std::vector<solution::solution_segment_data_t> solution_segments = getSolutionSegments();
+                mesh_errors.assign(trajectory.size(), std::vector<double>());
+                size_t first_refined = trajectory.size();
+                for (size_t i = 0; i < trajectory.size(); ++i)
                 {
-                    sol[0] = horzcat(sol[0], sol_i[0]);
-                    sol[1] = horzcat(sol[1], sol_i[1]);
+                    auto phase = sequence->getPhase(i);
+                    /*The accuracy of a multiple shooting phase is set by its integrator, not by the interpolation of its knots*/
+                    if (phase.transcription != TranscriptionMethod::PSEUDOSPECTRAL)
+                        continue;
+
+                    mesh_errors[i] = MeshRefinement::estimateKnotErrors(solution_segments[i], phase.phase_dynamics, gp_data->Fdiff, options.samples_per_interval);
+                    int knot_points = phase.knot_points;
+                    int phase_degree = phase.degree > 0 ? phase.degree : degree;
+                    if (MeshRefinement::refinePhase(mesh_errors[i], options, knot_points, phase_degree))
+                    {
+                        sequence->FillPhaseKnotPoints(i, knot_points);
+                        sequence->FillPhaseDegree(i, phase_degree);
+                        first_refined = std::min(first_refined, i);
+                    }
                 }
+                if (first_refined == trajectory.size())
+                    break;
+
+                /*The phases before the first refined phase keep their segments, and start from the last solution. The cached
+                NLPs share these segments, so they are dropped*/
+                for (size_t i = 0; i < first_refined; ++i)
+                {
+                    trajectory[i]->update_w0(w0);
+                }
+                nlp_cache.clear();
+                current_nlp_key = 0;
+                casadi::Function initial_guess = MeshRefinement::createInitialGuess(solution_segments, state_indices->nx, state_indices->nu);
+                parallelFor(trajectory.size() - first_refined, [this, first_refined](size_t k)
+                            { buildSegment(first_refined + k, first_refined + k); });
+                for (size_t i = first_refined; i < trajectory.size(); ++i)
+                {
+                    decision_datas_for_phase[i]->initial_guess = initial_guess;
+                }
+                num_initialized_segments = first_refined;
+                has_multipliers = false;
+                stitchFiniteElements();
+
+                stats = optimize();
+            }
+            return stats;
+        }
+
+        template <class ProblemData, class MODE_T>
+        void TrajectoryOpt<ProblemData, MODE_T>::storeSolution(const casadi::DM &x)
+        {
+            /*Each segment knows the range of its decision variables, so it reads its solution directly from the numeric result*/
+            casadi::DM x_dense = casadi::DM::densify(x);
+            const std::vector<double> &w_opt = x_dense.nonzeros();
+            solx_segments.resize(trajectory.size());
+            solu_segments.resize(trajectory.size());
+            for (size_t i = 0; i < trajectory.size(); ++i)
+            {
+                trajectory[i]->extractSolution(w_opt, solx_segments[i], solu_segments[i]);
             }
-            return sol;
         }
 
         template <class ProblemData, class MODE_T>
@@ -523,38 +2560,29 @@ namespace galileo
         template <class ProblemData, class MODE_T>
         std::vector<solution::solution_segment_data_t> TrajectoryOpt<ProblemData, MODE_T>::getSolutionSegments()
         {
+            assert(solx_segments.size() == trajectory.size() && "The solution must be stored after the segments change");
             std::vector<solution::solution_segment_data_t> result;
-            auto solx = sol[0];
-            auto solu = sol[1];
-            int state_count = 0;
-            int input_count = 0;
-            for (std::shared_ptr<Segment> seg : trajectory)
+            for (size_t i = 0; i < trajectory.size(); ++i)
             {
+                std::shared_ptr<Segment> seg = trajectory[i];
                 solution::solution_segment_data_t segment_data;
 
-                std::shared_ptr<PseudospectralSegment> pseg = std::dynamic_pointer_cast<PseudospectralSegment>(seg);
-
-                std::vector<double> state_times_vec = pseg->getSegmentTimes().get_elements();
-                std::vector<double> input_times_vec = pseg->getUSegmentTimes().get_elements();
+                std::vector<double> state_times_vec = seg->getSegmentTimes().get_elements();
+                std::vector<double> input_times_vec = seg->getUSegmentTimes().get_elements();
                 segment_data.state_times = Eigen::Map<Eigen::VectorXd>(state_times_vec.data(), state_times_vec.size());
                 segment_data.input_times = Eigen::Map<Eigen::VectorXd>(input_times_vec.data(), input_times_vec.size());
                 segment_data.initial_time = state_times_vec[0];
-                segment_data.end_time = state_times_vec[state_times_vec.size() - 1];
-
-                segment_data.state_degree = pseg->getStateDegree();
-                segment_data.input_degree = pseg->getInputDegree();
-                segment_data.num_knots = pseg->getKnotNum();
+                segment_data.end_time = state_times_vec[0] + seg->T;
 
-                std::vector<double> solx_vec = casadi::MX::evalf(solx(casadi::Slice(0, solx.rows()), casadi::Slice(state_count, state_count + (pseg->getStateDegree() + 1) * pseg->getKnotNum()))).get_elements();
-                std::vector<double> solu_vec = casadi::MX::evalf(solu(casadi::Slice(0, solu.rows()), casadi::Slice(input_count, input_count + (pseg->getInputDegree() + 1) * pseg->getKnotNum()))).get_elements();
-                segment_data.solx_segment = Eigen::Map<Eigen::MatrixXd>(solx_vec.data(), solx.rows(), solx.columns());
-                segment_data.solu_segment = Eigen::Map<Eigen::MatrixXd>(solu_vec.data(), solu.rows(), solu.columns());
+                segment_data.state_degree = seg->getStateDegree();
+                segment_data.input_degree = seg->getInputDegree();
+                segment_data.num_knots = seg->getKnotNum();
 
-                segment_data.state_poly = *(pseg->get_dXPoly());
-                segment_data.input_poly = *(pseg->get_UPoly());
+                segment_data.solx_segment = solx_segments[i];
+                segment_data.solu_segment = solu_segments[i];
 
-                state_count += (pseg->getStateDegree() + 1) * pseg->getKnotNum();
-                input_count += (pseg->getInputDegree() + 1) * pseg->getKnotNum();
+                segment_data.state_poly = *(seg->get_dXPoly());
+                segment_data.input_poly = *(seg->get_UPoly());
 
                 result.push_back(segment_data);
             }
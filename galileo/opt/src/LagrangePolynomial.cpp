@@ -4,8 +4,9 @@ namespace galileo
 {
     namespace opt
     {
-        LagrangePolynomial::LagrangePolynomial(int d_, const std::string &scheme)
+        LagrangePolynomial::LagrangePolynomial(int d_, const std::string &scheme_)
         {
+            scheme = scheme_;
             if (d_ == 0)
             {
                 piecewise_constant = true;
@@ -60,6 +61,31 @@ namespace galileo
                 casadi::Polynomial pint = p.anti_derivative();
                 B[j] = pint(1.0);
             }
+
+            differentiation_matrix = Eigen::MatrixXd::Zero(d + 1, d + 1);
+            if (!piecewise_constant)
+            {
+                for (int j = 0; j < d + 1; ++j)
+                {
+                    for (int r = 0; r < d + 1; ++r)
+                        differentiation_matrix(j, r) = C[j][r];
+                }
+            }
+
+            monomial_matrix = Eigen::MatrixXd::Zero(d + 1, d + 1);
+            if (piecewise_constant)
+                monomial_matrix(0, 0) = 1.0;
+            else
+            {
+                /*The values at the roots are the Vandermonde matrix times the coefficients, so the basis polynomials are the columns of its inverse*/
+                Eigen::MatrixXd vandermonde(d + 1, d + 1);
+                for (int r = 0; r < d + 1; ++r)
+                {
+                    for (int m = 0; m < d + 1; ++m)
+                        vandermonde(r, m) = std::pow(tau_root[r], m);
+                }
+                monomial_matrix = vandermonde.inverse().transpose();
+            }
         }
 
         template <typename Scalar>
@@ -97,32 +123,62 @@ namespace galileo
         Eigen::VectorXd LagrangePolynomial::barycentricInterpolation(double t, const Eigen::MatrixXd &terms) const
         {
             assert(terms.cols() == tau_root.size());
+            Eigen::VectorXd weights;
+            interpolationWeights(t, weights);
+            return terms * weights;
+        }
+
+        void LagrangePolynomial::interpolationWeights(double t, Eigen::VectorXd &weights) const
+        {
+            /*Does not allocate if the weights already have the right size*/
+            weights.resize(tau_root.size());
+            basisWeights(t, weights);
+        }
+
+        void LagrangePolynomial::interpolationWeights(double t, int derivative_order, Eigen::Ref<Eigen::MatrixXd> weights) const
+        {
+            assert(derivative_order >= 0);
+            assert(weights.rows() == Eigen::Index(tau_root.size()) && weights.cols() == derivative_order + 1);
+            basisWeights(t, weights.col(0));
+            /*The derivative of the interpolant is the interpolant of its derivatives at the roots, which is exact since it has a lower degree*/
+            for (int k = 1; k <= derivative_order; ++k)
+            {
+                weights.col(k).noalias() = differentiation_matrix * weights.col(k - 1);
+            }
+        }
+
+        void LagrangePolynomial::basisWeights(double t, Eigen::Ref<Eigen::VectorXd> weights) const
+        {
             assert(t >= -1e-8 && t <= 1. + 1e-8);
+            weights.setZero();
             if (piecewise_constant)
             {
-                return terms.col(0);
+                weights(0) = 1.0;
+                return;
             }
 
-            // Compute the interpolated value
-            Eigen::VectorXd numerator = Eigen::VectorXd::Zero(terms.rows());
-            Eigen::VectorXd denominator = Eigen::VectorXd::Zero(terms.rows());
-            double interpolant;
             for (std::size_t i = 0; i < tau_root.size(); ++i)
             {
                 if (std::abs(t - tau_root[i]) < 1e-6)
                 {
-                    return terms.col(i);
+                    weights(i) = 1.0;
+                    return;
                 }
-                interpolant = barycentric_weights[i] / (t - tau_root[i]);
-                numerator += interpolant * terms.col(i);
-                denominator += Eigen::VectorXd::Constant(terms.rows(), interpolant);
             }
 
-            if ((denominator.array() == 0).any())
+            /*The denominator of the barycentric formula is the same for every row of the terms*/
+            double denominator = 0.0;
+            for (std::size_t i = 0; i < tau_root.size(); ++i)
+            {
+                weights(i) = barycentric_weights[i] / (t - tau_root[i]);
+                denominator += weights(i);
+            }
+
+            if (denominator == 0)
             {
                 throw std::runtime_error("Error: Division by zero in barycentricInterpolation");
             }
-            return numerator.array() / denominator.array();
+            weights /= denominator;
         }
     }
 }
\ No newline at end of file
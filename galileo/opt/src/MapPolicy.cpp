@@ -0,0 +1,65 @@
+#include "galileo/opt/MapPolicy.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace galileo
+{
+    namespace opt
+    {
+        casadi::Function MapPolicy::map(const casadi::Function &f, casadi_int n) const
+        {
+            if (parallelization == MapParallelization::SERIAL || n < min_batch_size)
+                return cachedMap(f, n, MapParallelization::SERIAL, 1);
+
+            if (parallelization == MapParallelization::THREAD)
+            {
+                casadi_int workers = max_workers > 0 ? max_workers : casadi_int(std::max(std::thread::hardware_concurrency(), 1u));
+                return cachedMap(f, n, MapParallelization::THREAD, std::min(workers, n));
+            }
+            return cachedMap(f, n, MapParallelization::OPENMP, 1);
+        }
+
+        casadi::Function MapPolicy::serialMap(const casadi::Function &f, casadi_int n) const
+        {
+            return cachedMap(f, n, MapParallelization::SERIAL, 1);
+        }
+
+        casadi::Function MapPolicy::cachedMap(const casadi::Function &f, casadi_int n, MapParallelization mode, casadi_int workers) const
+        {
+            std::lock_guard<std::mutex> lock(map_cache->mutex);
+            auto key = std::make_tuple(static_cast<const void *>(f.get()), n, mode, workers);
+            auto it = map_cache->entries.find(key);
+            if (it == map_cache->entries.end())
+            {
+                while (!map_cache->entries.empty() && map_cache->entries.size() >= std::max(map_cache_capacity, size_t(1)))
+                {
+                    auto least_recent = std::min_element(map_cache->entries.begin(), map_cache->entries.end(), [](const auto &a, const auto &b)
+                                                         { return a.second.last_use < b.second.last_use; });
+                    map_cache->entries.erase(least_recent);
+                }
+                map_cache_entry_t entry;
+                entry.f = f;
+                if (mode == MapParallelization::THREAD)
+                    entry.mapped = f.map(n, "thread", workers);
+                else
+                    entry.mapped = f.map(n, mode == MapParallelization::OPENMP ? "openmp" : "serial");
+                it = map_cache->entries.emplace(key, entry).first;
+            }
+            it->second.last_use = ++map_cache->uses;
+            return it->second.mapped;
+        }
+
+        MapParallelization MapPolicy::parallelizationFromString(const std::string &name)
+        {
+            if (name == "serial")
+                return MapParallelization::SERIAL;
+            if (name == "openmp")
+                return MapParallelization::OPENMP;
+            if (name == "thread")
+                return MapParallelization::THREAD;
+            throw std::invalid_argument("Unknown map parallelization: " + name);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#include "galileo/opt/MeshRefinement.h"
+
+#include <algorithm>
+
+namespace galileo
+{
+    namespace opt
+    {
+        std::vector<double> MeshRefinement::estimateKnotErrors(const solution::solution_segment_data_t &segment, casadi::Function F, casadi::Function Fdiff, int samples_per_interval)
+        {
+            solution::Solution solution;
+            solution.UpdateSolution({segment});
+
+            int nodes_per_knot = segment.state_degree + 1;
+            std::vector<double> knot_lengths(segment.num_knots, 0.0);
+            /*Each sample is queried at t - delta, t, and t + delta, so the state derivative can be taken by central differences*/
+            std::vector<double> query_times;
+            std::vector<double> sample_steps;
+            std::vector<int> sample_knots;
+            for (int k = 0; k < segment.num_knots; ++k)
+            {
+                std::vector<double> nodes(segment.state_times.data() + k * nodes_per_knot, segment.state_times.data() + (k + 1) * nodes_per_knot);
+                double knot_end = (k + 1 < segment.num_knots) ? segment.state_times(nodes_per_knot * (k + 1)) : segment.end_time;
+                if (nodes.back() < knot_end)
+                    nodes.push_back(knot_end);
+                knot_lengths[k] = knot_end - nodes.front();
+                double delta = 1e-4 * knot_lengths[k];
+
+                for (size_t j = 0; j + 1 < nodes.size(); ++j)
+                {
+                    for (int s = 0; s < samples_per_interval; ++s)
+                    {
+                        double t = nodes[j] + (s + 0.5) / samples_per_interval * (nodes[j + 1] - nodes[j]);
+                        query_times.insert(query_times.end(), {t - delta, t, t + delta});
+                        sample_steps.push_back(2 * delta);
+                        sample_knots.push_back(k);
+                    }
+                }
+            }
+
+            std::vector<double> knot_errors(segment.num_knots, 0.0);
+            casadi_int num_samples = sample_knots.size();
+            if (num_samples == 0)
+                return knot_errors;
+
+            Eigen::VectorXd query = Eigen::Map<Eigen::VectorXd>(query_times.data(), query_times.size());
+            Eigen::MatrixXd state_result(segment.solx_segment.rows(), query.size());
+            Eigen::MatrixXd input_result(segment.solu_segment.rows(), query.size());
+            solution.GetSolution(query, state_result, input_result);
+
+            casadi::DM states;
+            casadi::DM inputs;
+            tools::eigenToCasadi(state_result, states);
+            tools::eigenToCasadi(input_result, inputs);
+
+            casadi::Slice all;
+            casadi::DM x_before = states(all, casadi::Slice(0, 3 * num_samples, 3));
+            casadi::DM x_mid = states(all, casadi::Slice(1, 3 * num_samples, 3));
+            casadi::DM x_after = states(all, casadi::Slice(2, 3 * num_samples, 3));
+            casadi::DM u_mid = inputs(all, casadi::Slice(1, 3 * num_samples, 3));
+            casadi::DM steps = casadi::DM(sample_steps).T();
+
+            casadi::DM dx_polynomial = Fdiff.map(num_samples, "serial")(casadi::DMVector{x_before, x_after, steps}).at(0);
+            casadi::DM dx_dynamics = F.map(num_samples, "serial")(casadi::DMVector{x_mid, u_mid}).at(0);
+
+            Eigen::MatrixXd defect;
+            tools::casadiToEigen(dx_polynomial - dx_dynamics, defect);
+            for (casadi_int s = 0; s < num_samples; ++s)
+            {
+                int k = sample_knots[s];
+                knot_errors[k] = std::max(knot_errors[k], defect.col(s).lpNorm<Eigen::Infinity>() * knot_lengths[k]);
+            }
+            return knot_errors;
+        }
+
+        bool MeshRefinement::refinePhase(const std::vector<double> &knot_errors, const MeshRefinementOptions &options, int &knot_points, int &degree)
+        {
+            int num_above_tolerance = std::count_if(knot_errors.begin(), knot_errors.end(), [&options](double error)
+                                                    { return error > options.tolerance; });
+            if (num_above_tolerance == 0)
+                return false;
+
+            bool error_is_spread = 2 * num_above_tolerance > int(knot_errors.size());
+            if (degree < options.max_degree && (error_is_spread || knot_points >= options.max_knot_points))
+            {
+                ++degree;
+                return true;
+            }
+
+            int refined_knot_points = std::min(knot_points + num_above_tolerance, options.max_knot_points);
+            if (refined_knot_points <= knot_points)
+                return false;
+            knot_points = refined_knot_points;
+            return true;
+        }
+
+        casadi::Function MeshRefinement::createInitialGuess(const std::vector<solution::solution_segment_data_t> &solution_segments, casadi_int nx, casadi_int nu)
+        {
+            std::vector<double> grid;
+            for (const solution::solution_segment_data_t &segment : solution_segments)
+            {
+                grid.insert(grid.end(), segment.state_times.data(), segment.state_times.data() + segment.state_times.size());
+                grid.insert(grid.end(), segment.input_times.data(), segment.input_times.data() + segment.input_times.size());
+            }
+            std::sort(grid.begin(), grid.end());
+            /*The interpolation grid must be strictly increasing, and the segments share their boundary times*/
+            grid.erase(std::unique(grid.begin(), grid.end(), [](double a, double b)
+                                   { return b - a < 1e-12; }),
+                       grid.end());
+
+            solution::Solution solution;
+            solution.UpdateSolution(solution_segments);
+            Eigen::VectorXd query = Eigen::Map<Eigen::VectorXd>(grid.data(), grid.size());
+            Eigen::MatrixXd state_result(nx, query.size());
+            Eigen::MatrixXd input_result(nu, query.size());
+            solution.GetSolution(query, state_result, input_result);
+
+            /*CasADi expects the values with the output dimension changing fastest, which is the column-major layout of the results*/
+            std::vector<double> state_values(state_result.data(), state_result.data() + state_result.size());
+            std::vector<double> input_values(input_result.data(), input_result.data() + input_result.size());
+            casadi::Function x_interpolant = casadi::interpolant("x_interpolant", "linear", {grid}, state_values);
+            casadi::Function u_interpolant = casadi::interpolant("u_interpolant", "linear", {grid}, input_values);
+
+            casadi::MX t = casadi::MX::sym("t");
+            return casadi::Function("MeshRefinementInitialGuess", casadi::MXVector{t},
+                                    casadi::MXVector{x_interpolant(casadi::MXVector{t}).at(0), u_interpolant(casadi::MXVector{t}).at(0)});
+        }
+    }
+}
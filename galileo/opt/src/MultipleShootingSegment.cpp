@@ -0,0 +1,555 @@
+#include "galileo/opt/MultipleShootingSegment.h"
+
+#include <numeric>
+
+namespace galileo
+{
+    namespace opt
+    {
+        MultipleShootingSegment::MultipleShootingSegment(std::shared_ptr<GeneralProblemData> problem, casadi::Function F_, casadi::Function L_, std::shared_ptr<States> st_m_, int knot_num_, double h_, int steps_per_knot_, bool stage_wise_ordering_)
+        {
+            auto Fint_ = problem->Fint;
+            auto Fdiff_ = problem->Fdiff;
+
+            assert(h_ > 0 && "h must be a positive duration");
+            assert(steps_per_knot_ > 0 && "There must be at least one integration step per knot segment");
+
+            assert(F_.n_in() == 2 && "F must have 2 inputs");
+            assert(F_.n_out() == 1 && "F must have 1 output");
+            assert(Fint_.n_in() == 3 && "Fint must have 3 inputs");
+            assert(Fint_.n_out() == 1 && "Fint must have 1 output");
+            assert(Fdiff_.n_in() == 3 && "Fdiff must have 3 inputs");
+            assert(Fdiff_.n_out() == 1 && "Fdiff must have 1 output");
+            assert(L_.n_in() == (problem->np > 0 ? 3 : 2) && "L must have 2 inputs, or 3 inputs if there are problem parameters");
+            assert(L_.n_out() == 1 && "L must have 1 output");
+
+            F_.assert_size_in(0, st_m_->nx, 1);
+            F_.assert_size_in(1, st_m_->nu, 1);
+            F_.assert_size_out(0, st_m_->ndx, 1);
+
+            L_.assert_size_in(0, st_m_->nx, 1);
+            L_.assert_size_in(1, st_m_->nu, 1);
+            if (problem->np > 0)
+                L_.assert_size_in(2, problem->np, 1);
+            L_.assert_size_out(0, 1, 1);
+
+            Fint_.assert_size_in(0, st_m_->nx, 1);
+            Fint_.assert_size_in(1, st_m_->ndx, 1);
+            Fint_.assert_size_in(2, 1, 1);
+            Fint_.assert_size_out(0, st_m_->nx, 1);
+
+            Fdiff_.assert_size_in(0, st_m_->nx, 1);
+            Fdiff_.assert_size_in(1, st_m_->nx, 1);
+            Fdiff_.assert_size_in(2, 1, 1);
+            Fdiff_.assert_size_out(0, st_m_->ndx, 1);
+
+            this->knot_num = knot_num_;
+            this->h = h_;
+            this->st_m = st_m_;
+            this->Fint = Fint_;
+            this->Fdiff = Fdiff_;
+            this->F = F_;
+            this->L = L_;
+            this->T = (knot_num)*h;
+            this->steps_per_knot = steps_per_knot_;
+            this->stage_wise_ordering = stage_wise_ordering_;
+            this->P = casadi::SX::sym("P", problem->np, 1);
+            this->H = casadi::SX::sym("h", 1, 1);
+
+            /*The radau polynomial of degree 1 has its roots at both ends of the knot segment, so the state is interpolated linearly between the knots*/
+            dX_poly = LagrangePolynomial(1, "radau");
+            U_poly = LagrangePolynomial(0);
+        }
+
+        void MultipleShootingSegment::initializeSegmentTimeVector(casadi::DM &global_times)
+        {
+            std::vector<double> vec_knot_times;
+            std::vector<double> vec_segment_times;
+            for (int k = 0; k < knot_num; ++k)
+            {
+                vec_knot_times.push_back(k * h);
+                vec_segment_times.push_back(k * h);
+                vec_segment_times.push_back((k + 1) * h);
+            }
+            vec_knot_times.push_back(T);
+
+            tools::vectorToCasadi<casadi::DM>(vec_segment_times, 2 * knot_num, 1, segment_times);
+            tools::vectorToCasadi<casadi::DM>(vec_knot_times, knot_num + 1, 1, knot_times);
+
+            double start_time = 0.0;
+            if (global_times.is_empty() == false)
+            {
+                start_time = global_times(global_times.size1() - 1, 0).get_elements()[0];
+                segment_times += start_time;
+                global_times = vertcat(global_times, segment_times);
+            }
+            else
+            {
+                global_times = segment_times;
+            }
+            knot_times += start_time;
+        }
+
+        void MultipleShootingSegment::initializeInputTimeVector(casadi::DM &global_times)
+        {
+            /*The input of each knot segment is applied from its start*/
+            u_knot_times = knot_times(casadi::Slice(0, knot_num));
+        }
+
+        void MultipleShootingSegment::initializeKnotSegments(casadi::DM x0_global_, casadi::MX x0_local_, casadi::MX parameters_, casadi::MX knot_length_)
+        {
+            x0_global = x0_global_;
+            x0_local = x0_local_;
+            parameters = parameters_;
+            knot_length = knot_length_;
+            assert(x0_local.size1() == st_m->nx && x0_local.size2() == 1 && "x0 must be a column std::vector of size nx");
+            assert(parameters.size1() == P.size1() && parameters.size2() == 1 && "parameters must be a column std::vector of size np");
+            assert(knot_length.size1() == 1 && knot_length.size2() == 1 && "knot_length must be a scalar");
+
+            dX0_var_vec.clear();
+            X0_var_vec.clear();
+            U0_var_vec.clear();
+            for (int k = 0; k < knot_num; ++k)
+            {
+                U0_var_vec.push_back(casadi::MX::sym("U0_" + std::to_string(k), st_m->nu, 1));
+            }
+
+            /*We do knot_num + 1 so we have a decision variable for the final state*/
+            for (int k = 0; k < knot_num + 1; ++k)
+            {
+                dX0_var_vec.push_back(casadi::MX::sym("dX0_" + std::to_string(k), st_m->ndx, 1));
+                X0_var_vec.push_back(Fint(casadi::MXVector{x0_global_, dX0_var_vec[k], 1.0}).at(0));
+            }
+        }
+
+        void MultipleShootingSegment::buildKnotFunctions(const std::vector<ConstraintData> &G)
+        {
+            casadi::SX X0 = casadi::SX::sym("X0", st_m->nx, 1);
+            casadi::SX dX0 = casadi::SX::sym("dX0", st_m->ndx, 1);
+            casadi::SX U0 = casadi::SX::sym("U0", st_m->nu, 1);
+            casadi::SX Lc = casadi::SX::sym("Lc", 1, 1);
+
+            auto cost = [this](const casadi::SX &x, const casadi::SX &u)
+            {
+                return (P.is_empty() ? L(casadi::SXVector{x, u}) : L(casadi::SXVector{x, u, P})).at(0);
+            };
+
+            /*Runge-Kutta 4 steps. The stages are taken in the tangent space of the current state, so states on a manifold stay on it*/
+            casadi::SX dt = H / steps_per_knot;
+            casadi::SX x = X0;
+            /*State deviant at the end of the knot segment. The increments are accumulated like the collocation increments of a PseudospectralSegment*/
+            casadi::SX dXf = dX0;
+            /*Cost at the end of the knot segment*/
+            casadi::SX Qf = 0;
+            for (int s = 0; s < steps_per_knot; ++s)
+            {
+                casadi::SX k1 = F(casadi::SXVector{x, U0}).at(0);
+                casadi::SX x2 = Fint(casadi::SXVector{x, k1, dt / 2}).at(0);
+                casadi::SX k2 = F(casadi::SXVector{x2, U0}).at(0);
+                casadi::SX x3 = Fint(casadi::SXVector{x, k2, dt / 2}).at(0);
+                casadi::SX k3 = F(casadi::SXVector{x3, U0}).at(0);
+                casadi::SX x4 = Fint(casadi::SXVector{x, k3, dt}).at(0);
+                casadi::SX k4 = F(casadi::SXVector{x4, U0}).at(0);
+
+                casadi::SX dx = (k1 + 2 * k2 + 2 * k3 + k4) / 6;
+                Qf += dt / 6 * (cost(x, U0) + 2 * cost(x2, U0) + 2 * cost(x3, U0) + cost(x4, U0));
+                x = Fint(casadi::SXVector{x, dx, dt}).at(0);
+                dXf += dt * dx;
+            }
+
+            /*The knot length is an input, so the functions do not change when the segment is stretched*/
+            casadi::SXVector function_inputs = {X0, dX0, U0, H};
+
+            shooting_constraint = casadi::Function("fms",
+                                                   function_inputs,
+                                                   casadi::SXVector{dXf});
+
+            q_cost = casadi::Function("fxq", casadi::SXVector{Lc, X0, dX0, U0, H, P},
+                                      casadi::SXVector{Lc + Qf});
+
+            general_constraints.clear();
+            for (size_t i = 0; i < G.size(); ++i)
+            {
+                const ConstraintData &g_data = G[i];
+
+                assert(g_data.G.n_in() == 2 && "G must have 2 inputs");
+                g_data.G.assert_size_in(0, st_m->nx, 1);
+                g_data.G.assert_size_in(1, st_m->nu, 1);
+                assert(g_data.lower_bound.n_in() == 1 && "G lower_bound must have 1 inputs");
+                assert(g_data.lower_bound.n_out() == 1 && "G lower_bound must have 1 output");
+                g_data.lower_bound.assert_size_in(0, 1, 1);
+                casadi::Function tmap = casadi::Function(g_data.G.name() + "_knot",
+                                                         function_inputs,
+                                                         g_data.G(casadi::SXVector{X0, U0}));
+                general_constraints.push_back(tmap);
+            }
+        }
+
+        std::vector<casadi::Function> MultipleShootingSegment::getKnotFunctions() const
+        {
+            if (shooting_constraint.is_null())
+                return {};
+            std::vector<casadi::Function> knot_functions = {shooting_constraint, q_cost};
+            knot_functions.insert(knot_functions.end(), general_constraints.begin(), general_constraints.end());
+            return knot_functions;
+        }
+
+        void MultipleShootingSegment::initializeExpressionGraph(std::vector<ConstraintData> G, std::shared_ptr<DecisionData> Wdata)
+        {
+            if (reused_knot_functions.empty())
+            {
+                buildKnotFunctions(G);
+            }
+            else
+            {
+                assert(reused_knot_functions.size() == 2 + G.size() && "The reused functions must come from a segment with the same constraints");
+                shooting_constraint = reused_knot_functions[0];
+                q_cost = reused_knot_functions[1];
+                general_constraints.assign(reused_knot_functions.begin() + 2, reused_knot_functions.end());
+            }
+
+            initializeFunctionMaps();
+            initializeOrdering();
+            updateBounds(G, Wdata);
+            updateInitialGuess(Wdata);
+
+            lam_w0 = casadi::DM::zeros(general_lbw.size1(), 1);
+            lam_g0 = casadi::DM::zeros(general_lbg.size1(), 1);
+        }
+
+        void MultipleShootingSegment::updateBounds(const std::vector<ConstraintData> &G, std::shared_ptr<DecisionData> Wdata)
+        {
+            assert(G.size() == general_constraints.size() && "The constraints must be the ones the expression graph was built with");
+            casadi_int N = knot_num * shooting_constraint.size1_out(0) * shooting_constraint.size2_out(0);
+            casadi_int tmp = N;
+
+            std::vector<tuple_size_t> ranges_G;
+            for (const casadi::Function &general_constraint : general_constraints)
+            {
+                ranges_G.push_back(tuple_size_t(N, N + knot_num * general_constraint.size1_out(0) * general_constraint.size2_out(0)));
+                N += knot_num * general_constraint.size1_out(0) * general_constraint.size2_out(0);
+            }
+
+            general_lbg.resize(N, 1);
+            general_ubg.resize(N, 1);
+            general_lbg(casadi::Slice(0, tmp)) = casadi::DM::zeros(tmp, 1);
+            general_ubg(casadi::Slice(0, tmp)) = casadi::DM::zeros(tmp, 1);
+
+            for (std::size_t i = 0; i < G.size(); ++i)
+            {
+                ConstraintData g_data = G[i];
+                casadi_int range_size = std::get<1>(ranges_G[i]) - std::get<0>(ranges_G[i]);
+                general_lbg(casadi::Slice(casadi_int(std::get<0>(ranges_G[i])), casadi_int(std::get<1>(ranges_G[i]))), 0) =
+                    casadi::DM::reshape(vertcat(map_policy.serialMap(g_data.lower_bound, knot_num)(u_knot_times)), range_size, 1);
+                general_ubg(casadi::Slice(casadi_int(std::get<0>(ranges_G[i])), casadi_int(std::get<1>(ranges_G[i]))), 0) =
+                    casadi::DM::reshape(vertcat(map_policy.serialMap(g_data.upper_bound, knot_num)(u_knot_times)), range_size, 1);
+            }
+
+            int Ndx = st_m->ndx * (knot_num + 1);
+            int Nu = st_m->nu * knot_num;
+            general_lbw = -casadi::DM::inf(Ndx + Nu, 1);
+            general_ubw = casadi::DM::inf(Ndx + Nu, 1);
+
+            if (!Wdata->lower_bound.is_null() && !Wdata->upper_bound.is_null())
+            {
+                general_lbw(casadi::Slice(0, Ndx)) = casadi::DM::reshape(map_policy.serialMap(Wdata->lower_bound, knot_num + 1)(knot_times).at(0), Ndx, 1);
+                general_ubw(casadi::Slice(0, Ndx)) = casadi::DM::reshape(map_policy.serialMap(Wdata->upper_bound, knot_num + 1)(knot_times).at(0), Ndx, 1);
+                general_lbw(casadi::Slice(Ndx, Ndx + Nu)) = casadi::DM::reshape(map_policy.serialMap(Wdata->lower_bound, knot_num)(u_knot_times).at(1), Nu, 1);
+                general_ubw(casadi::Slice(Ndx, Ndx + Nu)) = casadi::DM::reshape(map_policy.serialMap(Wdata->upper_bound, knot_num)(u_knot_times).at(1), Nu, 1);
+            }
+        }
+
+        void MultipleShootingSegment::updateInitialGuess(std::shared_ptr<DecisionData> Wdata)
+        {
+            int Ndx = st_m->ndx * (knot_num + 1);
+            int Nu = st_m->nu * knot_num;
+            w0 = casadi::DM::zeros(Ndx + Nu, 1);
+
+            if (!Wdata->initial_guess.is_null())
+            {
+                /*Transform initial guess for x to an initial guess for dx, using f_diff, the inverse of f_int*/
+                casadi::DM xg = map_policy.serialMap(Wdata->initial_guess, knot_num + 1)(knot_times).at(0);
+                w0(casadi::Slice(0, Ndx)) = casadi::DM::reshape(map_policy.serialMap(Fdiff, knot_num + 1)(casadi::DMVector{x0_global, xg, 1.0}).at(0), Ndx, 1);
+                w0(casadi::Slice(Ndx, Ndx + Nu)) = casadi::DM::reshape(map_policy.serialMap(Wdata->initial_guess, knot_num)(u_knot_times).at(1), Nu, 1);
+            }
+        }
+
+        void MultipleShootingSegment::initializeFunctionMaps()
+        {
+            shooting_constraint_map = map_policy.map(shooting_constraint, knot_num);
+            if (map_reduce_cost)
+                q_cost_map = map_policy.map(q_cost, knot_num);
+            else
+                q_cost_fold = q_cost.fold(knot_num);
+
+            general_constraint_maps.clear();
+            for (const casadi::Function &general_constraint : general_constraints)
+            {
+                general_constraint_maps.push_back(map_policy.map(general_constraint, knot_num));
+            }
+
+            /*The extraction is built once, from w in storage order to the states and inputs of the solution. It is numeric, so
+            its map is serial. Each knot segment of the solution holds the states at both of its ends, and its constant input twice*/
+            casadi_int Ndx = st_m->ndx * (knot_num + 1);
+            casadi::MX x0_sym = casadi::MX::sym("x0", st_m->nx);
+            casadi::MX w_sym = casadi::MX::sym("w", Ndx + st_m->nu * knot_num);
+            casadi::MX h_sym = casadi::MX::sym("h");
+            casadi::MX dxs = casadi::MX::reshape(w_sym(casadi::Slice(0, Ndx)), st_m->ndx, knot_num + 1);
+            casadi::MX us = casadi::MX::reshape(w_sym(casadi::Slice(Ndx, Ndx + st_m->nu * knot_num)), st_m->nu, knot_num);
+            casadi::MX xs = map_policy.serialMap(Fint, knot_num + 1)(casadi::MXVector{x0_sym, dxs, 1.0}).at(0);
+            casadi::MX solx = casadi::MX::reshape(vertcat(xs(casadi::Slice(), casadi::Slice(0, knot_num)), xs(casadi::Slice(), casadi::Slice(1, knot_num + 1))), st_m->nx, 2 * knot_num);
+            casadi::MX solu = casadi::MX::reshape(vertcat(us, us), st_m->nu, 2 * knot_num);
+            initializeExtraction(casadi::Function("extraction", casadi::MXVector{x0_sym, w_sym, h_sym},
+                                                 casadi::MXVector{casadi::MX::densify(solx), casadi::MX::densify(solu)}));
+        }
+
+        std::vector<std::tuple<casadi_int, casadi_int>> MultipleShootingSegment::decisionVariableRegions() const
+        {
+            /*Decision variables are stored as [dX0, U0], each of which is contiguous per knot*/
+            return {std::make_tuple(knot_num + 1, casadi_int(st_m->ndx)),
+                    std::make_tuple(knot_num, casadi_int(st_m->nu))};
+        }
+
+        std::vector<std::tuple<casadi_int, casadi_int>> MultipleShootingSegment::constraintRegions() const
+        {
+            /*Constraints are stored as [shooting, general constraints...], each of which is contiguous per knot*/
+            std::vector<std::tuple<casadi_int, casadi_int>> g_regions = {std::make_tuple(knot_num, shooting_constraint.size1_out(0) * shooting_constraint.size2_out(0))};
+            for (const casadi::Function &general_constraint : general_constraints)
+            {
+                g_regions.push_back(std::make_tuple(knot_num, general_constraint.size1_out(0) * general_constraint.size2_out(0)));
+            }
+            return g_regions;
+        }
+
+        void MultipleShootingSegment::initializeOrdering()
+        {
+            w_permutation.clear();
+            g_permutation.clear();
+            if (!stage_wise_ordering)
+                return;
+
+            /*Each stage holds [dX0_k, U0_k], the last stage only the final knot [dX0_K]*/
+            w_permutation = stageWisePermutation(decisionVariableRegions(), {0, 1});
+            std::vector<std::tuple<casadi_int, casadi_int>> g_regions = constraintRegions();
+            std::vector<size_t> g_stage_order(g_regions.size());
+            std::iota(g_stage_order.begin(), g_stage_order.end(), 0);
+            g_permutation = stageWisePermutation(g_regions, g_stage_order);
+        }
+
+        void MultipleShootingSegment::evaluateExpressionGraph(casadi::MX &J0, casadi::MXVector &w, casadi::MXVector &g)
+        {
+            assert(J0.size1() == 1 && J0.size2() == 1 && "J0 must be a scalar");
+
+            casadi::MXVector result;
+
+            casadi::MXVector x_start(X0_var_vec.begin(), X0_var_vec.end() - 1);
+            casadi::MXVector dx_start(dX0_var_vec.begin(), dX0_var_vec.end() - 1);
+            casadi::MXVector dx_end(dX0_var_vec.begin() + 1, dX0_var_vec.end());
+            casadi::MX xs = horzcat(x_start);
+            casadi::MX dxs = horzcat(dx_start);
+            casadi::MX dxs_offset = horzcat(dx_end);
+            casadi::MX us = horzcat(U0_var_vec);
+            /*Every knot segment of this segment has the same length*/
+            casadi::MX hs = repmat(knot_length, 1, knot_num);
+
+            casadi::MXVector con_mats = {shooting_constraint_map(casadi::MXVector{xs, dxs, us, hs}).at(0) - dxs_offset};
+            for (size_t i = 0; i < general_constraint_maps.size(); ++i)
+            {
+                con_mats.push_back(general_constraint_maps[i](casadi::MXVector{xs, dxs, us, hs}).at(0));
+            }
+
+            if (stage_wise_ordering)
+            {
+                /*Each mapped constraint holds the constraints of knot k in its k-th column*/
+                for (casadi_int k = 0; k < knot_num; ++k)
+                {
+                    casadi::MXVector stage;
+                    for (const casadi::MX &con_mat : con_mats)
+                    {
+                        casadi_int width = con_mat.size2() / knot_num;
+                        stage.push_back(reshape(con_mat(casadi::Slice(), casadi::Slice(k * width, (k + 1) * width)), con_mat.size1() * width, 1));
+                    }
+                    result.push_back(vertcat(stage));
+                }
+            }
+            else
+            {
+                for (const casadi::MX &con_mat : con_mats)
+                {
+                    result.push_back(reshape(con_mat, con_mat.size1() * con_mat.size2(), 1));
+                }
+            }
+
+            /*The parameters are the same for every knot segment*/
+            if (map_reduce_cost)
+            {
+                /*Each knot segment starts from zero accumulated cost, and the knot costs are summed afterwards*/
+                J0 = J0 + sum2(q_cost_map(casadi::MXVector{casadi::MX::zeros(1, knot_num), xs, dxs, us, hs, repmat(parameters, 1, knot_num)}).at(0));
+            }
+            else
+                J0 = q_cost_fold(casadi::MXVector{J0, xs, dxs, us, hs, repmat(parameters, 1, knot_num)}).at(0);
+
+            /*where g of this segment starts*/
+            size_t g_size = g.size();
+            g.insert(g.end(), make_move_iterator(result.begin()), make_move_iterator(result.end()));
+            g_range = tuple_size_t(g_size, g.size());
+
+            /*where w of this segment starts*/
+            size_t w_size = 0;
+            for (const casadi::MX &item : w)
+                w_size += item.size1() * item.size2();
+
+            if (stage_wise_ordering)
+            {
+                for (casadi_int k = 0; k < knot_num; ++k)
+                {
+                    w.push_back(dX0_var_vec[k]);
+                    w.push_back(U0_var_vec[k]);
+                }
+                w.push_back(dX0_var_vec[knot_num]);
+            }
+            else
+            {
+                w.insert(w.end(), dX0_var_vec.begin(), dX0_var_vec.end());
+                w.insert(w.end(), U0_var_vec.begin(), U0_var_vec.end());
+            }
+
+            size_t w_end = w_size + st_m->ndx * (knot_num + 1) + st_m->nu * knot_num;
+            w_range = tuple_size_t(w_size, w_end);
+        }
+
+        void MultipleShootingSegment::extractSolution(const std::vector<double> &w, Eigen::MatrixXd &solx, Eigen::MatrixXd &solu) const
+        {
+            evaluateExtraction(w, w_permutation, solx, solu);
+        }
+
+        casadi::MX MultipleShootingSegment::getInitialStateDeviant() const
+        {
+            return dX0_var_vec.front();
+        }
+
+        casadi::MX MultipleShootingSegment::getInitialState() const
+        {
+            return X0_var_vec.front();
+        }
+
+        casadi::MX MultipleShootingSegment::getFinalStateDeviant() const
+        {
+            return dX0_var_vec.back();
+        }
+
+        casadi::MX MultipleShootingSegment::getFinalState() const
+        {
+            return X0_var_vec.back();
+        }
+
+        casadi::DM MultipleShootingSegment::getSegmentTimes() const
+        {
+            return segment_times;
+        }
+
+        casadi::DM MultipleShootingSegment::getUSegmentTimes() const
+        {
+            return segment_times;
+        }
+
+        casadi::DM MultipleShootingSegment::getKnotTimes() const
+        {
+            return knot_times;
+        }
+
+        void MultipleShootingSegment::fill_lbw_ubw(std::vector<double> &lbw, std::vector<double> &ubw)
+        {
+            /*where lb/ub of this segment starts*/
+            auto bw_size = lbw.size();
+            std::vector<double> element_access1 = toNLPOrder(general_lbw, w_permutation);
+            std::vector<double> element_access2 = toNLPOrder(general_ubw, w_permutation);
+
+            lbw.insert(lbw.end(), element_access1.begin(), element_access1.end());
+            ubw.insert(ubw.end(), element_access2.begin(), element_access2.end());
+            lbw_ubw_range = tuple_size_t(bw_size, lbw.size());
+        }
+
+        void MultipleShootingSegment::fill_lbg_ubg(std::vector<double> &lbg, std::vector<double> &ubg)
+        {
+            /*where lb/ub of this segment starts*/
+            auto bg_size = lbg.size();
+            std::vector<double> element_access1 = toNLPOrder(general_lbg, g_permutation);
+            std::vector<double> element_access2 = toNLPOrder(general_ubg, g_permutation);
+
+            lbg.insert(lbg.end(), element_access1.begin(), element_access1.end());
+            ubg.insert(ubg.end(), element_access2.begin(), element_access2.end());
+            lbg_ubg_range = tuple_size_t(bg_size, lbg.size());
+        }
+
+        void MultipleShootingSegment::fill_w0(std::vector<double> &all_w0) const
+        {
+            std::vector<double> element_access1 = toNLPOrder(w0, w_permutation);
+            all_w0.insert(all_w0.end(), element_access1.begin(), element_access1.end());
+        }
+
+        void MultipleShootingSegment::update_w0(const std::vector<double> &all_w0)
+        {
+            assert(std::get<1>(lbw_ubw_range) <= all_w0.size() && "w0 does not contain this segment");
+            w0 = fromNLPOrder(all_w0.begin() + std::get<0>(lbw_ubw_range), all_w0.begin() + std::get<1>(lbw_ubw_range), w_permutation);
+        }
+
+        void MultipleShootingSegment::fill_lam0(std::vector<double> &all_lam_w0, std::vector<double> &all_lam_g0) const
+        {
+            std::vector<double> element_access1 = toNLPOrder(lam_w0, w_permutation);
+            std::vector<double> element_access2 = toNLPOrder(lam_g0, g_permutation);
+            all_lam_w0.insert(all_lam_w0.end(), element_access1.begin(), element_access1.end());
+            all_lam_g0.insert(all_lam_g0.end(), element_access2.begin(), element_access2.end());
+        }
+
+        void MultipleShootingSegment::update_lam0(const std::vector<double> &all_lam_w0, const std::vector<double> &all_lam_g0)
+        {
+            assert(std::get<1>(lbw_ubw_range) <= all_lam_w0.size() && "lam_w0 does not contain this segment");
+            assert(std::get<1>(lbg_ubg_range) <= all_lam_g0.size() && "lam_g0 does not contain this segment");
+            lam_w0 = fromNLPOrder(all_lam_w0.begin() + std::get<0>(lbw_ubw_range), all_lam_w0.begin() + std::get<1>(lbw_ubw_range), w_permutation);
+            lam_g0 = fromNLPOrder(all_lam_g0.begin() + std::get<0>(lbg_ubg_range), all_lam_g0.begin() + std::get<1>(lbg_ubg_range), g_permutation);
+        }
+
+        tuple_size_t MultipleShootingSegment::get_range_idx_decision_variables() const
+        {
+            return w_range;
+        }
+
+        tuple_size_t MultipleShootingSegment::get_range_idx_constraint_expressions() const
+        {
+            return g_range;
+        }
+
+        tuple_size_t MultipleShootingSegment::get_range_idx_constraint_bounds() const
+        {
+            return lbg_ubg_range;
+        }
+
+        tuple_size_t MultipleShootingSegment::get_range_idx_decision_bounds() const
+        {
+            return lbw_ubw_range;
+        }
+
+        std::vector<stage_structure_t> MultipleShootingSegment::getStageStructure() const
+        {
+            assert(stage_wise_ordering && "The stage structure requires stage-wise ordering");
+            std::vector<std::tuple<casadi_int, casadi_int>> g_regions = constraintRegions();
+            std::vector<stage_structure_t> stages(knot_num + 1);
+            casadi_int row = 0;
+            for (casadi_int k = 0; k < knot_num; ++k)
+            {
+                stages[k].nx = st_m->ndx;
+                stages[k].nu = st_m->nu;
+                /*Each stage holds [shooting, general constraints...], of which the shooting constraint closes the gap*/
+                for (size_t r = 0; r < g_regions.size(); ++r)
+                {
+                    std::vector<casadi_int> &rows = r == 0 ? stages[k].gap_closing_rows : stages[k].path_rows;
+                    for (casadi_int i = 0; i < std::get<1>(g_regions[r]); ++i)
+                        rows.push_back(row++);
+                }
+            }
+            stages[knot_num].nx = st_m->ndx;
+            return stages;
+        }
+    }
+}
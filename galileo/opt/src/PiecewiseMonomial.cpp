@@ -0,0 +1,88 @@
+#include "galileo/opt/PiecewiseMonomial.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace galileo
+{
+    namespace opt
+    {
+        namespace solution
+        {
+            void piecewise_monomial_t::Resize(uint32_t num_rows_, uint32_t order_, uint32_t num_intervals_)
+            {
+                num_rows = num_rows_;
+                order = order_;
+                num_intervals = num_intervals_;
+                /*Each interval starts on a cache line, so evaluating a time touches as few lines as possible*/
+                interval_stride = (num_rows * order + cache_line_doubles - 1) / cache_line_doubles * cache_line_doubles;
+                breakpoints.assign(num_intervals + 1, 0.0);
+                coefficients.assign(size_t(num_intervals) * interval_stride, 0.0);
+            }
+
+            bool piecewise_monomial_t::Evaluate(double t, Eigen::Ref<Eigen::VectorXd> result) const
+            {
+                assert(result.size() == num_rows);
+                if (num_intervals == 0 || t < breakpoints.front() || t > breakpoints.back())
+                    return false;
+
+                auto it = std::upper_bound(breakpoints.begin(), breakpoints.end() - 1, t);
+                uint32_t interval = it == breakpoints.begin() ? 0 : std::distance(breakpoints.begin(), it) - 1;
+                double s = t - breakpoints[interval];
+                for (uint32_t row = 0; row < num_rows; ++row)
+                {
+                    result(row) = hornerEvaluate(Coefficients(interval, row), order, s);
+                }
+                return true;
+            }
+
+            std::vector<uint8_t, cache_aligned_allocator<uint8_t>> piecewise_monomial_t::Serialize() const
+            {
+                const uint32_t header[6] = {magic, version, num_rows, order, num_intervals, interval_stride};
+                size_t breakpoints_offset = sizeof(header);
+                size_t coefficients_offset = (breakpoints_offset + breakpoints.size() * sizeof(double) + 63) / 64 * 64;
+
+                std::vector<uint8_t, cache_aligned_allocator<uint8_t>> blob(coefficients_offset + coefficients.size() * sizeof(double), 0);
+                std::memcpy(blob.data(), header, sizeof(header));
+                std::memcpy(blob.data() + breakpoints_offset, breakpoints.data(), breakpoints.size() * sizeof(double));
+                std::memcpy(blob.data() + coefficients_offset, coefficients.data(), coefficients.size() * sizeof(double));
+                return blob;
+            }
+
+            bool piecewise_monomial_t::Deserialize(const uint8_t *data, size_t size, piecewise_monomial_t &monomial)
+            {
+                uint32_t header[6];
+                if (size < sizeof(header))
+                    return false;
+                std::memcpy(header, data, sizeof(header));
+                if (header[0] != magic || header[1] != version)
+                    return false;
+
+                /*The header is untrusted, so the sizes it implies are computed in size_t and checked against the blob before resizing*/
+                size_t num_rows = header[2];
+                size_t order = header[3];
+                size_t num_intervals = header[4];
+                size_t interval_doubles = num_rows * order;
+                if (order != 0 && interval_doubles / order != num_rows)
+                    return false;
+                size_t interval_stride = (interval_doubles + cache_line_doubles - 1) / cache_line_doubles * cache_line_doubles;
+                if (interval_stride != header[5])
+                    return false;
+
+                size_t remaining = size - sizeof(header);
+                if (num_intervals + 1 > remaining / sizeof(double))
+                    return false;
+                size_t breakpoints_offset = sizeof(header);
+                size_t coefficients_offset = (breakpoints_offset + (num_intervals + 1) * sizeof(double) + 63) / 64 * 64;
+                if (coefficients_offset > size || (interval_stride != 0 && num_intervals > (size - coefficients_offset) / sizeof(double) / interval_stride))
+                    return false;
+
+                monomial.Resize(header[2], header[3], header[4]);
+                std::memcpy(monomial.breakpoints.data(), data + breakpoints_offset, monomial.breakpoints.size() * sizeof(double));
+                std::memcpy(monomial.coefficients.data(), data + coefficients_offset, monomial.coefficients.size() * sizeof(double));
+                return true;
+            }
+        }
+    }
+}
@@ -1,10 +1,12 @@
 #include <galileo/opt/PseudospectralSegment.h>
 
+#include <numeric>
+
 namespace galileo
 {
     namespace opt
     {
-        PseudospectralSegment::PseudospectralSegment(std::shared_ptr<GeneralProblemData> problem, casadi::Function F_, casadi::Function L_, std::shared_ptr<States> st_m_, int d, int knot_num_, double h_)
+        PseudospectralSegment::PseudospectralSegment(std::shared_ptr<GeneralProblemData> problem, casadi::Function F_, casadi::Function L_, std::shared_ptr<States> st_m_, int d, int knot_num_, double h_, bool stage_wise_ordering_, const std::string &scheme, bool fused_kernel_)
         {
             auto Fint_ = problem->Fint;
             auto Fdiff_ = problem->Fdiff;
@@ -18,7 +20,7 @@ namespace galileo
             assert(Fint_.n_out() == 1 && "Fint must have 1 output");
             assert(Fdiff_.n_in() == 3 && "Fdiff must have 3 inputs");
             assert(Fdiff_.n_out() == 1 && "Fdiff must have 1 output");
-            assert(L_.n_in() == 2 && "L must have 2 inputs");
+            assert(L_.n_in() == (problem->np > 0 ? 3 : 2) && "L must have 2 inputs, or 3 inputs if there are problem parameters");
             assert(L_.n_out() == 1 && "L must have 1 output");
 
             F_.assert_size_in(0, st_m_->nx, 1);
@@ -27,6 +29,8 @@ namespace galileo
 
             L_.assert_size_in(0, st_m_->nx, 1);
             L_.assert_size_in(1, st_m_->nu, 1);
+            if (problem->np > 0)
+                L_.assert_size_in(2, problem->np, 1);
             L_.assert_size_out(0, 1, 1);
 
             Fint_.assert_size_in(0, st_m_->nx, 1);
@@ -47,17 +51,20 @@ namespace galileo
             this->F = F_;
             this->L = L_;
             this->T = (knot_num)*h;
+            this->stage_wise_ordering = stage_wise_ordering_;
+            this->fused_kernel = fused_kernel_;
+            this->P = casadi::SX::sym("P", problem->np, 1);
 
-            initializeExpressionVariables(d);
+            initializeExpressionVariables(d, scheme);
         }
 
-        void PseudospectralSegment::initializeExpressionVariables(int d)
+        void PseudospectralSegment::initializeExpressionVariables(int d, const std::string &scheme)
         {
             dXc.clear();
             Uc.clear();
 
-            dX_poly = LagrangePolynomial(d);
-            U_poly = LagrangePolynomial(d - 1);
+            dX_poly = LagrangePolynomial(d, scheme);
+            U_poly = LagrangePolynomial(d - 1, scheme);
 
             for (int j = 0; j < dX_poly.d; ++j)
             {
@@ -71,6 +78,7 @@ namespace galileo
             X0 = casadi::SX::sym("X0", st_m->nx, 1);
             U0 = casadi::SX::sym("U0", st_m->nu, 1);
             Lc = casadi::SX::sym("Lc", 1, 1);
+            H = casadi::SX::sym("h", 1, 1);
         }
 
         void PseudospectralSegment::initializeSegmentTimeVector(casadi::DM &global_times)
@@ -147,11 +155,15 @@ namespace galileo
             u_knot_times += start_time;
         }
 
-        void PseudospectralSegment::initializeKnotSegments(casadi::DM x0_global_, casadi::MX x0_local_)
+        void PseudospectralSegment::initializeKnotSegments(casadi::DM x0_global_, casadi::MX x0_local_, casadi::MX parameters_, casadi::MX knot_length_)
         {
             x0_global = x0_global_;
             x0_local = x0_local_;
+            parameters = parameters_;
+            knot_length = knot_length_;
             assert(x0_local.size1() == st_m->nx && x0_local.size2() == 1 && "x0 must be a column std::vector of size nx");
+            assert(parameters.size1() == P.size1() && parameters.size2() == 1 && "parameters must be a column std::vector of size np");
+            assert(knot_length.size1() == 1 && knot_length.size2() == 1 && "knot_length must be a scalar");
 
             dXc_var_vec.clear();
             Uc_var_vec.clear();
@@ -175,7 +187,7 @@ namespace galileo
             }
         }
 
-        void PseudospectralSegment::initializeExpressionGraph(std::vector<ConstraintData> G, std::shared_ptr<DecisionData> Wdata)
+        void PseudospectralSegment::buildKnotFunctions(const std::vector<ConstraintData> &G)
         {
             /*Collocation equations*/
             casadi::SXVector eq;
@@ -201,7 +213,7 @@ namespace galileo
 
             for (int j = 0; j < dX_poly.d; ++j)
             {
-                double dt_j = (dX_poly.tau_root[j + 1] - dX_poly.tau_root[j]) * h;
+                casadi::SX dt_j = (dX_poly.tau_root[j + 1] - dX_poly.tau_root[j]) * H;
                 /*Expression for the state derivative at the collocation point*/
                 casadi::SX dxp = dX_poly.C[0][j + 1] * dX0;
                 for (int r = 0; r < dX_poly.d; ++r)
@@ -218,12 +230,12 @@ namespace galileo
                 tmp_dx.push_back(dXc[j]);
 
                 /*Append collocation equations*/
-                eq.push_back(h * F(casadi::SXVector{x_c, u_c}).at(0) - dxp);
+                eq.push_back(H * F(casadi::SXVector{x_c, u_c}).at(0) - dxp);
 
                 /*Add cost contribution*/
-                casadi::SXVector L_out = L(casadi::SXVector{x_c, u_c});
+                casadi::SXVector L_out = P.is_empty() ? L(casadi::SXVector{x_c, u_c}) : L(casadi::SXVector{x_c, u_c, P});
                 /*This is fine as long as the cost is not related to the Lie Group elements. See the state integrator and dX for clarity*/
-                Qf += dX_poly.B[j + 1] * L_out.at(0) * h;
+                Qf += dX_poly.B[j + 1] * L_out.at(0) * H;
 
                 dXf += dX_poly.D[j + 1] * dXc[j];
             }
@@ -238,48 +250,36 @@ namespace galileo
 
             casadi::SX vcat_dXc = vertcat(dXc);
             casadi::SX vcat_Uc = vertcat(Uc);
-            casadi::SXVector function_inputs = {X0, vcat_dXc, dX0, U0, vcat_Uc};
+            /*The knot length is an input, so the functions do not change when the segment is stretched*/
+            casadi::SXVector function_inputs = {X0, vcat_dXc, dX0, U0, vcat_Uc, H};
 
 
-            casadi::Function collocation_constraint = casadi::Function("feq",
-                                                           function_inputs,
-                                                           casadi::SXVector{vertcat(eq)}, opts);
+            collocation_constraint = casadi::Function("feq",
+                                                      function_inputs,
+                                                      casadi::SXVector{vertcat(eq)}, opts);
 
-            casadi::Function xf_constraint = casadi::Function("fxf",
-                                                  function_inputs,
-                                                  casadi::SXVector{dXf}, opts);
+            xf_constraint = casadi::Function("fxf",
+                                             function_inputs,
+                                             casadi::SXVector{dXf}, opts);
 
-            casadi::Function uf_constraint = casadi::Function("fuf",
-                                                  function_inputs,
-                                                  casadi::SXVector{uf}, opts);
+            uf_constraint = casadi::Function("fuf",
+                                             function_inputs,
+                                             casadi::SXVector{uf}, opts);
 
-            casadi::Function q_cost = casadi::Function("fxq", casadi::SXVector{Lc, X0, vcat_dXc, dX0, U0, vcat_Uc},
-                                           casadi::SXVector{Lc + Qf}, opts);
+            q_cost = casadi::Function("fxq", casadi::SXVector{Lc, X0, vcat_dXc, dX0, U0, vcat_Uc, H, P},
+                                      casadi::SXVector{Lc + Qf}, opts);
 
-            /*Implicit discrete-time equations*/
-            collocation_constraint_map = collocation_constraint.map(knot_num, "openmp");
-            /*When you evaluate this map, subtract by the knot points list offset by 1 to be correct*/
-            xf_constraint_map = xf_constraint.map(knot_num, "openmp");
-            uf_constraint_map = uf_constraint.map(knot_num, "openmp");
-            q_cost_fold = q_cost.fold(knot_num);
-
-            sol_map_func = casadi::Function("sol_map",
-                                            function_inputs,
-                                            casadi::SXVector{horzcat(tmp_x), horzcat(tmp_u)})
-                               .map(knot_num, "serial");
-
-            casadi_int N = collocation_constraint_map.size1_out(0) * collocation_constraint_map.size2_out(0) +
-                           xf_constraint_map.size1_out(0) * xf_constraint_map.size2_out(0) +
-                           uf_constraint_map.size1_out(0) * uf_constraint_map.size2_out(0);
-            casadi_int tmp = N;
-
-            std::vector<tuple_size_t> ranges_G;
+            sol_map = casadi::Function("sol_map",
+                                       function_inputs,
+                                       casadi::SXVector{horzcat(tmp_x), horzcat(tmp_u)});
 
+            general_constraints.clear();
             casadi::SXVector tmap_symbolic_input = casadi::SXVector{horzcat(x_at_c), horzcat(u_at_c)};
+            casadi::SXVector kernel_outputs = {vertcat(eq), dXf, uf};
             /*Map the constraint to each collocation point, and then map the mapped constraint to each knot segment*/
             for (size_t i = 0; i < G.size(); ++i)
             {
-                ConstraintData  g_data = G[i];
+                const ConstraintData &g_data = G[i];
 
                 assert(g_data.G.n_in() == 2 && "G must have 2 inputs");
                 g_data.G.assert_size_in(0, st_m->nx, 1);
@@ -287,13 +287,75 @@ namespace galileo
                 assert(g_data.lower_bound.n_in() == 1 && "G lower_bound must have 1 inputs");
                 assert(g_data.lower_bound.n_out() == 1 && "G lower_bound must have 1 output");
                 g_data.lower_bound.assert_size_in(0, 1, 1);
+                casadi::SX g_at_c = vertcat(g_data.G.map(dX_poly.d, "serial")((tmap_symbolic_input)));
                 casadi::Function tmap = casadi::Function(g_data.G.name() + "_map",
                                              function_inputs,
-                                             casadi::SXVector{vertcat(g_data.G.map(dX_poly.d, "serial")((tmap_symbolic_input)))})
-                                .map(knot_num, "serial");
-                general_constraint_maps.push_back(tmap);
-                ranges_G.push_back(tuple_size_t(N, N + tmap.size1_out(0) * tmap.size2_out(0)));
-                N += tmap.size1_out(0) * tmap.size2_out(0);
+                                             casadi::SXVector{g_at_c});
+                kernel_outputs.push_back(g_at_c);
+                general_constraints.push_back(tmap);
+            }
+
+            if (fused_kernel)
+            {
+                /*The constraints share the kinematics of the collocation points, which cse evaluates once per point*/
+                casadi::Dict kernel_opts = opts;
+                kernel_opts["cse"] = true;
+                kernel_outputs.push_back(Qf);
+                casadi::SXVector kernel_inputs = function_inputs;
+                kernel_inputs.push_back(P);
+                knot_kernel = casadi::Function("fknot", kernel_inputs, kernel_outputs, kernel_opts);
+            }
+        }
+
+        std::vector<casadi::Function> PseudospectralSegment::getKnotFunctions() const
+        {
+            if (collocation_constraint.is_null())
+                return {};
+            std::vector<casadi::Function> knot_functions = {collocation_constraint, xf_constraint, uf_constraint, q_cost, sol_map, knot_kernel};
+            knot_functions.insert(knot_functions.end(), general_constraints.begin(), general_constraints.end());
+            return knot_functions;
+        }
+
+        void PseudospectralSegment::initializeExpressionGraph(std::vector<ConstraintData> G, std::shared_ptr<DecisionData> Wdata)
+        {
+            if (reused_knot_functions.empty())
+            {
+                buildKnotFunctions(G);
+            }
+            else
+            {
+                assert(reused_knot_functions.size() == 6 + G.size() && "The reused functions must come from a segment with the same constraints");
+                collocation_constraint = reused_knot_functions[0];
+                xf_constraint = reused_knot_functions[1];
+                uf_constraint = reused_knot_functions[2];
+                q_cost = reused_knot_functions[3];
+                sol_map = reused_knot_functions[4];
+                knot_kernel = reused_knot_functions[5];
+                general_constraints.assign(reused_knot_functions.begin() + 6, reused_knot_functions.end());
+            }
+
+            initializeFunctionMaps();
+            initializeOrdering();
+            updateBounds(G, Wdata);
+            updateInitialGuess(Wdata);
+
+            lam_w0 = casadi::DM::zeros(general_lbw.size1(), 1);
+            lam_g0 = casadi::DM::zeros(general_lbg.size1(), 1);
+        }
+
+        void PseudospectralSegment::updateBounds(const std::vector<ConstraintData> &G, std::shared_ptr<DecisionData> Wdata)
+        {
+            assert(G.size() == general_constraints.size() && "The constraints must be the ones the expression graph was built with");
+            casadi_int N = knot_num * (collocation_constraint.size1_out(0) * collocation_constraint.size2_out(0) +
+                                       xf_constraint.size1_out(0) * xf_constraint.size2_out(0) +
+                                       uf_constraint.size1_out(0) * uf_constraint.size2_out(0));
+            casadi_int tmp = N;
+
+            std::vector<tuple_size_t> ranges_G;
+            for (const casadi::Function &general_constraint : general_constraints)
+            {
+                ranges_G.push_back(tuple_size_t(N, N + knot_num * general_constraint.size1_out(0) * general_constraint.size2_out(0)));
+                N += knot_num * general_constraint.size1_out(0) * general_constraint.size2_out(0);
             }
 
             general_lbg.resize(N, 1);
@@ -307,9 +369,9 @@ namespace galileo
             {
                 g_data = G[i];
                 general_lbg(casadi::Slice(casadi_int(std::get<0>(ranges_G[i])), casadi_int(std::get<1>(ranges_G[i]))), 0) =
-                    casadi::DM::reshape(vertcat(g_data.lower_bound.map(knot_num * (dX_poly.d), "serial")(collocation_times)), std::get<1>(ranges_G[i]) - std::get<0>(ranges_G[i]), 1);
+                    casadi::DM::reshape(vertcat(map_policy.serialMap(g_data.lower_bound, knot_num * (dX_poly.d))(collocation_times)), std::get<1>(ranges_G[i]) - std::get<0>(ranges_G[i]), 1);
                 general_ubg(casadi::Slice(casadi_int(std::get<0>(ranges_G[i])), casadi_int(std::get<1>(ranges_G[i]))), 0) =
-                    casadi::DM::reshape(vertcat(g_data.upper_bound.map(knot_num * (dX_poly.d), "serial")(collocation_times)), std::get<1>(ranges_G[i]) - std::get<0>(ranges_G[i]), 1);
+                    casadi::DM::reshape(vertcat(map_policy.serialMap(g_data.upper_bound, knot_num * (dX_poly.d))(collocation_times)), std::get<1>(ranges_G[i]) - std::get<0>(ranges_G[i]), 1);
             }
 
             int Ndxknot = st_m->ndx * (knot_num + 1);
@@ -319,34 +381,9 @@ namespace galileo
             int Nuknot = st_m->nu * (knot_num + 1);
             int Nu = st_m->nu * (U_poly.d + 1) * knot_num + st_m->nu;
             int Nucol = Nu - Nuknot;
-            w0 = casadi::DM::zeros(Ndx + Nu, 1);
             general_lbw = -casadi::DM::inf(Ndx + Nu, 1);
             general_ubw = casadi::DM::inf(Ndx + Nu, 1);
 
-            /*Transform initial guess for x to an initial guess for dx, using f_diff, the inverse of f_int*/
-            casadi::MX xkg_sym = casadi::MX::sym("xkg", st_m->nx, 1);
-            casadi::MX xckg_sym = casadi::MX::sym("Xckg", st_m->nx * dX_poly.d, 1);
-            if (!Wdata->initial_guess.is_null())
-            {
-                casadi::DM xg = Wdata->initial_guess.map(knot_num + 1, "serial")(knot_times).at(0);
-                casadi::Function dxg_func = casadi::Function("xg_fun", casadi::MXVector{xkg_sym}, casadi::MXVector{Fdiff(casadi::MXVector{x0_global, xkg_sym, 1.0}).at(0)})
-                                                .map(knot_num + 1, "serial");
-                w0(casadi::Slice(0, Ndxknot)) = casadi::DM::reshape(dxg_func(casadi::DMVector{xg}).at(0), Ndxknot, 1);
-                /*The transformation of xc to dxc is a slightly less trivial. While x_k = fint(x0_init, dx_k), for xc_k, we have xc_k = fint(x_k, dxc_k) which is equivalent to xc_k = fint(fint(x0_init, dx_k), dxc_k).
-                Thus, dxc_k = fdiff(fint(x0_init, dx_k), xc_k)). This could be done with maps like above, but it is not necessary.*/
-                casadi::DM xc_g = Wdata->initial_guess.map((dX_poly.d) * knot_num, "serial")(collocation_times).at(0);
-                for (casadi_int i = 0; i < knot_num; ++i)
-                {
-                    casadi::DM xk = xg(casadi::Slice(i * st_m->nx, (i + 1) * st_m->nx));
-                    casadi::DM xck = xc_g(casadi::Slice(i * st_m->nx * dX_poly.d, (i + 1) * st_m->nx * dX_poly.d));
-                    for (casadi_int j = 0; j < dX_poly.d; ++j)
-                    {
-                        w0(casadi::Slice(Ndxknot + i * st_m->ndx * dX_poly.d + j * st_m->ndx, Ndxknot + i * st_m->ndx * dX_poly.d + (j + 1) * st_m->ndx)) =
-                            reshape(Fdiff(casadi::DMVector{xk, xck(casadi::Slice(j * st_m->nx, (j + 1) * st_m->nx)), h}).at(0), st_m->ndx, 1);
-                    }
-                }
-            }
-
             if (!Wdata->lower_bound.is_null() && !Wdata->upper_bound.is_null())
             {
                 // casadi::SX t = casadi::SX::sym("t");
@@ -357,24 +394,127 @@ namespace galileo
                 // general_ubw(casadi::Slice(0, Ndxknot)) = casadi::DM::reshape(ubdx.map(knot_num + 1, "serial")(knot_times).at(0), Ndxknot, 1);
                 // general_lbw(casadi::Slice(Ndxknot, Ndx)) = casadi::DM::reshape(lbdx.map((dX_poly.d) * knot_num, "serial")(collocation_times).at(0), Ndxcol, 1);
                 // general_ubw(casadi::Slice(Ndxknot, Ndx)) = casadi::DM::reshape(ubdx.map((dX_poly.d) * knot_num, "serial")(collocation_times).at(0), Ndxcol, 1);
-                
-                general_lbw(casadi::Slice(0, Ndxknot)) = casadi::DM::reshape(Wdata->lower_bound.map(knot_num + 1, "serial")(knot_times).at(0), Ndxknot, 1);
-                general_ubw(casadi::Slice(0, Ndxknot)) = casadi::DM::reshape(Wdata->upper_bound.map(knot_num + 1, "serial")(knot_times).at(0), Ndxknot, 1);
-                general_lbw(casadi::Slice(Ndxknot, Ndx)) = casadi::DM::reshape(Wdata->lower_bound.map((dX_poly.d) * knot_num, "serial")(collocation_times).at(0), Ndxcol, 1);
-                general_ubw(casadi::Slice(Ndxknot, Ndx)) = casadi::DM::reshape(Wdata->upper_bound.map((dX_poly.d) * knot_num, "serial")(collocation_times).at(0), Ndxcol, 1);
+
+                casadi::DMVector knot_lb = map_policy.serialMap(Wdata->lower_bound, knot_num + 1)(knot_times);
+                casadi::DMVector knot_ub = map_policy.serialMap(Wdata->upper_bound, knot_num + 1)(knot_times);
+                general_lbw(casadi::Slice(0, Ndxknot)) = casadi::DM::reshape(knot_lb.at(0), Ndxknot, 1);
+                general_ubw(casadi::Slice(0, Ndxknot)) = casadi::DM::reshape(knot_ub.at(0), Ndxknot, 1);
+                general_lbw(casadi::Slice(Ndxknot, Ndx)) = casadi::DM::reshape(map_policy.serialMap(Wdata->lower_bound, dX_poly.d * knot_num)(collocation_times).at(0), Ndxcol, 1);
+                general_ubw(casadi::Slice(Ndxknot, Ndx)) = casadi::DM::reshape(map_policy.serialMap(Wdata->upper_bound, dX_poly.d * knot_num)(collocation_times).at(0), Ndxcol, 1);
+
+                general_lbw(casadi::Slice(Ndx, Ndx + Nuknot)) = casadi::DM::reshape(knot_lb.at(1), Nuknot, 1);
+                general_ubw(casadi::Slice(Ndx, Ndx + Nuknot)) = casadi::DM::reshape(knot_ub.at(1), Nuknot, 1);
+                general_lbw(casadi::Slice(Ndx + Nuknot, Ndx + Nu)) = casadi::DM::reshape(map_policy.serialMap(Wdata->lower_bound, U_poly.d * knot_num)(u_collocation_times).at(1), Nucol, 1);
+                general_ubw(casadi::Slice(Ndx + Nuknot, Ndx + Nu)) = casadi::DM::reshape(map_policy.serialMap(Wdata->upper_bound, U_poly.d * knot_num)(u_collocation_times).at(1), Nucol, 1);
             }
+        }
+
+        void PseudospectralSegment::updateInitialGuess(std::shared_ptr<DecisionData> Wdata)
+        {
+            int Ndxknot = st_m->ndx * (knot_num + 1);
+            int Ndx = st_m->ndx * (dX_poly.d + 1) * knot_num + st_m->ndx;
+            int Ndxcol = Ndx - Ndxknot;
+
+            int Nuknot = st_m->nu * (knot_num + 1);
+            int Nu = st_m->nu * (U_poly.d + 1) * knot_num + st_m->nu;
+            int Nucol = Nu - Nuknot;
+            w0 = casadi::DM::zeros(Ndx + Nu, 1);
+
+            /*The functions of time are evaluated once per set of times, the inputs share the knot times with the states*/
             if (!Wdata->initial_guess.is_null())
             {
-                w0(casadi::Slice(Ndx, Ndx + Nuknot)) = casadi::DM::reshape(Wdata->initial_guess.map(knot_num + 1, "serial")(u_knot_times).at(1), Nuknot, 1);
-                w0(casadi::Slice(Ndx + Nuknot, Ndx + Nu)) = casadi::DM::reshape(Wdata->initial_guess.map((U_poly.d) * knot_num, "serial")(u_collocation_times).at(1), Nucol, 1);
+                casadi::DMVector knot_guess = map_policy.serialMap(Wdata->initial_guess, knot_num + 1)(knot_times);
+                casadi::DM xc_g = map_policy.serialMap(Wdata->initial_guess, dX_poly.d * knot_num)(collocation_times).at(0);
+
+                /*Transform initial guess for x to an initial guess for dx, using f_diff, the inverse of f_int*/
+                w0(casadi::Slice(0, Ndxknot)) = casadi::DM::reshape(map_policy.serialMap(Fdiff, knot_num + 1)(casadi::DMVector{x0_global, knot_guess.at(0), 1.0}).at(0), Ndxknot, 1);
+                /*The transformation of xc to dxc is a slightly less trivial. While x_k = fint(x0_init, dx_k), for xc_k, we have xc_k = fint(x_k, dxc_k) which is equivalent to xc_k = fint(fint(x0_init, dx_k), dxc_k).
+                Thus, dxc_k = fdiff(fint(x0_init, dx_k), xc_k)). Repeating each knot state once per collocation point of its knot segment does this with one map.*/
+                casadi::DM xk_g = knot_guess.at(0)(casadi::Slice(), casadi::Slice(0, knot_num));
+                xk_g = casadi::DM::reshape(casadi::DM::repmat(xk_g, dX_poly.d, 1), st_m->nx, dX_poly.d * knot_num);
+                w0(casadi::Slice(Ndxknot, Ndx)) = casadi::DM::reshape(map_policy.serialMap(Fdiff, dX_poly.d * knot_num)(casadi::DMVector{xk_g, xc_g, h}).at(0), Ndxcol, 1);
+
+                w0(casadi::Slice(Ndx, Ndx + Nuknot)) = casadi::DM::reshape(knot_guess.at(1), Nuknot, 1);
+                w0(casadi::Slice(Ndx + Nuknot, Ndx + Nu)) = casadi::DM::reshape(map_policy.serialMap(Wdata->initial_guess, U_poly.d * knot_num)(u_collocation_times).at(1), Nucol, 1);
+            }
+        }
+
+        void PseudospectralSegment::initializeFunctionMaps()
+        {
+            /*Implicit discrete-time equations*/
+            collocation_constraint_map = map_policy.map(collocation_constraint, knot_num);
+            /*When you evaluate this map, subtract by the knot points list offset by 1 to be correct*/
+            xf_constraint_map = map_policy.map(xf_constraint, knot_num);
+            uf_constraint_map = map_policy.map(uf_constraint, knot_num);
+            if (map_reduce_cost)
+                q_cost_map = map_policy.map(q_cost, knot_num);
+            else
+                q_cost_fold = q_cost.fold(knot_num);
+
+            /*The extraction is built once, from w in storage order to the states and inputs of the solution. It is numeric, so
+            its maps are serial*/
+            casadi_int Ndxknot = st_m->ndx * (knot_num + 1);
+            casadi_int Ndx = Ndxknot + st_m->ndx * dX_poly.d * knot_num;
+            casadi_int Nuknot = st_m->nu * (knot_num + 1);
+            casadi_int Nu = Nuknot + st_m->nu * U_poly.d * knot_num;
+            casadi::MX x0_sym = casadi::MX::sym("x0", st_m->nx);
+            casadi::MX w_sym = casadi::MX::sym("w", Ndx + Nu);
+            casadi::MX h_sym = casadi::MX::sym("h");
+            /*The final knot of each kind belongs to the next segment*/
+            casadi::MX dxs = casadi::MX::reshape(w_sym(casadi::Slice(0, st_m->ndx * knot_num)), st_m->ndx, knot_num);
+            casadi::MX dxcs = casadi::MX::reshape(w_sym(casadi::Slice(Ndxknot, Ndx)), st_m->ndx * dX_poly.d, knot_num);
+            casadi::MX us = casadi::MX::reshape(w_sym(casadi::Slice(Ndx, Ndx + st_m->nu * knot_num)), st_m->nu, knot_num);
+            casadi::MX ucs = casadi::MX::reshape(w_sym(casadi::Slice(Ndx + Nuknot, Ndx + Nu)), st_m->nu * U_poly.d, knot_num);
+            casadi::MX xs = map_policy.serialMap(Fint, knot_num)(casadi::MXVector{x0_sym, dxs, 1.0}).at(0);
+            casadi::MXVector sol = map_policy.serialMap(sol_map, knot_num)(casadi::MXVector{xs, dxcs, dxs, us, ucs, casadi::MX::repmat(h_sym, 1, knot_num)});
+            initializeExtraction(casadi::Function("extraction", casadi::MXVector{x0_sym, w_sym, h_sym},
+                                                 casadi::MXVector{casadi::MX::densify(sol.at(0)), casadi::MX::densify(sol.at(1))}));
+
+            general_constraint_maps.clear();
+            for (const casadi::Function &general_constraint : general_constraints)
+            {
+                general_constraint_maps.push_back(map_policy.map(general_constraint, knot_num));
             }
-            if (!Wdata->lower_bound.is_null() && !Wdata->upper_bound.is_null())
+
+            if (fused_kernel)
+                knot_kernel_map = map_policy.map(knot_kernel, knot_num);
+        }
+
+        std::vector<std::tuple<casadi_int, casadi_int>> PseudospectralSegment::decisionVariableRegions() const
+        {
+            /*Decision variables are stored as [dX0, dXc, U0, Uc], each of which is contiguous per knot*/
+            return {std::make_tuple(knot_num + 1, casadi_int(st_m->ndx)),
+                    std::make_tuple(knot_num, casadi_int(st_m->ndx * dX_poly.d)),
+                    std::make_tuple(knot_num + 1, casadi_int(st_m->nu)),
+                    std::make_tuple(knot_num, casadi_int(st_m->nu * U_poly.d))};
+        }
+
+        std::vector<std::tuple<casadi_int, casadi_int>> PseudospectralSegment::constraintRegions() const
+        {
+            /*Constraints are stored as [collocation, xf, uf, general constraints...], each of which is contiguous per knot*/
+            std::vector<std::tuple<casadi_int, casadi_int>> g_regions = {std::make_tuple(knot_num, collocation_constraint.size1_out(0) * collocation_constraint.size2_out(0)),
+                                                                         std::make_tuple(knot_num, xf_constraint.size1_out(0) * xf_constraint.size2_out(0)),
+                                                                         std::make_tuple(knot_num, uf_constraint.size1_out(0) * uf_constraint.size2_out(0))};
+            for (const casadi::Function &general_constraint : general_constraints)
             {
-                general_lbw(casadi::Slice(Ndx, Ndx + Nuknot)) = casadi::DM::reshape(Wdata->lower_bound.map(knot_num + 1, "serial")(u_knot_times).at(1), Nuknot, 1);
-                general_ubw(casadi::Slice(Ndx, Ndx + Nuknot)) = casadi::DM::reshape(Wdata->upper_bound.map(knot_num + 1, "serial")(u_knot_times).at(1), Nuknot, 1);
-                general_lbw(casadi::Slice(Ndx + Nuknot, Ndx + Nu)) = casadi::DM::reshape(Wdata->lower_bound.map((U_poly.d) * knot_num, "serial")(u_collocation_times).at(1), Nucol, 1);
-                general_ubw(casadi::Slice(Ndx + Nuknot, Ndx + Nu)) = casadi::DM::reshape(Wdata->upper_bound.map((U_poly.d) * knot_num, "serial")(u_collocation_times).at(1), Nucol, 1);
+                g_regions.push_back(std::make_tuple(knot_num, general_constraint.size1_out(0) * general_constraint.size2_out(0)));
             }
+            return g_regions;
+        }
+
+        void PseudospectralSegment::initializeOrdering()
+        {
+            w_permutation.clear();
+            g_permutation.clear();
+            if (!stage_wise_ordering)
+                return;
+
+            /*Each stage holds [dX0_k, U0_k, dXc_k, Uc_k], the last stage only the final knot [dX0_K, U0_K]*/
+            w_permutation = stageWisePermutation(decisionVariableRegions(), {0, 2, 1, 3});
+            std::vector<std::tuple<casadi_int, casadi_int>> g_regions = constraintRegions();
+            std::vector<size_t> g_stage_order(g_regions.size());
+            std::iota(g_stage_order.begin(), g_stage_order.end(), 0);
+            g_permutation = stageWisePermutation(g_regions, g_stage_order);
         }
 
         casadi::MX PseudospectralSegment::processVector(casadi::MXVector &vec) const
@@ -406,30 +546,68 @@ namespace galileo
             casadi::MX dxs_offset = processOffsetVector(dX0_var_vec);
             casadi::MX us_offset = processOffsetVector(U0_var_vec);
 
-            casadi::MXVector solmap_result = sol_map_func(casadi::MXVector{xs, dxcs, dxs, us, ucs});
-            casadi::MX all_xs = solmap_result.at(0);
-            casadi::MX all_us = solmap_result.at(1);
+            /*Every knot segment of this segment has the same length*/
+            casadi::MX hs = repmat(knot_length, 1, knot_num);
 
-            /*This section cannot get much faster, it is bounded by the time to evaluate the constraint*/
-            casadi::MX col_con_mat = collocation_constraint_map(casadi::MXVector{xs, dxcs, dxs, us, ucs}).at(0);
-            casadi::MX xf_con_mat = xf_constraint_map(casadi::MXVector{xs, dxcs, dxs, us, ucs}).at(0);
-            casadi::MX uf_con_mat = uf_constraint_map(casadi::MXVector{xs, dxcs, dxs, us, ucs}).at(0);
-            dxs_offset = reshape(dxs_offset, dxs_offset.size1() * dxs_offset.size2(), 1);
-            us_offset = reshape(us_offset, us_offset.size1() * us_offset.size2(), 1);
+            casadi::MXVector con_mats;
+            casadi::MX cost;
+            if (fused_kernel)
+            {
+                /*One call evaluates every knot segment, returning [collocation, xf, uf, general constraints..., cost]*/
+                casadi::MXVector kernel_result = knot_kernel_map(casadi::MXVector{xs, dxcs, dxs, us, ucs, hs, repmat(parameters, 1, knot_num)});
+                con_mats = {kernel_result[0],
+                            kernel_result[1] - dxs_offset,
+                            kernel_result[2] - us_offset};
+                con_mats.insert(con_mats.end(), kernel_result.begin() + 3, kernel_result.end() - 1);
+                cost = J0 + sum2(kernel_result.back());
+            }
+            else
+            {
+                /*This section cannot get much faster, it is bounded by the time to evaluate the constraint*/
+                casadi::MX col_con_mat = collocation_constraint_map(casadi::MXVector{xs, dxcs, dxs, us, ucs, hs}).at(0);
+                casadi::MX xf_con_mat = xf_constraint_map(casadi::MXVector{xs, dxcs, dxs, us, ucs, hs}).at(0);
+                casadi::MX uf_con_mat = uf_constraint_map(casadi::MXVector{xs, dxcs, dxs, us, ucs, hs}).at(0);
+
+                con_mats = {col_con_mat,
+                            xf_con_mat - dxs_offset,
+                            uf_con_mat - us_offset};
+                for (size_t i = 0; i < general_constraint_maps.size(); ++i)
+                {
+                    con_mats.push_back(general_constraint_maps[i](casadi::MXVector{xs, dxcs, dxs, us, ucs, hs}).at(0));
+                }
 
-            result.push_back(reshape(col_con_mat, col_con_mat.size1() * col_con_mat.size2(), 1));
-            result.push_back(reshape(xf_con_mat, xf_con_mat.size1() * xf_con_mat.size2(), 1) -
-                             dxs_offset);
-            result.push_back(reshape(uf_con_mat, uf_con_mat.size1() * uf_con_mat.size2(), 1) -
-                             us_offset);
+                /*The parameters are the same for every knot segment*/
+                if (map_reduce_cost)
+                {
+                    /*Each knot segment starts from zero accumulated cost, and the knot costs are summed afterwards*/
+                    cost = J0 + sum2(q_cost_map(casadi::MXVector{casadi::MX::zeros(1, knot_num), xs, dxcs, dxs, us, ucs, hs, repmat(parameters, 1, knot_num)}).at(0));
+                }
+                else
+                    cost = q_cost_fold(casadi::MXVector{J0, xs, dxcs, dxs, us, ucs, hs, repmat(parameters, 1, knot_num)}).at(0);
+            }
 
-            for (size_t i = 0; i < general_constraint_maps.size(); ++i)
+            if (stage_wise_ordering)
+            {
+                /*Each mapped constraint holds the constraints of knot k in its k-th group of columns*/
+                for (casadi_int k = 0; k < knot_num; ++k)
+                {
+                    casadi::MXVector stage;
+                    for (const casadi::MX &con_mat : con_mats)
+                    {
+                        casadi_int width = con_mat.size2() / knot_num;
+                        stage.push_back(reshape(con_mat(casadi::Slice(), casadi::Slice(k * width, (k + 1) * width)), con_mat.size1() * width, 1));
+                    }
+                    result.push_back(vertcat(stage));
+                }
+            }
+            else
             {
-                casadi::MX g_con_mat = general_constraint_maps[i](casadi::MXVector{xs, dxcs, dxs, us, ucs}).at(0);
-                result.push_back(reshape(g_con_mat, g_con_mat.size1() * g_con_mat.size2(), 1));
+                for (const casadi::MX &con_mat : con_mats)
+                {
+                    result.push_back(reshape(con_mat, con_mat.size1() * con_mat.size2(), 1));
+                }
             }
 
-            casadi::MX cost = q_cost_fold(casadi::MXVector{J0, xs, dxcs, dxs, us, ucs}).at(0);
             J0 = cost;
             /*where g of this segment starts*/
             size_t g_size = g.size();
@@ -445,22 +623,34 @@ namespace galileo
                 w_size = size_t(accumulate(w.begin(), w.end(), 0.0, [](int sum, const casadi::MX &item)
                                            { return sum + item.size1() * item.size2(); }));
 
-            /*Use move to avoid copying the vectors. Reserve space for w in advance outside of PseudospectralSegment.*/
-            w.insert(w.end(), make_move_iterator(dX0_var_vec.begin()), make_move_iterator(dX0_var_vec.end()));
-            w.insert(w.end(), make_move_iterator(dXc_var_vec.begin()), make_move_iterator(dXc_var_vec.end()));
-            w.insert(w.end(), make_move_iterator(U0_var_vec.begin()), make_move_iterator(U0_var_vec.end()));
-            w.insert(w.end(), make_move_iterator(Uc_var_vec.begin()), make_move_iterator(Uc_var_vec.end()));
+            if (stage_wise_ordering)
+            {
+                for (casadi_int k = 0; k < knot_num; ++k)
+                {
+                    w.push_back(dX0_var_vec[k]);
+                    w.push_back(U0_var_vec[k]);
+                    w.push_back(dXc_var_vec[k]);
+                    w.push_back(Uc_var_vec[k]);
+                }
+                w.push_back(dX0_var_vec[knot_num]);
+                w.push_back(U0_var_vec[knot_num]);
+            }
+            else
+            {
+                /*Use move to avoid copying the vectors. Reserve space for w in advance outside of PseudospectralSegment.*/
+                w.insert(w.end(), make_move_iterator(dX0_var_vec.begin()), make_move_iterator(dX0_var_vec.end()));
+                w.insert(w.end(), make_move_iterator(dXc_var_vec.begin()), make_move_iterator(dXc_var_vec.end()));
+                w.insert(w.end(), make_move_iterator(U0_var_vec.begin()), make_move_iterator(U0_var_vec.end()));
+                w.insert(w.end(), make_move_iterator(Uc_var_vec.begin()), make_move_iterator(Uc_var_vec.end()));
+            }
 
             w_range = tuple_size_t(w_size, accumulate(w.begin(), w.end(), 0.0, [](int sum, const casadi::MX &item)
                                                       { return sum + item.size1() * item.size2(); }));
-            get_sol_func = casadi::Function("func",
-                                            casadi::MXVector({vertcat(w)}),
-                                            casadi::MXVector({all_xs, all_us}));
         }
 
-        casadi::MXVector PseudospectralSegment::extractSolution(casadi::MX &w) const
+        void PseudospectralSegment::extractSolution(const std::vector<double> &w, Eigen::MatrixXd &solx, Eigen::MatrixXd &solu) const
         {
-            return get_sol_func(casadi::MXVector{w});
+            evaluateExtraction(w, w_permutation, solx, solu);
         }
 
         casadi::MX PseudospectralSegment::getInitialStateDeviant() const
@@ -517,8 +707,8 @@ namespace galileo
         {
             /*where lb/ub of this segment starts*/
             auto bw_size = lbw.size();
-            std::vector<double> element_access1 = general_lbw.get_elements();
-            std::vector<double> element_access2 = general_ubw.get_elements();
+            std::vector<double> element_access1 = toNLPOrder(general_lbw, w_permutation);
+            std::vector<double> element_access2 = toNLPOrder(general_ubw, w_permutation);
 
             lbw.insert(lbw.end(), element_access1.begin(), element_access1.end());
             ubw.insert(ubw.end(), element_access2.begin(), element_access2.end());
@@ -529,8 +719,8 @@ namespace galileo
         {
             /*where lb/ub of this segment starts*/
             auto bg_size = lbg.size();
-            std::vector<double> element_access1 = general_lbg.get_elements();
-            std::vector<double> element_access2 = general_ubg.get_elements();
+            std::vector<double> element_access1 = toNLPOrder(general_lbg, g_permutation);
+            std::vector<double> element_access2 = toNLPOrder(general_ubg, g_permutation);
 
             lbg.insert(lbg.end(), element_access1.begin(), element_access1.end());
             ubg.insert(ubg.end(), element_access2.begin(), element_access2.end());
@@ -540,10 +730,34 @@ namespace galileo
 
         void PseudospectralSegment::fill_w0(std::vector<double> &all_w0) const
         {
-            std::vector<double> element_access1 = w0.get_elements();
+            std::vector<double> element_access1 = toNLPOrder(w0, w_permutation);
             all_w0.insert(all_w0.end(), element_access1.begin(), element_access1.end());
         }
 
+        void PseudospectralSegment::update_w0(const std::vector<double> &all_w0)
+        {
+            assert(std::get<1>(lbw_ubw_range) <= all_w0.size() && "w0 does not contain this segment");
+            auto start = all_w0.begin() + std::get<0>(lbw_ubw_range);
+            auto end = all_w0.begin() + std::get<1>(lbw_ubw_range);
+            w0 = fromNLPOrder(start, end, w_permutation);
+        }
+
+        void PseudospectralSegment::fill_lam0(std::vector<double> &all_lam_w0, std::vector<double> &all_lam_g0) const
+        {
+            std::vector<double> element_access1 = toNLPOrder(lam_w0, w_permutation);
+            std::vector<double> element_access2 = toNLPOrder(lam_g0, g_permutation);
+            all_lam_w0.insert(all_lam_w0.end(), element_access1.begin(), element_access1.end());
+            all_lam_g0.insert(all_lam_g0.end(), element_access2.begin(), element_access2.end());
+        }
+
+        void PseudospectralSegment::update_lam0(const std::vector<double> &all_lam_w0, const std::vector<double> &all_lam_g0)
+        {
+            assert(std::get<1>(lbw_ubw_range) <= all_lam_w0.size() && "lam_w0 does not contain this segment");
+            assert(std::get<1>(lbg_ubg_range) <= all_lam_g0.size() && "lam_g0 does not contain this segment");
+            lam_w0 = fromNLPOrder(all_lam_w0.begin() + std::get<0>(lbw_ubw_range), all_lam_w0.begin() + std::get<1>(lbw_ubw_range), w_permutation);
+            lam_g0 = fromNLPOrder(all_lam_g0.begin() + std::get<0>(lbg_ubg_range), all_lam_g0.begin() + std::get<1>(lbg_ubg_range), g_permutation);
+        }
+
         tuple_size_t PseudospectralSegment::get_range_idx_decision_variables() const
         {
             return w_range;
@@ -563,5 +777,33 @@ namespace galileo
         {
             return lbw_ubw_range;
         }
+
+        std::vector<stage_structure_t> PseudospectralSegment::getStageStructure() const
+        {
+            assert(stage_wise_ordering && "The stage structure requires stage-wise ordering");
+            /*The states of a knot are [dX0_k, U0_k], which the end state and input constraints of the previous knot determine. The
+            first knot has no previous knot in the segment, and the constraint joining it to the last segment only determines dX0_0,
+            so U0_0 is a control of the first stage*/
+            casadi_int ndx = st_m->ndx;
+            casadi_int nu = st_m->nu;
+            casadi_int collocation_vars = ndx * dX_poly.d + nu * U_poly.d;
+            std::vector<std::tuple<casadi_int, casadi_int>> g_regions = constraintRegions();
+            std::vector<stage_structure_t> stages(knot_num + 1);
+            casadi_int row = 0;
+            for (casadi_int k = 0; k < knot_num; ++k)
+            {
+                stages[k].nx = k == 0 ? ndx : ndx + nu;
+                stages[k].nu = k == 0 ? nu + collocation_vars : collocation_vars;
+                /*Each stage holds [collocation, xf, uf, general constraints...], of which xf and uf close the gap*/
+                for (size_t r = 0; r < g_regions.size(); ++r)
+                {
+                    std::vector<casadi_int> &rows = (r == 1 || r == 2) ? stages[k].gap_closing_rows : stages[k].path_rows;
+                    for (casadi_int i = 0; i < std::get<1>(g_regions[r]); ++i)
+                        rows.push_back(row++);
+                }
+            }
+            stages[knot_num].nx = ndx + nu;
+            return stages;
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "galileo/opt/Segment.h"
+
+#include <algorithm>
+
+namespace galileo
+{
+    namespace opt
+    {
+        std::vector<casadi_int> Segment::stageWisePermutation(const std::vector<std::tuple<casadi_int, casadi_int>> &regions, const std::vector<size_t> &stage_order)
+        {
+            std::vector<casadi_int> offsets;
+            casadi_int offset = 0;
+            casadi_int num_stages = 0;
+            for (const auto &region : regions)
+            {
+                offsets.push_back(offset);
+                offset += std::get<0>(region) * std::get<1>(region);
+                num_stages = std::max(num_stages, std::get<0>(region));
+            }
+
+            std::vector<casadi_int> permutation;
+            permutation.reserve(offset);
+            for (casadi_int k = 0; k < num_stages; ++k)
+            {
+                for (size_t r : stage_order)
+                {
+                    casadi_int num_blocks = std::get<0>(regions[r]);
+                    casadi_int block_size = std::get<1>(regions[r]);
+                    if (k >= num_blocks)
+                        continue;
+                    for (casadi_int j = 0; j < block_size; ++j)
+                        permutation.push_back(offsets[r] + k * block_size + j);
+                }
+            }
+            assert(casadi_int(permutation.size()) == offset && "Stage order does not cover the regions");
+            return permutation;
+        }
+
+        std::vector<double> Segment::toNLPOrder(const casadi::DM &vec, const std::vector<casadi_int> &permutation)
+        {
+            std::vector<double> elements = vec.get_elements();
+            if (permutation.empty())
+                return elements;
+            assert(permutation.size() == elements.size() && "Permutation does not match the vector");
+            std::vector<double> result(elements.size());
+            for (size_t i = 0; i < permutation.size(); ++i)
+                result[i] = elements[permutation[i]];
+            return result;
+        }
+
+        casadi::DM Segment::fromNLPOrder(std::vector<double>::const_iterator begin, std::vector<double>::const_iterator end, const std::vector<casadi_int> &permutation)
+        {
+            std::vector<double> elements(begin, end);
+            if (permutation.empty())
+                return casadi::DM(elements);
+            assert(permutation.size() == elements.size() && "Permutation does not match the vector");
+            std::vector<double> result(elements.size());
+            for (size_t i = 0; i < permutation.size(); ++i)
+                result[permutation[i]] = elements[i];
+            return casadi::DM(result);
+        }
+
+        void Segment::initializeExtraction(const casadi::Function &extraction)
+        {
+            if (!extraction_func.is_null() && extraction_memory >= 0)
+                extraction_func.release(extraction_memory);
+            extraction_func = extraction;
+            extraction_memory = extraction_func.checkout();
+            extraction_w.resize(extraction_func.nnz_in(1));
+            extraction_arg.resize(extraction_func.sz_arg());
+            extraction_res.resize(extraction_func.sz_res());
+            extraction_iw.resize(extraction_func.sz_iw());
+            extraction_work.resize(extraction_func.sz_w());
+        }
+
+        void Segment::evaluateExtraction(const std::vector<double> &w, const std::vector<casadi_int> &permutation, Eigen::MatrixXd &solx, Eigen::MatrixXd &solu) const
+        {
+            assert(std::get<1>(w_range) <= w.size() && "w does not contain this segment");
+            assert(std::get<1>(w_range) - std::get<0>(w_range) == extraction_w.size() && "The extraction does not match the segment");
+            assert(x0_global.is_dense() && "The global initial state must be dense");
+            const double *w_segment = w.data() + std::get<0>(w_range);
+            if (!permutation.empty())
+            {
+                for (size_t i = 0; i < permutation.size(); ++i)
+                    extraction_w[permutation[i]] = w_segment[i];
+                w_segment = extraction_w.data();
+            }
+
+            /*The outputs are dense and column major, like Eigen, so they are written in place. Resizing to the same size does not allocate*/
+            solx.resize(extraction_func.size1_out(0), extraction_func.size2_out(0));
+            solu.resize(extraction_func.size1_out(1), extraction_func.size2_out(1));
+            double h_value = h;
+            extraction_arg[0] = x0_global.ptr();
+            extraction_arg[1] = w_segment;
+            extraction_arg[2] = &h_value;
+            extraction_res[0] = solx.data();
+            extraction_res[1] = solu.data();
+            extraction_func(extraction_arg.data(), extraction_res.data(), extraction_iw.data(), extraction_work.data(), extraction_memory);
+        }
+    }
+}
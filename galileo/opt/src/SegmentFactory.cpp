@@ -0,0 +1,29 @@
+#include "galileo/opt/SegmentFactory.h"
+
+namespace galileo
+{
+    namespace opt
+    {
+        std::shared_ptr<Segment> SegmentFactory::createSegment(TranscriptionMethod transcription, std::shared_ptr<GeneralProblemData> problem, casadi::Function F, casadi::Function L,
+                                                               std::shared_ptr<States> st_m, int d, const std::string &scheme, int knot_num, double h, bool stage_wise_ordering, bool fused_kernel)
+        {
+            switch (transcription)
+            {
+            case TranscriptionMethod::MULTIPLE_SHOOTING:
+                return std::make_shared<MultipleShootingSegment>(problem, F, L, st_m, knot_num, h, 1, stage_wise_ordering);
+            case TranscriptionMethod::PSEUDOSPECTRAL:
+            default:
+                return std::make_shared<PseudospectralSegment>(problem, F, L, st_m, d, knot_num, h, stage_wise_ordering, scheme, fused_kernel);
+            }
+        }
+
+        TranscriptionMethod SegmentFactory::transcriptionFromString(const std::string &name)
+        {
+            if (name == "pseudospectral")
+                return TranscriptionMethod::PSEUDOSPECTRAL;
+            if (name == "multiple_shooting")
+                return TranscriptionMethod::MULTIPLE_SHOOTING;
+            throw std::invalid_argument("Unknown transcription method: " + name);
+        }
+    }
+}
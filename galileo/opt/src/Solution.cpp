@@ -1,5 +1,9 @@
 #include "galileo/opt/Solution.h"
 
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
 namespace galileo
 {
     namespace opt
@@ -9,10 +13,180 @@ namespace galileo
             void Solution::UpdateSolution(std::vector<solution_segment_data_t> solution_segments)
             {
                 solution_segments_ = solution_segments;
+
+                /*The knots are located by binary search, so their start times are gathered once per solution*/
+                segment_end_times_.clear();
+                state_knot_times_.clear();
+                input_knot_times_.clear();
+                for (const solution_segment_data_t &segment : solution_segments_)
+                {
+                    segment_end_times_.push_back(segment.end_time);
+                    int state_deg = segment.state_degree + 1;
+                    int input_deg = segment.input_degree + 1;
+                    std::vector<double> state_knots;
+                    std::vector<double> input_knots;
+                    for (int k = 0; k < segment.num_knots; ++k)
+                    {
+                        state_knots.push_back(segment.state_times[k * state_deg]);
+                        input_knots.push_back(segment.input_times[k * input_deg]);
+                    }
+                    state_knot_times_.push_back(state_knots);
+                    input_knot_times_.push_back(input_knots);
+                }
+
+                /*Prepared queries only hold weights, so the solutions of the segments are laid side by side to be multiplied at once*/
+                state_column_offsets_.clear();
+                input_column_offsets_.clear();
+                max_state_nodes_ = 0;
+                max_input_nodes_ = 0;
+                Eigen::Index state_columns = 0;
+                Eigen::Index input_columns = 0;
+                for (const solution_segment_data_t &segment : solution_segments_)
+                {
+                    state_column_offsets_.push_back(state_columns);
+                    input_column_offsets_.push_back(input_columns);
+                    max_state_nodes_ = std::max<Eigen::Index>(max_state_nodes_, segment.state_poly.tau_root.size());
+                    max_input_nodes_ = std::max<Eigen::Index>(max_input_nodes_, segment.input_poly.tau_root.size());
+                    state_columns += segment.solx_segment.cols();
+                    input_columns += segment.solu_segment.cols();
+                }
+                if (!solution_segments_.empty())
+                {
+                    solx_.resize(solution_segments_[0].solx_segment.rows(), state_columns);
+                    solu_.resize(solution_segments_[0].solu_segment.rows(), input_columns);
+                }
+                for (size_t j = 0; j < solution_segments_.size(); ++j)
+                {
+                    solx_.middleCols(state_column_offsets_[j], solution_segments_[j].solx_segment.cols()) = solution_segments_[j].solx_segment;
+                    solu_.middleCols(input_column_offsets_[j], solution_segments_[j].solu_segment.cols()) = solution_segments_[j].solu_segment;
+                }
+
+                std::vector<double> layout;
+                double start_time = solution_segments_.empty() ? 0.0 : solution_segments_[0].initial_time;
+                for (size_t j = 0; j < solution_segments_.size(); ++j)
+                {
+                    const solution_segment_data_t &segment = solution_segments_[j];
+                    layout.insert(layout.end(), {segment.initial_time - start_time, segment.end_time - start_time, double(segment.num_knots),
+                                                 double(segment.solx_segment.cols()), double(segment.solu_segment.cols()),
+                                                 double(segment.state_poly.piecewise_constant), double(segment.input_poly.piecewise_constant)});
+                    layout.insert(layout.end(), segment.state_poly.tau_root.begin(), segment.state_poly.tau_root.end());
+                    layout.insert(layout.end(), segment.input_poly.tau_root.begin(), segment.input_poly.tau_root.end());
+                    for (double t : state_knot_times_[j])
+                        layout.push_back(t - start_time);
+                    for (double t : input_knot_times_[j])
+                        layout.push_back(t - start_time);
+                }
+                /*The times are shifted by the start of the horizon, so they are compared up to rounding*/
+                bool same_layout = layout.size() == layout_.size() &&
+                                   std::equal(layout.begin(), layout.end(), layout_.begin(), [](double a, double b)
+                                              { return std::abs(a - b) <= 1e-9 * std::max(1.0, std::abs(a)); });
+                if (!same_layout)
+                {
+                    layout_ = layout;
+                    ++layout_version_;
+                }
+            }
+
+            size_t Solution::findSegment(double t, size_t first_segment) const
+            {
+                /*The first segment which ends at or after t, so a time shared by two segments belongs to the earlier one*/
+                auto it = std::lower_bound(segment_end_times_.begin() + first_segment, segment_end_times_.end(), t);
+                size_t j = std::distance(segment_end_times_.begin(), it);
+                if (j == solution_segments_.size() || t < solution_segments_[j].initial_time)
+                    return solution_segments_.size();
+                return j;
+            }
+
+            size_t Solution::findKnot(const std::vector<double> &knot_times, double t)
+            {
+                auto it = std::upper_bound(knot_times.begin(), knot_times.end(), t);
+                return it == knot_times.begin() ? 0 : std::distance(knot_times.begin(), it) - 1;
+            }
+
+            void Solution::PrepareWorkspace(query_workspace_t &workspace, int derivative_order) const
+            {
+                assert(derivative_order >= 0);
+                workspace.derivative_order = derivative_order;
+                workspace.state_weights.resize(std::max<Eigen::Index>(max_state_nodes_, 1), derivative_order + 1);
+                workspace.input_weights.resize(std::max<Eigen::Index>(max_input_nodes_, 1), derivative_order + 1);
+            }
+
+            bool Solution::locateQuery(double t, size_t &segment, Eigen::Index &state_column, Eigen::Index &input_column, query_workspace_t &workspace) const
+            {
+                size_t j = findSegment(t, segment);
+                if (j == solution_segments_.size())
+                    return false;
+                segment = j;
+                const solution_segment_data_t &segment_data = solution_segments_[j];
+                int derivative_order = workspace.derivative_order;
+
+                /*The knot length, rather than the span of the collocation points, scales the time, since the last collocation point of a Legendre scheme is not at the end of the knot*/
+                double knot_length = (segment_data.end_time - segment_data.initial_time) / segment_data.num_knots;
+
+                /*The weights are written to the top left corner of the workspace, which fits the polynomials of every segment*/
+                Eigen::Index state_nodes = segment_data.state_poly.tau_root.size();
+                size_t state_index = findKnot(state_knot_times_[j], t);
+                state_column = state_index * (segment_data.state_degree + 1);
+                segment_data.state_poly.interpolationWeights((t - state_knot_times_[j][state_index]) / knot_length, derivative_order,
+                                                             workspace.state_weights.topLeftCorner(state_nodes, derivative_order + 1));
+
+                Eigen::Index input_nodes = segment_data.input_poly.tau_root.size();
+                size_t input_index = findKnot(input_knot_times_[j], t);
+                input_column = input_index * (segment_data.input_degree + 1);
+                segment_data.input_poly.interpolationWeights((t - input_knot_times_[j][input_index]) / knot_length, derivative_order,
+                                                             workspace.input_weights.topLeftCorner(input_nodes, derivative_order + 1));
+
+                /*The polynomials are differentiated w.r.t. the Lagrange time scale, which is the time divided by the knot length*/
+                double scale = 1.0;
+                for (int k = 1; k <= derivative_order; ++k)
+                {
+                    scale /= knot_length;
+                    workspace.state_weights.col(k).head(state_nodes) *= scale;
+                    workspace.input_weights.col(k).head(input_nodes) *= scale;
+                }
+                return true;
             }
 
             // state_result and input_result should be initialized to the correct size before calling GetSolution!
             bool Solution::GetSolution(const Eigen::VectorXd &query_times, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result, AccessSolutionError &sol_error) const
+            {
+                query_workspace_t workspace;
+                PrepareWorkspace(workspace, 0);
+                std::vector<Eigen::MatrixXd> no_derivatives;
+                return GetSolution(query_times, workspace, state_result, input_result, no_derivatives, no_derivatives, sol_error);
+            }
+
+            bool Solution::GetSolution(const Eigen::VectorXd &query_times, int derivative_order, std::vector<Eigen::MatrixXd> &state_results, std::vector<Eigen::MatrixXd> &input_results, AccessSolutionError &sol_error) const
+            {
+                if (solution_segments_.size() == 0)
+                {
+                    sol_error = AccessSolutionError::SOLUTION_DNE;
+                    return false;
+                }
+
+                state_results.resize(derivative_order + 1);
+                input_results.resize(derivative_order + 1);
+                for (int k = 0; k <= derivative_order; ++k)
+                {
+                    state_results[k].resize(solx_.rows(), query_times.size());
+                    input_results[k].resize(solu_.rows(), query_times.size());
+                }
+
+                query_workspace_t workspace;
+                PrepareWorkspace(workspace, derivative_order);
+                /*The derivatives are moved out of the results and back, which does not copy them*/
+                std::vector<Eigen::MatrixXd> state_derivatives(std::make_move_iterator(state_results.begin() + 1), std::make_move_iterator(state_results.end()));
+                std::vector<Eigen::MatrixXd> input_derivatives(std::make_move_iterator(input_results.begin() + 1), std::make_move_iterator(input_results.end()));
+                bool success = GetSolution(query_times, workspace, state_results[0], input_results[0], state_derivatives, input_derivatives, sol_error);
+                std::move(state_derivatives.begin(), state_derivatives.end(), state_results.begin() + 1);
+                std::move(input_derivatives.begin(), input_derivatives.end(), input_results.begin() + 1);
+                return success;
+            }
+
+            bool Solution::GetSolution(const Eigen::Ref<const Eigen::VectorXd> &query_times, query_workspace_t &workspace,
+                                       Eigen::Ref<Eigen::MatrixXd> state_result, Eigen::Ref<Eigen::MatrixXd> input_result,
+                                       std::vector<Eigen::MatrixXd> &state_derivatives, std::vector<Eigen::MatrixXd> &input_derivatives,
+                                       AccessSolutionError &sol_error) const
             {
                 if (query_times.size() == 0)
                 {
@@ -21,44 +195,187 @@ namespace galileo
                 }
                 if (solution_segments_.size() == 0)
                 {
-
                     sol_error = AccessSolutionError::SOLUTION_DNE;
                     return false;
                 }
 
-                auto clock_start_time = std::chrono::high_resolution_clock::now();
+                assert(state_result.cols() >= query_times.size() && input_result.cols() >= query_times.size() && "The results must have a column per query time");
+                assert(state_derivatives.size() == input_derivatives.size() && int(state_derivatives.size()) <= workspace.derivative_order && "The workspace must be prepared for the derivatives");
+                /*Only allocates when the polynomials of the solution outgrow the workspace*/
+                if (workspace.state_weights.rows() < max_state_nodes_ || workspace.input_weights.rows() < max_input_nodes_ ||
+                    workspace.state_weights.cols() != workspace.derivative_order + 1)
+                    PrepareWorkspace(workspace, workspace.derivative_order);
 
-                for (size_t i = 0; i < query_times.size(); i++)
+                Eigen::Index state_column;
+                Eigen::Index input_column;
+                size_t segment = 0;
+                for (Eigen::Index i = 0; i < query_times.size(); i++)
                 {
-                    for (size_t j = 0; j < solution_segments_.size(); j++)
+                    /*Sorted queries continue the search from the segment of the previous query*/
+                    if (i > 0 && query_times(i) < query_times(i - 1))
+                        segment = 0;
+                    if (!locateQuery(query_times(i), segment, state_column, input_column, workspace))
+                        continue;
+
+                    /*The interpolation weights are shared by all the states, so each value and derivative is a single matrix-vector product*/
+                    const solution_segment_data_t &segment_data = solution_segments_[segment];
+                    Eigen::Index state_nodes = segment_data.state_poly.tau_root.size();
+                    Eigen::Index input_nodes = segment_data.input_poly.tau_root.size();
+                    auto state_terms = segment_data.solx_segment.middleCols(state_column, state_nodes);
+                    auto input_terms = segment_data.solu_segment.middleCols(input_column, input_nodes);
+                    state_result.col(i).noalias() = state_terms * workspace.state_weights.col(0).head(state_nodes);
+                    input_result.col(i).noalias() = input_terms * workspace.input_weights.col(0).head(input_nodes);
+                    for (size_t k = 0; k < state_derivatives.size(); ++k)
                     {
-                        if (query_times(i) >= solution_segments_[j].initial_time && query_times(i) <= solution_segments_[j].end_time)
+                        state_derivatives[k].col(i).noalias() = state_terms * workspace.state_weights.col(k + 1).head(state_nodes);
+                        input_derivatives[k].col(i).noalias() = input_terms * workspace.input_weights.col(k + 1).head(input_nodes);
+                    }
+                }
+
+                sol_error = AccessSolutionError::OK;
+                return true;
+            }
+
+            void Solution::PrepareQuery(prepared_query_t &query) const
+            {
+                assert(query.derivative_order >= 0);
+                /*One set of triplets per derivative order, starting from the value*/
+                std::vector<std::vector<Eigen::Triplet<double>>> state_triplets(query.derivative_order + 1);
+                std::vector<std::vector<Eigen::Triplet<double>>> input_triplets(query.derivative_order + 1);
+                query_workspace_t workspace;
+                PrepareWorkspace(workspace, query.derivative_order);
+                Eigen::Index state_column;
+                Eigen::Index input_column;
+                size_t segment = 0;
+                double start_time = solution_segments_.empty() ? 0.0 : solution_segments_[0].initial_time;
+                for (Eigen::Index i = 0; i < query.times.size(); i++)
+                {
+                    if (i > 0 && query.times(i) < query.times(i - 1))
+                        segment = 0;
+                    if (!locateQuery(query.times(i) + start_time, segment, state_column, input_column, workspace))
+                        continue;
+
+                    Eigen::Index state_nodes = solution_segments_[segment].state_poly.tau_root.size();
+                    Eigen::Index input_nodes = solution_segments_[segment].input_poly.tau_root.size();
+                    for (int k = 0; k <= query.derivative_order; ++k)
+                    {
+                        for (Eigen::Index r = 0; r < state_nodes; ++r)
+                        {
+                            if (workspace.state_weights(r, k) != 0)
+                                state_triplets[k].emplace_back(state_column_offsets_[segment] + state_column + r, i, workspace.state_weights(r, k));
+                        }
+                        for (Eigen::Index r = 0; r < input_nodes; ++r)
                         {
-                            int state_deg = solution_segments_[j].state_degree + 1;
-                            size_t state_index = ((query_times(i) >= solution_segments_[j].state_times.array()).count() - 1) / state_deg;
-                            Eigen::MatrixXd state_terms = solution_segments_[j].solx_segment.block(0, state_index * state_deg, solution_segments_[j].solx_segment.rows(), state_deg);
-                            double state_knot_start_time = solution_segments_[j].state_times[state_index * state_deg];
-                            double state_knot_end_time = solution_segments_[j].state_times[(state_index * state_deg) + state_deg - 1];
-                            double state_scaled_time = (query_times(i) - state_knot_start_time) / (state_knot_end_time - state_knot_start_time);
-                            state_result.col(i) = solution_segments_[j].state_poly.barycentricInterpolation(state_scaled_time, state_terms);
-
-                            int input_deg = solution_segments_[j].input_degree + 1;
-                            size_t input_index = ((query_times(i) >= solution_segments_[j].input_times.array()).count() - 1) / input_deg;
-                            Eigen::MatrixXd input_terms = solution_segments_[j].solu_segment.block(0, input_index * state_deg, solution_segments_[j].solu_segment.rows(), input_deg);
-                            double input_knot_start_time = solution_segments_[j].input_times[input_index * input_deg];
-                            double input_knot_end_time = solution_segments_[j].input_times[(input_index * input_deg) + input_deg - 1];
-                            double input_scaled_time = (query_times(i) - input_knot_start_time) / (input_knot_end_time - input_knot_start_time);
-                            input_result.col(i) = solution_segments_[j].input_poly.barycentricInterpolation(input_scaled_time, input_terms);
-                            break;
+                            if (workspace.input_weights(r, k) != 0)
+                                input_triplets[k].emplace_back(input_column_offsets_[segment] + input_column + r, i, workspace.input_weights(r, k));
                         }
                     }
                 }
 
-                auto clock_end_time = std::chrono::high_resolution_clock::now();
-                std::chrono::duration<double> elapsed_time = clock_end_time - clock_start_time;
+                query.state_weights.resize(solx_.cols(), query.times.size());
+                query.input_weights.resize(solu_.cols(), query.times.size());
+                query.state_weights.setFromTriplets(state_triplets[0].begin(), state_triplets[0].end());
+                query.input_weights.setFromTriplets(input_triplets[0].begin(), input_triplets[0].end());
+                query.state_derivative_weights.resize(query.derivative_order);
+                query.input_derivative_weights.resize(query.derivative_order);
+                for (int k = 1; k <= query.derivative_order; ++k)
+                {
+                    query.state_derivative_weights[k - 1].resize(solx_.cols(), query.times.size());
+                    query.input_derivative_weights[k - 1].resize(solu_.cols(), query.times.size());
+                    query.state_derivative_weights[k - 1].setFromTriplets(state_triplets[k].begin(), state_triplets[k].end());
+                    query.input_derivative_weights[k - 1].setFromTriplets(input_triplets[k].begin(), input_triplets[k].end());
+                }
+                query.layout_version = layout_version_;
+            }
+
+            bool Solution::GetSolution(prepared_query_t &query, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result) const
+            {
+                if (solution_segments_.empty())
+                    return false;
+                if (query.layout_version != layout_version_)
+                    PrepareQuery(query);
+
+                state_result.noalias() = solx_ * query.state_weights;
+                input_result.noalias() = solu_ * query.input_weights;
+                return true;
+            }
+
+            bool Solution::GetSolution(prepared_query_t &query, Eigen::MatrixXd &state_result, Eigen::MatrixXd &input_result,
+                                       std::vector<Eigen::MatrixXd> &state_derivatives, std::vector<Eigen::MatrixXd> &input_derivatives) const
+            {
+                if (solution_segments_.empty())
+                    return false;
+                /*The derivative weights are only prepared up to the order the query had when it was prepared*/
+                if (query.layout_version != layout_version_ || int(query.state_derivative_weights.size()) != query.derivative_order)
+                    PrepareQuery(query);
+
+                state_result.noalias() = solx_ * query.state_weights;
+                input_result.noalias() = solu_ * query.input_weights;
+                state_derivatives.resize(query.derivative_order);
+                input_derivatives.resize(query.derivative_order);
+                for (int k = 0; k < query.derivative_order; ++k)
+                {
+                    state_derivatives[k].noalias() = solx_ * query.state_derivative_weights[k];
+                    input_derivatives[k].noalias() = solu_ * query.input_derivative_weights[k];
+                }
+                return true;
+            }
+
+            bool Solution::ExportMonomial(piecewise_monomial_t &state_monomial, piecewise_monomial_t &input_monomial) const
+            {
+                if (!isSolutionSet())
+                    return false;
+                exportMonomial(false, state_monomial);
+                exportMonomial(true, input_monomial);
                 return true;
             }
 
+            void Solution::exportMonomial(bool input, piecewise_monomial_t &monomial) const
+            {
+                uint32_t order = 1;
+                uint32_t num_intervals = 0;
+                for (const solution_segment_data_t &segment : solution_segments_)
+                {
+                    const LagrangePolynomial &poly = input ? segment.input_poly : segment.state_poly;
+                    order = std::max<uint32_t>(order, poly.piecewise_constant ? 1 : poly.tau_root.size());
+                    num_intervals += segment.num_knots;
+                }
+                monomial.Resize(input ? solu_.rows() : solx_.rows(), order, num_intervals);
+
+                uint32_t interval = 0;
+                for (size_t j = 0; j < solution_segments_.size(); ++j)
+                {
+                    const solution_segment_data_t &segment = solution_segments_[j];
+                    const LagrangePolynomial &poly = input ? segment.input_poly : segment.state_poly;
+                    const Eigen::MatrixXd &sol = input ? segment.solu_segment : segment.solx_segment;
+                    const std::vector<double> &knot_times = input ? input_knot_times_[j] : state_knot_times_[j];
+                    int knot_columns = (input ? segment.input_degree : segment.state_degree) + 1;
+                    Eigen::Index nodes = poly.piecewise_constant ? 1 : poly.tau_root.size();
+
+                    /*The m-th coefficient in the Lagrange time scale is divided by the knot length to the m-th power to be in seconds*/
+                    double knot_length = (segment.end_time - segment.initial_time) / segment.num_knots;
+                    Eigen::VectorXd scale(nodes);
+                    for (Eigen::Index m = 0; m < nodes; ++m)
+                        scale(m) = std::pow(knot_length, -double(m));
+
+                    Eigen::MatrixXd coefficients;
+                    for (int k = 0; k < segment.num_knots; ++k, ++interval)
+                    {
+                        monomial.breakpoints[interval] = knot_times[k];
+                        coefficients.noalias() = sol.middleCols(k * knot_columns, nodes) * poly.monomial_matrix.topLeftCorner(nodes, nodes);
+                        coefficients *= scale.asDiagonal();
+                        /*The coefficients are stored highest power first, and polynomials of a lower order are padded with leading zeros*/
+                        for (uint32_t row = 0; row < monomial.num_rows; ++row)
+                        {
+                            double *row_coefficients = monomial.Coefficients(interval, row);
+                            for (Eigen::Index m = 0; m < nodes; ++m)
+                                row_coefficients[order - 1 - m] = coefficients(row, m);
+                        }
+                    }
+                }
+                monomial.breakpoints[num_intervals] = solution_segments_.back().end_time;
+            }
+
             void Solution::UpdateConstraints(std::vector<std::vector<galileo::opt::ConstraintData>> constarint_data_segments)
             {
                 constraint_data_segments_ = constarint_data_segments;
@@ -90,14 +407,14 @@ namespace galileo
                         casadi_int start_idx = casadi_int(std::get<0>(seg_range));
                         casadi_int end_idx = casadi_int(std::get<1>(seg_range));
 
-                        casadi::DM con_eval = con_data.G.map(end_idx - start_idx)(casadi::DMVector{
+                        casadi::DM con_eval = map_policy_.serialMap(con_data.G, end_idx - start_idx)(casadi::DMVector{
                                                                                       dm_state_result(casadi::Slice(0, dm_state_result.rows()), casadi::Slice(start_idx, end_idx)),
                                                                                       dm_input_result(casadi::Slice(0, dm_input_result.rows()), casadi::Slice(start_idx, end_idx))})
                                                   .at(0);
-                        casadi::DM con_lb = con_data.lower_bound.map(end_idx - start_idx)(casadi::DMVector{
+                        casadi::DM con_lb = map_policy_.serialMap(con_data.lower_bound, end_idx - start_idx)(casadi::DMVector{
                                                                                               dm_times(casadi::Slice(start_idx, end_idx), casadi::Slice(0, dm_times.columns()))})
                                                 .at(0);
-                        casadi::DM con_ub = con_data.upper_bound.map(end_idx - start_idx)(casadi::DMVector{
+                        casadi::DM con_ub = map_policy_.serialMap(con_data.upper_bound, end_idx - start_idx)(casadi::DMVector{
                                                                                               dm_times(casadi::Slice(start_idx, end_idx), casadi::Slice(0, dm_times.columns()))})
                                                 .at(0);
 
@@ -0,0 +1,347 @@
+#include "galileo/opt/SolutionLog.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace galileo
+{
+    namespace opt
+    {
+        namespace solution
+        {
+            bool SolutionLog::AppendSolution(const std::string &file_name, const std::vector<solution_segment_data_t> &solution_segments,
+                                             const std::vector<std::vector<ConstraintData>> &constraint_data_segments)
+            {
+                std::ofstream file(file_name, std::ios::binary | std::ios::app);
+                if (!file.is_open())
+                    return false;
+                return AppendSolution(file, solution_segments, constraint_data_segments);
+            }
+
+            bool SolutionLog::AppendSolution(std::ostream &file, const std::vector<solution_segment_data_t> &solution_segments,
+                                             const std::vector<std::vector<ConstraintData>> &constraint_data_segments)
+            {
+                /*The record header is the magic and version, the size of the record, and the number of solution and constraint segments*/
+                std::vector<uint8_t> record(8);
+                std::memcpy(record.data(), &magic, sizeof(magic));
+                std::memcpy(record.data() + sizeof(magic), &version, sizeof(version));
+                writeInt(record, 0);
+                writeInt(record, solution_segments.size());
+                writeInt(record, constraint_data_segments.size());
+
+                for (const solution_segment_data_t &segment : solution_segments)
+                {
+                    writeDoubles(record, &segment.initial_time, 1);
+                    writeDoubles(record, &segment.end_time, 1);
+                    writeInt(record, segment.num_knots);
+                    writeInt(record, segment.state_degree);
+                    writeInt(record, segment.input_degree);
+                    /*The polynomials are rebuilt from their degree and scheme, a piecewise constant polynomial having degree 0*/
+                    for (const LagrangePolynomial *poly : {&segment.state_poly, &segment.input_poly})
+                    {
+                        writeInt(record, poly->piecewise_constant ? 0 : poly->d);
+                        writeString(record, poly->scheme);
+                    }
+                    writeInt(record, segment.state_times.size());
+                    writeInt(record, segment.solx_segment.rows());
+                    writeInt(record, segment.solx_segment.cols());
+                    writeInt(record, segment.input_times.size());
+                    writeInt(record, segment.solu_segment.rows());
+                    writeInt(record, segment.solu_segment.cols());
+                    writeDoubles(record, segment.state_times.data(), segment.state_times.size());
+                    writeDoubles(record, segment.solx_segment.data(), segment.solx_segment.size());
+                    writeDoubles(record, segment.input_times.data(), segment.input_times.size());
+                    writeDoubles(record, segment.solu_segment.data(), segment.solu_segment.size());
+                }
+
+                for (const std::vector<ConstraintData> &constraint_datas : constraint_data_segments)
+                {
+                    writeInt(record, constraint_datas.size());
+                    for (const ConstraintData &constraint_data : constraint_datas)
+                    {
+                        const constraint_metadata_t &metadata = constraint_data.metadata;
+                        writeString(record, metadata.name);
+                        writeInt(record, metadata.plot_groupings.size());
+                        for (const tuple_size_t &grouping : metadata.plot_groupings)
+                        {
+                            writeInt(record, std::get<0>(grouping));
+                            writeInt(record, std::get<1>(grouping));
+                        }
+                        writeInt(record, metadata.plot_titles.size());
+                        for (const std::string &title : metadata.plot_titles)
+                            writeString(record, title);
+                        writeInt(record, metadata.plot_names.size());
+                        for (const std::vector<std::string> &names : metadata.plot_names)
+                        {
+                            writeInt(record, names.size());
+                            for (const std::string &name : names)
+                                writeString(record, name);
+                        }
+                    }
+                }
+
+                int64_t record_size = record.size();
+                std::memcpy(record.data() + 8, &record_size, sizeof(record_size));
+
+                /*The record is written at once, so an interrupted write only truncates the last record*/
+                file.write(reinterpret_cast<const char *>(record.data()), record.size());
+                file.flush();
+                return file.good();
+            }
+
+            bool SolutionLog::Open(const std::string &file_name)
+            {
+                Close();
+                int fd = open(file_name.c_str(), O_RDONLY);
+                if (fd < 0)
+                    return false;
+                struct stat file_stat;
+                if (fstat(fd, &file_stat) != 0)
+                {
+                    close(fd);
+                    return false;
+                }
+                size_ = file_stat.st_size;
+                if (size_ > 0)
+                {
+                    void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (mapping == MAP_FAILED)
+                    {
+                        close(fd);
+                        size_ = 0;
+                        return false;
+                    }
+                    data_ = static_cast<const uint8_t *>(mapping);
+                }
+                close(fd);
+
+                /*Only the record headers are read, each of which holds the size of its record*/
+                size_t offset = 0;
+                while (offset + 16 <= size_)
+                {
+                    uint32_t record_magic;
+                    uint32_t record_version;
+                    int64_t record_size;
+                    std::memcpy(&record_magic, data_ + offset, sizeof(record_magic));
+                    std::memcpy(&record_version, data_ + offset + 4, sizeof(record_version));
+                    std::memcpy(&record_size, data_ + offset + 8, sizeof(record_size));
+                    if (record_magic != magic || record_version != version || record_size < 16 || size_t(record_size) > size_ - offset)
+                        break;
+                    record_offsets_.push_back(offset);
+                    offset += record_size;
+                }
+                return true;
+            }
+
+            void SolutionLog::Close()
+            {
+                if (data_ != nullptr)
+                    munmap(const_cast<uint8_t *>(data_), size_);
+                data_ = nullptr;
+                size_ = 0;
+                record_offsets_.clear();
+            }
+
+            bool SolutionLog::ReadSolution(size_t index, std::vector<solution_segment_data_t> &solution_segments,
+                                           std::vector<std::vector<constraint_metadata_t>> &constraint_metadata)
+            {
+                if (index >= record_offsets_.size())
+                    return false;
+                int64_t record_size;
+                std::memcpy(&record_size, data_ + record_offsets_[index] + 8, sizeof(record_size));
+                cursor_t cursor{data_ + record_offsets_[index], size_t(record_size), 16};
+
+                /*Every count is bounded by the fields left in the record before anything is resized, as each element takes at least
+                one field: a segment takes 15 and a constraint 4*/
+                int64_t num_segments;
+                int64_t num_constraint_segments;
+                if (!readCount(cursor, num_segments, 15) || !readCount(cursor, num_constraint_segments, 1))
+                    return false;
+
+                solution_segments.resize(num_segments);
+                for (solution_segment_data_t &segment : solution_segments)
+                {
+                    int64_t num_knots, state_degree, input_degree;
+                    int64_t num_state_times, state_rows, state_cols, num_input_times, input_rows, input_cols;
+                    if (!readDoubles(cursor, &segment.initial_time, 1) || !readDoubles(cursor, &segment.end_time, 1) ||
+                        !readInt(cursor, num_knots) || !readInt(cursor, state_degree) || !readInt(cursor, input_degree) ||
+                        !readPolynomial(cursor, segment.state_poly) || !readPolynomial(cursor, segment.input_poly) ||
+                        !readInt(cursor, num_state_times) || !readInt(cursor, state_rows) || !readInt(cursor, state_cols) ||
+                        !readInt(cursor, num_input_times) || !readInt(cursor, input_rows) || !readInt(cursor, input_cols))
+                        return false;
+                    if (num_knots < 0 || num_knots > INT32_MAX || state_degree < 0 || state_degree > max_degree || input_degree < 0 || input_degree > max_degree)
+                        return false;
+                    segment.num_knots = num_knots;
+                    segment.state_degree = state_degree;
+                    segment.input_degree = input_degree;
+
+                    /*The sizes are checked against the rest of the record one block at a time, as each block is read before the next*/
+                    if (!fitsDoubles(cursor, num_state_times, 1))
+                        return false;
+                    segment.state_times.resize(num_state_times);
+                    if (!readDoubles(cursor, segment.state_times.data(), segment.state_times.size()) || !fitsDoubles(cursor, state_rows, state_cols))
+                        return false;
+                    segment.solx_segment.resize(state_rows, state_cols);
+                    if (!readDoubles(cursor, segment.solx_segment.data(), segment.solx_segment.size()) || !fitsDoubles(cursor, num_input_times, 1))
+                        return false;
+                    segment.input_times.resize(num_input_times);
+                    if (!readDoubles(cursor, segment.input_times.data(), segment.input_times.size()) || !fitsDoubles(cursor, input_rows, input_cols))
+                        return false;
+                    segment.solu_segment.resize(input_rows, input_cols);
+                    if (!readDoubles(cursor, segment.solu_segment.data(), segment.solu_segment.size()))
+                        return false;
+                }
+
+                constraint_metadata.resize(num_constraint_segments);
+                for (std::vector<constraint_metadata_t> &metadatas : constraint_metadata)
+                {
+                    int64_t num_constraints;
+                    if (!readCount(cursor, num_constraints, 4))
+                        return false;
+                    metadatas.resize(num_constraints);
+                    for (constraint_metadata_t &metadata : metadatas)
+                    {
+                        int64_t num_groupings;
+                        if (!readString(cursor, metadata.name) || !readCount(cursor, num_groupings, 2))
+                            return false;
+                        metadata.plot_groupings.resize(num_groupings);
+                        for (tuple_size_t &grouping : metadata.plot_groupings)
+                        {
+                            int64_t first, last;
+                            if (!readInt(cursor, first) || !readInt(cursor, last))
+                                return false;
+                            grouping = tuple_size_t(first, last);
+                        }
+
+                        int64_t num_titles;
+                        if (!readCount(cursor, num_titles, 1))
+                            return false;
+                        metadata.plot_titles.resize(num_titles);
+                        for (std::string &title : metadata.plot_titles)
+                        {
+                            if (!readString(cursor, title))
+                                return false;
+                        }
+
+                        int64_t num_plots;
+                        if (!readCount(cursor, num_plots, 1))
+                            return false;
+                        metadata.plot_names.resize(num_plots);
+                        for (std::vector<std::string> &names : metadata.plot_names)
+                        {
+                            int64_t num_names;
+                            if (!readCount(cursor, num_names, 1))
+                                return false;
+                            names.resize(num_names);
+                            for (std::string &name : names)
+                            {
+                                if (!readString(cursor, name))
+                                    return false;
+                            }
+                        }
+                    }
+                }
+                return true;
+            }
+
+            bool SolutionLog::LoadSolution(size_t index, Solution &solution)
+            {
+                std::vector<solution_segment_data_t> solution_segments;
+                std::vector<std::vector<constraint_metadata_t>> constraint_metadata;
+                if (!ReadSolution(index, solution_segments, constraint_metadata))
+                    return false;
+                solution.UpdateSolution(solution_segments);
+                return true;
+            }
+
+            void SolutionLog::writeInt(std::vector<uint8_t> &record, int64_t value)
+            {
+                size_t offset = record.size();
+                record.resize(offset + sizeof(value));
+                std::memcpy(record.data() + offset, &value, sizeof(value));
+            }
+
+            void SolutionLog::writeDoubles(std::vector<uint8_t> &record, const double *values, size_t size)
+            {
+                size_t offset = record.size();
+                record.resize(offset + size * sizeof(double));
+                if (size > 0)
+                    std::memcpy(record.data() + offset, values, size * sizeof(double));
+            }
+
+            void SolutionLog::writeString(std::vector<uint8_t> &record, const std::string &value)
+            {
+                writeInt(record, value.size());
+                size_t offset = record.size();
+                record.resize(offset + (value.size() + 7) / 8 * 8, 0);
+                std::memcpy(record.data() + offset, value.data(), value.size());
+            }
+
+            bool SolutionLog::readInt(cursor_t &cursor, int64_t &value)
+            {
+                if (cursor.size - cursor.offset < sizeof(value))
+                    return false;
+                std::memcpy(&value, cursor.data + cursor.offset, sizeof(value));
+                cursor.offset += sizeof(value);
+                return true;
+            }
+
+            bool SolutionLog::readCount(cursor_t &cursor, int64_t &count, size_t min_fields)
+            {
+                return readInt(cursor, count) && count >= 0 && size_t(count) <= (cursor.size - cursor.offset) / sizeof(int64_t) / min_fields;
+            }
+
+            bool SolutionLog::fitsDoubles(const cursor_t &cursor, int64_t rows, int64_t cols)
+            {
+                if (rows < 0 || cols < 0)
+                    return false;
+                size_t remaining = (cursor.size - cursor.offset) / sizeof(double);
+                return size_t(rows) <= remaining && (rows == 0 || size_t(cols) <= remaining / size_t(rows));
+            }
+
+            bool SolutionLog::readDoubles(cursor_t &cursor, double *values, size_t size)
+            {
+                if ((cursor.size - cursor.offset) / sizeof(double) < size)
+                    return false;
+                if (size > 0)
+                    std::memcpy(values, cursor.data + cursor.offset, size * sizeof(double));
+                cursor.offset += size * sizeof(double);
+                return true;
+            }
+
+            bool SolutionLog::readString(cursor_t &cursor, std::string &value)
+            {
+                int64_t length;
+                if (!readInt(cursor, length) || length < 0 || size_t(length) > cursor.size - cursor.offset)
+                    return false;
+                size_t padded_length = (length + 7) / 8 * 8;
+                if (padded_length > cursor.size - cursor.offset)
+                    return false;
+                value.assign(reinterpret_cast<const char *>(cursor.data + cursor.offset), length);
+                cursor.offset += padded_length;
+                return true;
+            }
+
+            bool SolutionLog::readPolynomial(cursor_t &cursor, LagrangePolynomial &poly)
+            {
+                int64_t degree;
+                std::string scheme;
+                if (!readInt(cursor, degree) || degree < 0 || degree > max_degree || !readString(cursor, scheme))
+                    return false;
+                /*Only the schemes casadi has collocation points for are built*/
+                if (scheme != "radau" && scheme != "legendre")
+                    return false;
+                auto key = std::make_pair(degree, scheme);
+                auto it = polynomials_.find(key);
+                if (it == polynomials_.end())
+                    it = polynomials_.emplace(key, LagrangePolynomial(degree, scheme)).first;
+                poly = it->second;
+                return true;
+            }
+        }
+    }
+}